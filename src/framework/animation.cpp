@@ -6,52 +6,170 @@
 #include "camera.h"
 #include "graphics/shader.h"
 #include "graphics/mesh.h"
+#include "animation_manager.h"
+#include "mapped_file.h"
 
 #include <sys/stat.h>
 
-Skeleton::Skeleton()
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	#define ANIMATION_USE_SSE
+	#include <emmintrin.h>
+#endif
+
+std::vector<Rig*> Rig::sRigsLoaded;
+
+Rig::Rig()
 {
 	num_bones = 0;
+	layout = 0;
+	memset(bones, 0, sizeof(bones));
 }
 
-Skeleton::Bone* Skeleton::getBone(const char* name)
+Rig::Bone* Rig::getBone(const char* name)
 {
-	auto it = bones_by_name.find(name);
-	if (it == bones_by_name.end())
+	int index = getBoneIndex(name);
+	if (index == -1)
 		return NULL;
-	return &bones[it->second];
+	return &bones[index];
 }
 
-Matrix44& Skeleton::getBoneMatrix(const char* name, bool local)
+int Rig::getBoneIndex(const char* name)
 {
-	static Matrix44 none;
 	auto it = bones_by_name.find(name);
 	if (it == bones_by_name.end())
-		return none;
-	if (local)
-		return bones[it->second].model;
-	return global_bone_matrices[it->second];
+		return -1;
+	return it->second;
 }
 
-void Skeleton::computeFinalBoneMatrices(std::vector<Matrix44>& bone_matrices, Mesh* mesh)
+void Rig::assignLayer(Bone* bone, uint8 layer)
+{
+	if (!bone)
+		return;
+	if (layer)
+		bone->layer |= layer;
+	else
+		bone->layer = 0;
+	for (int i = 0; i < bone->num_children; ++i)
+	{
+		Bone* child = &bones[bone->children[i]];
+		assignLayer(child, layer);
+	}
+}
+
+void Rig::update()
+{
+	//FNV-1a of the names in order
+	layout = 2166136261u;
+	bones_by_name.clear();
+	rest_translations.resize(num_bones);
+	rest_rotations.resize(num_bones);
+	rest_scales.resize(num_bones);
+	for (int i = 0; i < num_bones; ++i)
+	{
+		bones_by_name[bones[i].name] = i;
+		for (const char* c = bones[i].name; *c; ++c)
+			layout = (layout ^ (unsigned char)*c) * 16777619u;
+		layout = (layout ^ 0xFF) * 16777619u; //separator
+		bones[i].model.decompose(rest_translations[i], rest_rotations[i], rest_scales[i]);
+	}
+}
+
+Rig* Rig::GetShared(Rig* rig)
 {
-	assert(mesh);
+	assert(rig);
+	for (Rig* loaded : sRigsLoaded)
+		if (loaded->layout == rig->layout && loaded->num_bones == rig->num_bones &&
+			memcmp(loaded->bones, rig->bones, sizeof(Bone) * rig->num_bones) == 0)
+		{
+			delete rig;
+			return loaded;
+		}
+	sRigsLoaded.push_back(rig);
+	return rig;
+}
+
+std::atomic<unsigned int> Skeleton::last_version(0);
 
+Skeleton::Skeleton()
+{
+	rig = NULL;
+	num_bones = 0;
+	version = 0;
+}
+
+void Skeleton::setRig(Rig* rig)
+{
+	assert(rig);
+	this->rig = rig;
+	num_bones = rig->num_bones;
+	translations = rig->rest_translations;
+	rotations = rig->rest_rotations;
+	scales = rig->rest_scales;
+	global_bone_matrices.resize(num_bones);
 	updateGlobalMatrices();
+}
+
+Matrix44 Skeleton::getBoneMatrix(const char* name, bool local)
+{
+	int index = getBoneIndex(name);
+	if (index == -1)
+		return Matrix44();
+	if (!local)
+		return global_bone_matrices[index];
+	Matrix44 m;
+	m.compose(translations[index], rotations[index], scales[index]);
+	return m;
+}
+
+void Skeleton::computeFinalBoneMatrices(std::vector<Matrix44>& bone_matrices, Mesh* mesh)
+{
+	assert(mesh && rig);
+
+	//the animations already update them, only skeletons never posed need it
+	if (!version)
+		updateGlobalMatrices();
 
-	bone_matrices.resize(mesh->bones_info.size());
-#pragma omp for  
-	for (int i = 0; i < (int)mesh->bones_info.size(); ++i)
+	//bone indices and bind transforms are resolved once per mesh and rig
+	const sBoneRemap& remap = mesh->getBoneRemap(this);
+	bone_matrices.resize(remap.indices.size());
+	for (int i = 0; i < (int)remap.indices.size(); ++i)
+	{
+		int index = remap.indices[i];
+		bone_matrices[i] = index != -1 ? remap.offsets[i] * global_bone_matrices[index] : remap.offsets[i];
+	}
+}
+
+//normalized lerp of count quaternions, taking the short path
+static void blendRotations(const Quaternion* a, const Quaternion* b, float w, Quaternion* result, int count)
+{
+#ifdef ANIMATION_USE_SSE
+	const __m128 wa = _mm_set1_ps(1.0f - w);
+	const __m128 wb = _mm_set1_ps(w);
+	const __m128 sign_mask = _mm_set1_ps(-0.0f);
+	for (int i = 0; i < count; ++i)
 	{
-		BoneInfo& bone_info = mesh->bones_info[i];
-		bone_matrices[i] = mesh->bind_matrix * bone_info.bind_pose * getBoneMatrix(bone_info.name, false); //use globals
+		__m128 qa = _mm_loadu_ps(a[i].q);
+		__m128 qb = _mm_loadu_ps(b[i].q);
+		//dot in all the lanes, its sign flips b
+		__m128 dot = _mm_mul_ps(qa, qb);
+		dot = _mm_add_ps(dot, _mm_shuffle_ps(dot, dot, _MM_SHUFFLE(2, 3, 0, 1)));
+		dot = _mm_add_ps(dot, _mm_shuffle_ps(dot, dot, _MM_SHUFFLE(1, 0, 3, 2)));
+		__m128 q = _mm_add_ps(_mm_mul_ps(qa, wa), _mm_mul_ps(qb, _mm_xor_ps(wb, _mm_and_ps(dot, sign_mask))));
+		__m128 length = _mm_mul_ps(q, q);
+		length = _mm_add_ps(length, _mm_shuffle_ps(length, length, _MM_SHUFFLE(2, 3, 0, 1)));
+		length = _mm_add_ps(length, _mm_shuffle_ps(length, length, _MM_SHUFFLE(1, 0, 3, 2)));
+		_mm_storeu_ps(result[i].q, _mm_div_ps(q, _mm_sqrt_ps(length)));
 	}
+#else
+	for (int i = 0; i < count; ++i)
+		result[i] = Qlerp(a[i], b[i], w);
+#endif
 }
 
 void blendSkeleton(Skeleton* a, Skeleton* b, float w, Skeleton* result, uint8 layer)
 {
 	assert(a && b && result && "skeleton cannot be NULL");
-	assert(a->num_bones == b->num_bones && "skeleton must contain the same number of bones");
+	assert(a->rig && a->num_bones == b->num_bones && "skeleton must contain the same number of bones");
 
 	w = clamp(w, 0.0f, 1.0f);//safety
 
@@ -71,43 +189,32 @@ void blendSkeleton(Skeleton* a, Skeleton* b, float w, Skeleton* result, uint8 la
 		}
 	}
 
-	if (result != a) //copy bone names
-	{
-		memcpy(result->bones, a->bones, sizeof(result->bones)); //copy skeleton structure
-		result->bones_by_name = a->bones_by_name;
-		result->num_bones = a->num_bones;
-	}
+	if (result->rig != a->rig) //bones outside the layer keep the rest pose
+		result->setRig(a->rig);
 
-	//blend bones locally
-#pragma omp for  
-	for (int i = 0; i < result->num_bones; ++i)
+	//blend the local poses, all in linear arrays
+	const Rig::Bone* bones = a->rig->bones;
+	const int num_bones = a->num_bones;
+	if (layer == 0xFF)
 	{
-		Skeleton::Bone& bone = result->bones[i];
-		Skeleton::Bone& boneA = a->bones[i];
-		Skeleton::Bone& boneB = b->bones[i];
-		if (layer != 0xFF && !(bone.layer & layer)) //not in the same layer
-			continue;
-
-		Vector3 translationA, scaleA;
-		Quaternion rotationA;
-		boneA.model.decompose(translationA, rotationA, scaleA);
-
-		Vector3 translationB, scaleB;
-		Quaternion rotationB;
-		boneB.model.decompose(translationB, rotationB, scaleB);
-
-		// blend components
-		Vector3 translation = lerp(translationA, translationB, w);
-		Quaternion rotation = Qslerp(rotationA, rotationB, w);
-		Vector3 scale = lerp(scaleA, scaleB, w);
-
-		// compose final matrix
-		bone.model.compose(translation, rotation, scale);
-
-		//#pragma omp for
-		//for (int j = 0; j < 16; ++j)
-		//	bone.model.m[j] = lerp(boneA.model.m[j], boneB.model.m[j], w);
+		for (int i = 0; i < num_bones; ++i)
+		{
+			result->translations[i] = lerp(a->translations[i], b->translations[i], w);
+			result->scales[i] = lerp(a->scales[i], b->scales[i], w);
+		}
+		blendRotations(&a->rotations[0], &b->rotations[0], w, &result->rotations[0], num_bones);
 	}
+	else
+		for (int i = 0; i < num_bones; ++i)
+		{
+			if (!(bones[i].layer & layer)) //not in the same layer
+				continue;
+			result->translations[i] = lerp(a->translations[i], b->translations[i], w);
+			result->rotations[i] = Qlerp(a->rotations[i], b->rotations[i], w);
+			result->scales[i] = lerp(a->scales[i], b->scales[i], w);
+		}
+
+	result->updateGlobalMatrices();
 }
 
 void Skeleton::renderSkeleton(Camera* camera, Matrix44 model, Vector4 color, bool render_points)
@@ -116,7 +223,7 @@ void Skeleton::renderSkeleton(Camera* camera, Matrix44 model, Vector4 color, boo
 
 	for (int i = 1; i < num_bones; ++i)
 	{
-		Bone& bone = bones[i];
+		const Rig::Bone& bone = rig->bones[i];
 		Vector3 v1;
 		Vector3 v2;
 		Matrix44 parent_global_matrix = global_bone_matrices[bone.parent];
@@ -126,16 +233,15 @@ void Skeleton::renderSkeleton(Camera* camera, Matrix44 model, Vector4 color, boo
 		m.vertices.push_back(v1);
 		m.vertices.push_back(v2);
 	}
-
 	Shader* shader = Shader::getDefaultShader("flat");
 	shader->enable();
-	shader->setUniform("u_viewprojection", camera->viewprojection_matrix);
-	shader->setUniform("u_model", model);
-	shader->setUniform("u_color", color);
+	shader->setUniform(UNIFORM("u_viewprojection"), camera->viewprojection_matrix);
+	shader->setUniform(UNIFORM("u_model"), model);
+	shader->setUniform(UNIFORM("u_color"), color);
 	m.render(GL_LINES);
 	if (render_points)
 	{
-		shader->setUniform("u_color", color * 2);
+		shader->setUniform(UNIFORM("u_color"), color * 2);
 		glPointSize(10);
 		m.render(GL_POINTS);
 		glPointSize(1);
@@ -145,56 +251,58 @@ void Skeleton::renderSkeleton(Camera* camera, Matrix44 model, Vector4 color, boo
 
 void Skeleton::applyTransformToBones(const char* root, Matrix44 transform)
 {
-	Bone* bone = getBone(root);
-	if (!bone)
+	int index = getBoneIndex(root);
+	if (index == -1)
 		return;
-	bone->model = bone->model * transform;
+	Matrix44 model = getBoneMatrix(root) * transform;
+	model.decompose(translations[index], rotations[index], scales[index]);
+	updateGlobalMatrices();
 }
 
 void Skeleton::updateGlobalMatrices()
 {
-	//compute global matrices
-	global_bone_matrices[0] = bones[0].model;
-	//order dependant
+	if (!num_bones)
+		return;
+
+	//compute global matrices, order dependant
+	const Rig::Bone* bones = rig->bones;
+	global_bone_matrices[0].compose(translations[0], rotations[0], scales[0]);
 	for (int i = 1; i < num_bones; ++i)
 	{
-		Skeleton::Bone& bone = bones[i];
-		global_bone_matrices[i] = bone.model * global_bone_matrices[bone.parent];
+		Matrix44 local;
+		local.compose(translations[i], rotations[i], scales[i]);
+		global_bone_matrices[i] = local * global_bone_matrices[bones[i].parent];
 	}
+	version = ++last_version;
+	if (!version) //wrapped, 0 is reserved
+		version = ++last_version;
 }
 
-void Skeleton::assignLayer(Bone* bone, uint8 layer)
-{
-	if (!bone)
-		return;
-	if (layer)
-		bone->layer |= layer;
-	else
-		bone->layer = 0;
-	for (int i = 0; i < bone->num_children; ++i)
-	{
-		Bone* child = &bones[bone->children[i]];
-		assignLayer(child, layer);
-	}
-}
+bool Animation::reduce_keys = true;
 
 Animation::Animation()
 {
 	duration = 0.0f;
-	keyframes = NULL;
+	samples_per_second = 0.0f;
 	num_keyframes = 0;
 	num_animated_bones = 0;
 }
 
 Animation::~Animation()
 {
-	if (keyframes)
-		delete[] keyframes;
+	delete mapped_file;
 }
 
 void Animation::assignTime(float t, bool loop, bool interpolate, uint8 layers)
 {
-	assert(keyframes && skeleton.num_bones);
+	sample(t, skeleton, loop, interpolate, layers);
+}
+
+void Animation::sample(float t, Skeleton& pose, bool loop, bool interpolate, uint8 layers)
+{
+	assert(num_channels && skeleton.num_bones);
+	if (pose.rig != skeleton.rig)
+		pose.setRig(skeleton.rig);
 
 	if (loop)
 	{
@@ -205,34 +313,62 @@ void Animation::assignTime(float t, bool loop, bool interpolate, uint8 layers)
 	else
 		t = clamp(t, 0.0f, duration - (1.0f / samples_per_second));
 	float v = samples_per_second * t;
-	int index = (int)clamp(floor(v), 0.0f, (float)(num_keyframes - 1));
-	int index2 = index + 1;
-	if (index2 >= num_keyframes)
-		index2 = 0;
-	float f = v - floor(v);
+	float index = clamp(floor(v), 0.0f, (float)(num_keyframes - 1));
+	float frame = interpolate ? index + (v - floor(v)) : index;
 
-	Matrix44* k = keyframes + index * num_animated_bones;
-	Matrix44* k2 = keyframes + index2 * num_animated_bones;
-
-	//compute local bones
-#pragma omp for  
+	//sample the local poses straight from the tracks
+	const sAnimKey* k = keys;
+	const uint16* f = key_frames;
 	for (int i = 0; i < num_animated_bones; ++i)
 	{
 		int bone_index = bones_map[i];
-		Skeleton::Bone& bone = skeleton.bones[bone_index];
-		if (layers != 0xFF && !(bone.layer & layers))
+		if (layers != 0xFF && !(pose.rig->bones[bone_index].layer & layers))
 			continue;
-		for (int j = 0; j < 16; ++j)
-			bone.model.m[j] = lerp(k[i].m[j], k2[i].m[j], f);
+		const sAnimChannel* channel = &channels[i * ANIM_NUM_CHANNELS];
+		pose.translations[bone_index] = sampleVector(channel[ANIM_TRANSLATION], k, f, frame, num_keyframes);
+		pose.rotations[bone_index] = sampleRotation(channel[ANIM_ROTATION], k, f, frame, num_keyframes);
+		pose.scales[bone_index] = sampleVector(channel[ANIM_SCALE], k, f, frame, num_keyframes);
 	}
 
-	skeleton.updateGlobalMatrices();
+	pose.updateGlobalMatrices();
+}
+
+void Animation::setKeyframes(const Matrix44* keyframes)
+{
+	compressKeyframes(keyframes, num_keyframes, num_animated_bones, reduce_keys, channels_storage, keys_storage, key_frames_storage);
+	useStorage();
+}
+
+void Animation::useStorage()
+{
+	delete mapped_file;
+	mapped_file = nullptr;
+	channels = channels_storage.data();
+	keys = keys_storage.data();
+	key_frames = key_frames_storage.data();
+	num_channels = (int)channels_storage.size();
+	num_keys = (int)keys_storage.size();
+}
+
+size_t Animation::getMemorySize() const
+{
+	return num_channels * sizeof(sAnimChannel) + num_keys * (sizeof(sAnimKey) + sizeof(uint16));
 }
 
 void Animation::operator = (Animation* anim)
 {
-	memcpy(this, anim, sizeof(Animation));
-	this->keyframes = NULL;
+	skeleton = anim->skeleton;
+	name = anim->name;
+	duration = anim->duration;
+	samples_per_second = anim->samples_per_second;
+	num_animated_bones = anim->num_animated_bones;
+	num_keyframes = anim->num_keyframes;
+	memcpy(bones_map, anim->bones_map, sizeof(bones_map));
+	//the mapping belongs to the other one
+	channels_storage.assign(anim->channels, anim->channels + anim->num_channels);
+	keys_storage.assign(anim->keys, anim->keys + anim->num_keys);
+	key_frames_storage.assign(anim->key_frames, anim->key_frames + anim->num_keys);
+	useStorage();
 }
 
 bool Animation::load(const char* filename)
@@ -248,20 +384,31 @@ bool Animation::load(const char* filename)
 	{
 		if (!loadABIN(filename))
 			return false;
+		std::cout << "[OK BIN] ";
 	}
-	else //not a bin, try to load in ASCII
+	else
 	{
-		if (!loadSKANIM(filename))
+		//the cache is used while it is newer than the text, loadABIN rejects old versions
+		std::string binfilename = name + ".abin";
+		long long source_time = MappedFile::getModificationTime(filename);
+		long long bin_time = MappedFile::getModificationTime(binfilename.c_str());
+		if (bin_time && bin_time >= source_time && loadABIN(binfilename.c_str()))
+			std::cout << "[OK BIN] ";
+		else //not a valid bin, load the ASCII
 		{
-			std::cout << " [ERROR]: File not found" << std::endl;
-			return false;
-		}
+			if (!loadSKANIM(filename))
+			{
+				std::cout << " [ERROR]: File not found" << std::endl;
+				return false;
+			}
 
-		std::cout << "[Writing .ABIN] ... ";
-		writeABIN(filename);
+			std::cout << "[Writing .ABIN] ... ";
+			writeABIN(binfilename.c_str());
+		}
 	}
 
-	std::cout << "[OK] Num. Bones: " << skeleton.num_bones << " Time: " << (getTime() - time) * 0.001 << "sec" << std::endl;
+	size_t raw_size = sizeof(Matrix44) * num_keyframes * num_animated_bones;
+	std::cout << "[OK] Num. Bones: " << skeleton.num_bones << " Keys: " << getMemorySize() / 1024 << "KB (" << raw_size / 1024 << "KB as matrices) Time: " << (getTime() - time) * 0.001 << "sec" << std::endl;
 	return true;
 }
 
@@ -274,18 +421,17 @@ struct sAnimHeader {
 	int num_keyframes;
 	int num_bones;
 	int8 bones_map[128];
-	char extra[16];
+	int num_channels;
+	int num_keys;
+	char extra[8];
 };
 
 bool Animation::writeABIN(const char* filename)
 {
-	std::string s_filename = filename;
-	s_filename += ".abin";
-
-	FILE* f = fopen(s_filename.c_str(), "wb");
+	FILE* f = fopen(filename, "wb");
 	if (f == NULL)
 	{
-		std::cout << "[ERROR] cannot write BIN: " << s_filename.c_str() << std::endl;
+		std::cout << "[ERROR] cannot write BIN: " << filename << std::endl;
 		return false;
 	}
 
@@ -293,6 +439,7 @@ bool Animation::writeABIN(const char* filename)
 	fwrite("ABIN", sizeof(char), 4, f);
 
 	sAnimHeader header;
+	memset(&header, 0, sizeof(header));
 	header.version = ANIM_BIN_VERSION;
 	header.header_bytes = sizeof(header);
 	header.duration = duration;
@@ -301,15 +448,19 @@ bool Animation::writeABIN(const char* filename)
 	header.num_keyframes = num_keyframes;
 	header.num_bones = skeleton.num_bones;
 	memcpy(header.bones_map, bones_map, sizeof(bones_map));
+	header.num_channels = num_channels;
+	header.num_keys = num_keys;
 
 	//write header
 	fwrite((void*)&header, sizeof(sAnimHeader), 1, f);
 
 	//write skeleton
-	fwrite((void*)skeleton.bones, sizeof(skeleton.bones), 1, f);
+	fwrite((void*)skeleton.rig->bones, sizeof(skeleton.rig->bones), 1, f);
 
-	//write keyframes
-	fwrite((void*)keyframes, sizeof(Matrix44) * num_keyframes * num_animated_bones, 1, f);
+	//write tracks, in the layout they are used once mapped
+	fwrite((void*)channels, sizeof(sAnimChannel) * num_channels, 1, f);
+	fwrite((void*)keys, sizeof(sAnimKey) * num_keys, 1, f);
+	fwrite((void*)key_frames, sizeof(uint16) * num_keys, 1, f);
 
 	fclose(f);
 	return true;
@@ -317,36 +468,36 @@ bool Animation::writeABIN(const char* filename)
 
 bool Animation::loadABIN(const char* filename)
 {
-	FILE* f;
 	assert(filename);
 
-	struct stat stbuffer;
-
-	stat(filename, &stbuffer);
-	f = fopen(filename, "rb");
-	if (f == NULL)
+	MappedFile* file = new MappedFile();
+	if (!file->open(filename))
+	{
+		delete file;
 		return false;
+	}
 
-	unsigned int size = (unsigned int)stbuffer.st_size;
-	char* data = new char[size];
-	fread(data, size, 1, f);
-	fclose(f);
+	const uint8* data = file->data;
+	size_t header_size = 4 + sizeof(sAnimHeader) + sizeof(Rig::bones);
 
 	//watermark
-	if (memcmp(data, "ABIN", 4) != 0)
+	if (file->size < header_size || memcmp(data, "ABIN", 4) != 0)
 	{
 		std::cout << "[ERROR] loading BIN: invalid content: " << filename << std::endl;
+		delete file;
 		return false;
 	}
 
-	char* pos = data + 4;
+	const uint8* pos = data + 4;
 	sAnimHeader header;
 	memcpy(&header, pos, sizeof(sAnimHeader));
 	pos += sizeof(sAnimHeader);
 
-	if (header.version != ANIM_BIN_VERSION || header.header_bytes != sizeof(sAnimHeader))
+	size_t tracks_size = sizeof(sAnimChannel) * header.num_channels + (sizeof(sAnimKey) + sizeof(uint16)) * header.num_keys;
+	if (header.version != ANIM_BIN_VERSION || header.header_bytes != sizeof(sAnimHeader) || file->size != header_size + tracks_size)
 	{
 		std::cout << "[WARN] loading BIN: old version: " << filename << std::endl;
+		delete file;
 		return false;
 	}
 
@@ -355,24 +506,32 @@ bool Animation::loadABIN(const char* filename)
 	samples_per_second = header.samples_per_second;
 	num_animated_bones = header.num_animated_bones;
 	num_keyframes = header.num_keyframes;
-	skeleton.num_bones = header.num_bones;
+	Rig* rig = new Rig();
+	rig->num_bones = header.num_bones;
 	memcpy(bones_map, header.bones_map, sizeof(bones_map));
 
-	//extract skeleton
-	memcpy(skeleton.bones, pos, sizeof(skeleton.bones));
-	pos += sizeof(skeleton.bones);
-
-	//extract keyframes
-	assert(keyframes == NULL);
-	keyframes = new Matrix44[num_keyframes * num_animated_bones];
-	memcpy(keyframes, pos, sizeof(Matrix44) * num_keyframes * num_animated_bones);
-	pos += sizeof(Matrix44) * num_keyframes * num_animated_bones;
-
-	//compute bone names map
-	for (int i = 0; i < skeleton.num_bones; ++i)
-		skeleton.bones_by_name[skeleton.bones[i].name] = i;
-
-	delete[] data;
+	//extract skeleton, it may be shared with the other animations
+	memcpy(rig->bones, pos, sizeof(rig->bones));
+	pos += sizeof(rig->bones);
+
+	//the tracks are used in place, the pages are only read when sampled
+	assert((size_t)(pos - data) % alignof(sAnimChannel) == 0);
+	delete mapped_file;
+	mapped_file = file;
+	channels_storage.clear();
+	keys_storage.clear();
+	key_frames_storage.clear();
+	num_channels = header.num_channels;
+	num_keys = header.num_keys;
+	channels = (const sAnimChannel*)pos;
+	pos += sizeof(sAnimChannel) * num_channels;
+	keys = (const sAnimKey*)pos;
+	pos += sizeof(sAnimKey) * num_keys;
+	key_frames = (const uint16*)pos;
+
+	//compute bone names map and share the rig
+	rig->update();
+	skeleton.setRig(Rig::GetShared(rig));
 	return true;
 }
 
@@ -393,7 +552,7 @@ bool Animation::loadSKANIM(const char* filename)
 	data[size] = 0;
 	char* pos = data;
 	char word[255];
-	memset(&skeleton.bones, 0, sizeof(skeleton.bones)); //clear
+	Rig* rig = new Rig(); //cleared
 
 	//duration in seconds, samples per second, num. samples, number of bones in the skeleton, number of animated bones
 	std::vector<float> header;
@@ -401,11 +560,12 @@ bool Animation::loadSKANIM(const char* filename)
 	duration = header[0];
 	samples_per_second = header[1];
 	num_keyframes = (int)header[2];
-	skeleton.num_bones = (int)header[3];
-	assert(skeleton.num_bones < 128); //MAX_BONES
+	rig->num_bones = (int)header[3];
+	assert(rig->num_bones < 128); //MAX_BONES
 	num_animated_bones = 0;
 
 	int current_keyframe = 0;
+	std::vector<Matrix44> keyframes; //compressed at the end
 
 	while (*pos)
 	{
@@ -420,7 +580,7 @@ bool Animation::loadSKANIM(const char* filename)
 		{
 			pos = fetchWord(pos, word);
 			int index = (int)atof(word);
-			Skeleton::Bone& bone = skeleton.bones[index];
+			Rig::Bone& bone = rig->bones[index];
 			pos = fetchWord(pos, bone.name);
 			//std::cout << bone.name << std::endl;
 			pos = fetchWord(pos, word);
@@ -428,7 +588,7 @@ bool Animation::loadSKANIM(const char* filename)
 			bone.parent = parent_index;
 			if (bone.parent != -1)
 			{
-				Skeleton::Bone& parent_bone = skeleton.bones[bone.parent];
+				Rig::Bone& parent_bone = rig->bones[bone.parent];
 				assert(parent_bone.num_children < 16);
 				parent_bone.children[parent_bone.num_children++] = index;
 			}
@@ -442,14 +602,14 @@ bool Animation::loadSKANIM(const char* filename)
 			for (int j = 0; j < (int)bones_map_info.size(); ++j)
 				bones_map[j] = (int8)bones_map_info[j];
 			num_animated_bones = (int)bones_map_info.size();
-			assert(keyframes == NULL);
-			keyframes = new Matrix44[num_animated_bones * num_keyframes];
+			keyframes.resize(num_animated_bones * num_keyframes);
 		}
 		else if (type == 'K')
 		{
 			pos = fetchWord(pos, word);
 			//float time = atof(word);
-			Matrix44* k = keyframes + current_keyframe * num_animated_bones;
+			assert(current_keyframe < num_keyframes);
+			Matrix44* k = &keyframes[current_keyframe * num_animated_bones];
 			current_keyframe++;
 			for (int j = 0; j < num_animated_bones; ++j)
 				pos = fetchMatrix44(pos, *(k + j));
@@ -458,26 +618,25 @@ bool Animation::loadSKANIM(const char* filename)
 			break; //end of file probably
 	}
 
-	for (int i = 0; i < skeleton.num_bones; ++i)
-	{
-		Skeleton::Bone& bone = skeleton.bones[i];
-		bone.layer = BODY;
-		skeleton.bones_by_name[bone.name] = i;
-	}
+	for (int i = 0; i < rig->num_bones; ++i)
+		rig->bones[i].layer = BODY;
+	rig->update();
 
 	//assign layers
-	Skeleton::Bone* hips = skeleton.getBone("mixamorig_Hips");
+	Rig::Bone* hips = rig->getBone("mixamorig_Hips");
 	if (hips)
 	{
 		hips->layer |= HIPS;
-		skeleton.assignLayer(hips, BODY);//force every bone to have a bit
-		skeleton.assignLayer(skeleton.getBone("mixamorig_Spine"), UPPER_BODY);
-		skeleton.assignLayer(skeleton.getBone("mixamorig_RightUpLeg"), LOWER_BODY | RIGHT_LEG);
-		skeleton.assignLayer(skeleton.getBone("mixamorig_LeftUpLeg"), LOWER_BODY | LEFT_LEG);
-		skeleton.assignLayer(skeleton.getBone("mixamorig_RightShoulder"), RIGHT_ARM);
-		skeleton.assignLayer(skeleton.getBone("mixamorig_LeftShoulder"), LEFT_ARM);
+		rig->assignLayer(hips, BODY);//force every bone to have a bit
+		rig->assignLayer(rig->getBone("mixamorig_Spine"), UPPER_BODY);
+		rig->assignLayer(rig->getBone("mixamorig_RightUpLeg"), LOWER_BODY | RIGHT_LEG);
+		rig->assignLayer(rig->getBone("mixamorig_LeftUpLeg"), LOWER_BODY | LEFT_LEG);
+		rig->assignLayer(rig->getBone("mixamorig_RightShoulder"), RIGHT_ARM);
+		rig->assignLayer(rig->getBone("mixamorig_LeftShoulder"), LEFT_ARM);
 	}
 
+	setKeyframes(&keyframes[0]);
+	skeleton.setRig(Rig::GetShared(rig)); //the animations of the same character share it
 	assignTime(0); //reset pose
 
 	delete[] data;
@@ -509,13 +668,37 @@ Animation* Animation::Get(const char* filename)
 
 Animator::~Animator()
 {
-	delete current_animation;
-	delete target_animation;
+	//the animations are shared, owned by Animation::sAnimationsLoaded
+	AnimationManager::Get()->remove(this);
+	releaseBonePalettes();
+}
+
+void Animator::setSkinnedMesh(Mesh* mesh)
+{
+	if (skinned_mesh != mesh)
+		releaseBonePalettes();
+	skinned_mesh = mesh;
+}
+
+void Animator::releaseBonePalettes()
+{
+	//the mesh keys its palettes by the address of our skeletons
+	if (!skinned_mesh)
+		return;
+	skinned_mesh->releaseBonePalette(&current_pose);
+	skinned_mesh->releaseBonePalette(&target_pose);
+	skinned_mesh->releaseBonePalette(&blended_skeleton);
 }
 
 void Animator::playAnimation(const char* path, bool loop, float transition, bool reset_time)
 {
-	Animation* new_animation = Animation::Get(path);
+	playAnimation(Animation::Get(path), loop, transition, reset_time);
+}
+
+void Animator::playAnimation(Animation* new_animation, bool loop, float transition, bool reset_time)
+{
+	if (!new_animation)
+		return;
 
 	if (current_animation) {
 
@@ -526,6 +709,8 @@ void Animator::playAnimation(const char* path, bool loop, float transition, bool
 
 		target_animation = new_animation;
 		must_play_loop = loop;
+		if (current_pose.rig)
+			blended_skeleton = current_pose; // shown until the first sample of the transition
 	}
 	else {
 		current_animation = new_animation;
@@ -540,8 +725,10 @@ void Animator::playAnimation(const char* path, bool loop, float transition, bool
 	}
 
 	if (loop) {
-		last_loop_animation = path;
+		last_loop_animation = new_animation;
 	}
+
+	needs_sample = true;
 }
 
 void Animator::stopAnimation()
@@ -549,11 +736,38 @@ void Animator::stopAnimation()
 	current_animation = nullptr;
 	target_animation = nullptr;
 	last_loop_animation = nullptr;
+	graph_state = -1;
+}
+
+void Animator::setGraph(AnimationGraph* graph)
+{
+	this->graph = graph;
+	graph_state = -1;
+	if (graph && graph->states.size())
+		setState(graph->default_state, 0.0f);
+}
+
+void Animator::setState(int state, float transition)
+{
+	if (!graph || state < 0 || state >= (int)graph->states.size())
+		return;
+	const sAnimState& info = graph->states[state];
+	graph_state = state;
+	speed = info.speed;
+	playAnimation(info.clip, info.loop, transition);
 }
 
 void Animator::update(float delta_time)
 {
-	time += delta_time;
+	// only floats by index, no lookups
+	if (graph && graph_state != -1)
+	{
+		int transition = graph->evaluate(graph_state, graph_values);
+		if (transition != -1)
+			setState(graph->transitions[transition].to, graph->transitions[transition].duration);
+	}
+
+	time += delta_time * speed;
 
 	if (!current_animation)
 		return;
@@ -569,25 +783,20 @@ void Animator::update(float delta_time)
 		playAnimation(last_loop_animation, true, 0.3f, false);
 	}
 
-	current_animation->assignTime(time, playing_loop);
+	// sampled later, only if the character is visible and due this frame
+	AnimationManager::Get()->add(this);
+	needs_sample = true;
 
 	if (target_animation) {
 
-		target_animation->assignTime(transition_counter, must_play_loop);
-
 		transition_counter += delta_time;
 
-		blendSkeleton(
-			&current_animation->skeleton,
-			&target_animation->skeleton,
-			transition_counter / transition_time,
-			&blended_skeleton);
-
 		if (transition_counter >= transition_time) {
 			current_animation = target_animation;
 			playing_loop = must_play_loop;
 			time = transition_counter; // continue where the transition ended..
 			target_animation = nullptr;
+			std::swap(current_pose, target_pose); // last pose of the new animation until the next sample
 			return;
 		}
 	}
@@ -611,7 +820,7 @@ void Animator::update(float delta_time)
 	{
 		cb.time_elapsed += std::max(t - last_time, 0.0f);
 
-		if (current_animation->name != cb.animation_name)
+		if (current_animation != cb.animation)
 			continue;
 
 		int keyframe = cb.keyframe;
@@ -637,19 +846,36 @@ void Animator::update(float delta_time)
 
 void Animator::addCallback(const std::string& filename, std::function<void(float)> callback, float time)
 {
-	callbacks.push_back({ filename, time, -1, callback });
+	callbacks.push_back({ Animation::Get(filename.c_str()), time, -1, callback });
 }
 
 void Animator::addCallback(const std::string& filename, std::function<void(float)> callback, int keyframe)
 {
-	callbacks.push_back({ filename, -1.0f, keyframe, callback });
+	callbacks.push_back({ Animation::Get(filename.c_str()), -1.0f, keyframe, callback });
 }
 
-Skeleton& Animator::getCurrentSkeleton()
+void Animator::sample()
 {
+	needs_sample = false;
+	if (!current_animation)
+		return;
+
+	current_animation->sample(time, current_pose, playing_loop);
+
 	if (target_animation) {
-		return blended_skeleton;
+		target_animation->sample(transition_counter, target_pose, must_play_loop);
+		blendSkeleton(
+			&current_pose,
+			&target_pose,
+			transition_time > 0.0f ? transition_counter / transition_time : 1.0f,
+			&blended_skeleton);
 	}
+}
 
-	return current_animation->skeleton;
+Skeleton& Animator::getCurrentSkeleton()
+{
+	Skeleton& skeleton = target_animation ? blended_skeleton : current_pose;
+	if (!skeleton.rig)
+		sample();
+	return skeleton;
 }
\ No newline at end of file
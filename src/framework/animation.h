@@ -1,13 +1,17 @@
 #pragma once
 
 #include "graphics/mesh.h"
+#include "animation_tracks.h"
+#include "animation_graph.h"
 #include <cstring>
 #include <algorithm>
 #include <functional>
+#include <atomic>
 
 class Camera;
+class MappedFile;
 
-#define ANIM_BIN_VERSION 3
+#define ANIM_BIN_VERSION 5
 
 //defined layers for every body
 enum BODY_LAYERS {
@@ -24,14 +28,14 @@ enum BODY_LAYERS {
 //used to compare bone names in the map
 struct cmp_str { bool operator()(char const *a, char const *b) const { return std::strcmp(a, b) < 0; } };
 
-//This class contains the bone structure hierarchy
-class Skeleton {
+//This class contains the bone structure hierarchy, shared by all the skeletons posed with it and never modified once loaded
+class Rig {
 public:
 	//fixed size to help serializing
 	struct Bone {
 		int8 parent;	//id of the parent bone
 		char name[32];	//fixed size bone name
-		Matrix44 model; //local transformation (according to its parent bone)
+		Matrix44 model; //local transformation of the rest pose (according to its parent bone)
 		uint8 layer;	//which layers are assigned to this bone (UPPER_BODY, RIGHT_ARM, etc)
 		uint8 num_children;	//how many child bones
 		int8 children[16]; //list of child bone ids (max 16 children )
@@ -39,25 +43,57 @@ public:
 	Bone bones[128]; //max 128 bones
 	int num_bones;	//number of bones
 
-	Matrix44 global_bone_matrices[128]; //transform of every bone in global coordinates (according to the 0,0,0 and not the parent)
 	std::map<const char*, int, cmp_str> bones_by_name;	//map to get the bone index from its name, required to extract the final bones array
+	unsigned int layout;	//hash of the bone names, rigs with the same layout share the bone remap of a mesh
 
-	Skeleton();
+	//rest pose decomposed
+	std::vector<Vector3> rest_translations;
+	std::vector<Quaternion> rest_rotations;
+	std::vector<Vector3> rest_scales;
+
+	Rig();
 
 	Bone* getBone(const char* name); //returns the bone pointer
-	Matrix44& getBoneMatrix(const char* name, bool local = true); //returns the local matrix of a bone
+	int getBoneIndex(const char* name); //-1 if not found
+	void assignLayer(Bone* bone, uint8 layer); //assigns a layer to a node and all its children
+	void update(); //builds the names map, the layout and the rest pose from the bones, once they are loaded
+
+	static std::vector<Rig*> sRigsLoaded;
+	//returns an equal rig already loaded (and deletes this one) or registers this one
+	static Rig* GetShared(Rig* rig);
+};
+
+//A pose of a rig: local transformation of every bone as translation, rotation and scale (SoA), and the global matrices
+class Skeleton {
+public:
+	Rig* rig;
+	int num_bones;	//number of bones of the rig
+
+	std::vector<Vector3> translations;
+	std::vector<Quaternion> rotations;
+	std::vector<Vector3> scales;
+
+	std::vector<Matrix44> global_bone_matrices; //transform of every bone in global coordinates (according to the 0,0,0 and not the parent)
+	unsigned int version;	//changes every time the global matrices are updated, 0 if never computed
+
+	static std::atomic<unsigned int> last_version; //skeletons are posed from several threads
+
+	Skeleton();
+
+	void setRig(Rig* rig); //sets the rest pose of the rig
+	int getBoneIndex(const char* name) { return rig ? rig->getBoneIndex(name) : -1; }
+	Matrix44 getBoneMatrix(const char* name, bool local = true); //returns the local matrix of a bone
 	void applyTransformToBones(const char* root, Matrix44 transform); //given a bone name and matrix, it multiplies the matrix to the bone
-	void updateGlobalMatrices(); //updates the list of global matrices according to the local matrices
+	void updateGlobalMatrices(); //updates the list of global matrices according to the local poses
 
 	void renderSkeleton(Camera* camera, Matrix44 model, Vector4 color = Vector4(0.5, 0, 0.5, 1), bool render_points = false); //renders the skeleton with lines
-	void computeFinalBoneMatrices(std::vector<Matrix44>& bones, Mesh* mesh); //fills the std::vector with the bones ready for the shader
-	void assignLayer(Bone* bone, uint8 layer); //assigns a layer to a node and all its children
+	void computeFinalBoneMatrices(std::vector<Matrix44>& bones, Mesh* mesh); //fills the std::vector with the bones ready for the shader, uses the current global matrices
 };
 
-//this function takes skeleton A and blends it with skeleton B and stores the result in result
+//this function takes skeleton A and blends it with skeleton B and stores the result in result (global matrices included)
 void blendSkeleton(Skeleton* a, Skeleton* b, float w, Skeleton* result, uint8 layer = 0xFF);
 
-//This class contains one animation loaded from a file (it also uses a skeleton to store the current snapshot)
+//This class contains one animation loaded from a file (it also uses a skeleton to store the current snapshot, posing the shared rig)
 class Animation {
 public:
 
@@ -71,15 +107,33 @@ public:
 	int num_keyframes;
 	int8 bones_map[128]; //maps from keyframe data index to bone
 
-	Matrix44* keyframes;
+	//ANIM_NUM_CHANNELS channels per animated bone, they index the keys
+	//they point inside the mapped .abin, or to the storage when compressed after parsing the .skanim
+	const sAnimChannel* channels = nullptr;
+	const sAnimKey* keys = nullptr;
+	const uint16* key_frames = nullptr; //frame of every key
+	int num_channels = 0;
+	int num_keys = 0;
+
+	std::vector<sAnimChannel> channels_storage;
+	std::vector<sAnimKey> keys_storage;
+	std::vector<uint16> key_frames_storage;
+	MappedFile* mapped_file = nullptr;
 
 	Animation();
-	~Animation();	//we need the dtor to remove the keyframes memory
+	Animation(const Animation&) = delete; //the tracks may point inside mapped_file, use operator = (Animation*)
+	Animation& operator = (const Animation&) = delete;
+	~Animation();
 
 	//change the skeleton to the given pose according to time
 	void assignTime(float time, bool loop = true, bool interpolate = true, uint8 layers = 0xFF);
+	//same for a skeleton of the caller, so every character keeps its own pose
+	void sample(float time, Skeleton& pose, bool loop = true, bool interpolate = true, uint8 layers = 0xFF);
+	void setKeyframes(const Matrix44* keyframes); //compresses num_keyframes x num_animated_bones local matrices
+	void useStorage(); //points the tracks to the storage vectors, releases the mapping
+	size_t getMemorySize() const; //bytes of the keyframe data
 
-	//storage
+	//storage, the .skanim are cached in a .abin next to them that is used while newer than the source
 	bool load(const char* filename);
 	bool loadSKANIM(const char* filename);
 	bool loadABIN(const char* filename);
@@ -90,11 +144,13 @@ public:
 
 	//copy operator to copy the keyframes
 	void operator = (Animation* anim);
+
+	static bool reduce_keys; //removes the keys that interpolation reproduces, applied when compressing
 };
 
 struct AnimationCallback {
 
-	std::string animation_name;
+	Animation* animation = nullptr; //resolved when added
 	// Callback can be attached to a keyframe index or a given time (in secs)
 	float time = -1.0f;
 	int keyframe = -1;
@@ -113,33 +169,62 @@ class Animator {
 
 	// Transitions
 	bool must_play_loop = true;
-	const char* last_loop_animation = nullptr;
+	Animation* last_loop_animation = nullptr;
 	Animation* target_animation = nullptr;
+	Skeleton current_pose;	//own poses, the animations are shared by all the characters
+	Skeleton target_pose;
 	Skeleton blended_skeleton;
 
 	float transition_counter	= 0.f;
 	float transition_time		= 0.f;
+	float speed					= 1.f;
+
+	// Graph, shared definition and own state
+	AnimationGraph* graph = nullptr;
+	int graph_state = -1;
+	float graph_values[ANIM_GRAPH_MAX_PARAMETERS] = {};
 
 	// Callbacks
 	float last_time = 0.0f;
 	std::vector<AnimationCallback> callbacks;
 	std::function<void(std::string)> on_finish_animation = nullptr;
 
+	void releaseBonePalettes(); //of the skinned mesh, keyed by our skeletons
+
 public:
 
+	// Update rate LOD, the AnimationManager decides when to sample
+	int manager_slot = -1;
+	bool needs_sample = false;			//time or animation changed since the last sample
+	unsigned int last_sample_frame = 0;
+	int lod_interval = 1;				//frames between samples, 0 while paused
+	Vector3 bounds_center;				//world space, radius 0 means always sampled
+	float bounds_radius = 0.0f;
+	Mesh* skinned_mesh = nullptr;		//its palette is computed with the sample
+
 	Animator() {};
 	~Animator();
 
 	void playAnimation(const char* path, bool loop = true, float transition = 0.2f, bool reset_time = true);
+	void playAnimation(Animation* animation, bool loop = true, float transition = 0.2f, bool reset_time = true); //handle from Animation::Get
 	void stopAnimation();
 
-	void update(float delta_time);
+	// the graph picks the animation from the parameters, evaluated in every update
+	void setGraph(AnimationGraph* graph); //enters its default state
+	void setState(int state, float transition = 0.2f);
+	int getState() const { return graph_state; }
+	void setParameter(int parameter, float value) { if (parameter >= 0) graph_values[parameter] = value; } //handle from AnimationGraph::getParameter
+
+	void update(float delta_time); //advances the time, the poses are sampled later by the AnimationManager
+	void sample(); //poses the skeletons for the current time
+	void setBounds(const Vector3& center, float radius) { bounds_center = center; bounds_radius = radius; }
+	void setSkinnedMesh(Mesh* mesh);
 
 	void addCallback(const std::string& filename, std::function<void(float)> callback, float time);
 	void addCallback(const std::string& filename, std::function<void(float)> callback, int keyframe);
 
 	Animation* getCurrentAnimation() { return target_animation ? target_animation : current_animation; };
-	Skeleton& getCurrentSkeleton();
+	Skeleton& getCurrentSkeleton(); //samples now if it was never posed
 
 	void setOnFinishAnimation(std::function<void(std::string)> fn) { on_finish_animation = fn; }
 };
\ No newline at end of file
@@ -0,0 +1,106 @@
+#include "animation_graph.h"
+#include "animation.h"
+
+#include <cassert>
+#include <iostream>
+
+std::map<std::string, AnimationGraph*> AnimationGraph::sGraphsLoaded;
+
+int AnimationGraph::addParameter(const char* parameter_name)
+{
+	int index = getParameter(parameter_name);
+	if (index != -1)
+		return index;
+	assert(parameters.size() < ANIM_GRAPH_MAX_PARAMETERS && "too many parameters in the animation graph");
+	parameters.push_back(parameter_name);
+	return (int)parameters.size() - 1;
+}
+
+int AnimationGraph::addState(const char* state_name, const char* clip_filename, bool loop, float speed)
+{
+	assert(getState(state_name) == -1 && "state already in the animation graph");
+	sAnimState& state = states.emplace_back();
+	state.name = state_name;
+	state.clip = Animation::Get(clip_filename);
+	state.loop = loop;
+	state.speed = speed;
+	if (!state.clip)
+		std::cerr << "Animation graph: clip not found for state " << state_name << ": " << clip_filename << std::endl;
+	return (int)states.size() - 1;
+}
+
+int AnimationGraph::addTransition(const char* from, const char* to, float duration, const sAnimConditionDesc* conditions, int num_conditions)
+{
+	assert(num_conditions <= ANIM_GRAPH_MAX_CONDITIONS);
+	sAnimTransition& transition = transitions.emplace_back();
+	transition.from = from ? getState(from) : ANIM_GRAPH_ANY_STATE;
+	transition.to = getState(to);
+	assert((!from || transition.from != -1) && transition.to != -1 && "unknown state in the animation graph");
+	transition.duration = duration;
+	transition.num_conditions = num_conditions;
+	for (int i = 0; i < num_conditions; ++i)
+	{
+		transition.conditions[i].parameter = (uint8)addParameter(conditions[i].parameter);
+		transition.conditions[i].op = conditions[i].op;
+		transition.conditions[i].value = conditions[i].value;
+	}
+	return (int)transitions.size() - 1;
+}
+
+int AnimationGraph::getParameter(const char* parameter_name) const
+{
+	for (size_t i = 0; i < parameters.size(); ++i)
+		if (parameters[i] == parameter_name)
+			return (int)i;
+	return -1;
+}
+
+int AnimationGraph::getState(const char* state_name) const
+{
+	for (size_t i = 0; i < states.size(); ++i)
+		if (states[i].name == state_name)
+			return (int)i;
+	return -1;
+}
+
+static bool testCondition(const sAnimCondition& condition, const float* values)
+{
+	float v = values[condition.parameter];
+	switch (condition.op)
+	{
+	case ANIM_GREATER: return v > condition.value;
+	case ANIM_LESS: return v < condition.value;
+	case ANIM_GREATER_EQUAL: return v >= condition.value;
+	case ANIM_LESS_EQUAL: return v <= condition.value;
+	}
+	return false;
+}
+
+int AnimationGraph::evaluate(int state, const float* values) const
+{
+	for (size_t i = 0; i < transitions.size(); ++i)
+	{
+		const sAnimTransition& transition = transitions[i];
+		if (transition.to == state || (transition.from != ANIM_GRAPH_ANY_STATE && transition.from != state))
+			continue;
+		bool pass = true;
+		for (int j = 0; j < transition.num_conditions && pass; ++j)
+			pass = testCondition(transition.conditions[j], values);
+		if (pass)
+			return (int)i;
+	}
+	return -1;
+}
+
+AnimationGraph* AnimationGraph::Get(const char* name)
+{
+	assert(name);
+	auto it = sGraphsLoaded.find(name);
+	return it != sGraphsLoaded.end() ? it->second : nullptr;
+}
+
+void AnimationGraph::registerGraph(const char* name)
+{
+	this->name = name;
+	sGraphsLoaded[name] = this;
+}
@@ -0,0 +1,80 @@
+/*  Animation graph: the states of a character (a clip each), its parameters and the transitions between states.
+	Clips and parameter names are resolved when the graph is built, so at runtime the Animator only reads floats
+	by index and compares them: no strings, maps or allocations. The graph is shared by all the characters using it,
+	every Animator keeps its own parameter values and current state.
+	The transitions are tested in order and the first one whose conditions all pass (and goes to another state) wins.
+*/
+
+#pragma once
+
+#include "framework.h"
+#include <vector>
+#include <string>
+#include <map>
+
+class Animation;
+
+#define ANIM_GRAPH_MAX_PARAMETERS 16
+#define ANIM_GRAPH_MAX_CONDITIONS 4		//per transition, all of them must pass
+#define ANIM_GRAPH_ANY_STATE -1			//source of the transitions that can fire from every state
+
+enum eAnimConditionOp : uint8 {
+	ANIM_GREATER = 0,
+	ANIM_LESS,
+	ANIM_GREATER_EQUAL,
+	ANIM_LESS_EQUAL
+};
+
+struct sAnimCondition {
+	uint8 parameter;
+	eAnimConditionOp op;
+	float value;
+};
+
+struct sAnimState {
+	std::string name;
+	Animation* clip;		//resolved handle
+	bool loop;
+	float speed;			//playback rate
+};
+
+struct sAnimTransition {
+	int from;				//state index or ANIM_GRAPH_ANY_STATE
+	int to;
+	float duration;			//seconds of blending
+	int num_conditions;
+	sAnimCondition conditions[ANIM_GRAPH_MAX_CONDITIONS];
+};
+
+//declarative description of a transition, the names are resolved by addTransition
+struct sAnimConditionDesc {
+	const char* parameter;
+	eAnimConditionOp op;
+	float value;
+};
+
+class AnimationGraph
+{
+public:
+	std::string name;
+	std::vector<std::string> parameters;
+	std::vector<sAnimState> states;
+	std::vector<sAnimTransition> transitions;
+	int default_state = 0;
+
+	int addParameter(const char* parameter_name);
+	int addState(const char* state_name, const char* clip_filename, bool loop = true, float speed = 1.0f);
+	//from can be nullptr (any state), conditions is a list of num_conditions
+	int addTransition(const char* from, const char* to, float duration, const sAnimConditionDesc* conditions, int num_conditions);
+
+	//-1 if not found, resolve them once and keep the handles
+	int getParameter(const char* parameter_name) const;
+	int getState(const char* state_name) const;
+
+	//first transition from the state passing its conditions, -1 if none
+	int evaluate(int state, const float* values) const;
+
+	static std::map<std::string, AnimationGraph*> sGraphsLoaded;
+	static AnimationGraph* Get(const char* name); //nullptr until registered
+	void registerGraph(const char* name);
+};
@@ -0,0 +1,137 @@
+#include "animation_manager.h"
+#include "animation.h"
+#include "camera.h"
+#include "graphics/mesh.h"
+#include "worker_pool.h"
+
+#include <cassert>
+#include <algorithm>
+
+long AnimationManager::num_sampled = 0;
+long AnimationManager::num_paused = 0;
+
+AnimationManager* AnimationManager::Get()
+{
+	static AnimationManager* manager = nullptr;
+	if (!manager)
+		manager = new AnimationManager();
+	return manager;
+}
+
+void AnimationManager::add(Animator* animator)
+{
+	//copied animators keep the slot of the original
+	int slot = animator->manager_slot;
+	if (slot >= 0 && slot < (int)animators.size() && animators[slot] == animator)
+		return;
+	animator->manager_slot = (int)animators.size();
+	animators.push_back(animator);
+}
+
+void AnimationManager::remove(Animator* animator)
+{
+	int slot = animator->manager_slot;
+	if (slot < 0 || slot >= (int)animators.size() || animators[slot] != animator)
+		return;
+	animators[slot] = animators.back();
+	animators[slot]->manager_slot = slot;
+	animators.pop_back();
+	animator->manager_slot = -1;
+}
+
+int AnimationManager::computeInterval(float projected_radius)
+{
+	if (projected_radius >= ANIM_LOD_FULL_RATE_RADIUS)
+		return 1;
+	if (projected_radius >= ANIM_LOD_HALF_RATE_RADIUS)
+		return 2;
+	if (projected_radius >= ANIM_LOD_QUARTER_RATE_RADIUS)
+		return 4;
+	return ANIM_LOD_MAX_INTERVAL;
+}
+
+void AnimationManager::runJobs(sJob* jobs, size_t count)
+{
+	for (size_t i = 0; i < count; ++i)
+	{
+		sJob& job = jobs[i];
+		job.animator->sample();
+		if (!job.palette)
+			continue;
+		Skeleton& skeleton = job.animator->getCurrentSkeleton();
+		if (skeleton.rig == job.rig) //a new rig needs its remap, built by the first draw
+			job.animator->skinned_mesh->updateBonePalette(*job.palette, &skeleton);
+	}
+}
+
+void AnimationManager::update(Camera* const* cameras, int num_cameras)
+{
+	frame++;
+	jobs.clear();
+	for (size_t i = 0; i < animators.size(); ++i)
+	{
+		Animator* animator = animators[i];
+		if (!animator->needs_sample)
+			continue;
+
+		//the biggest view decides, animators without bounds are always sampled
+		int interval = 1;
+		if (use_lod && num_cameras && animator->bounds_radius > 0.0f)
+		{
+			float max_radius = -1.0f;
+			for (int j = 0; j < num_cameras; ++j)
+			{
+				Camera* camera = cameras[j];
+				if (camera->testSphereInFrustum(animator->bounds_center, animator->bounds_radius) == CLIP_OUTSIDE)
+					continue;
+				max_radius = std::max(max_radius, camera->getProjectedScale(animator->bounds_center, animator->bounds_radius));
+			}
+			interval = max_radius < 0.0f ? 0 : computeInterval(max_radius);
+		}
+		animator->lod_interval = interval;
+		if (!interval)
+		{
+			num_paused++;
+			continue;
+		}
+
+		//staggered by slot, the ones waiting too long (rate changed or just visible again) go now
+		unsigned int waited = frame - animator->last_sample_frame;
+		if ((frame + i) % interval != 0 && waited < (unsigned int)interval * 2)
+			continue;
+
+		animator->last_sample_frame = frame;
+		num_sampled++;
+
+		//map entries and remaps are created here, the workers only fill them
+		sJob& job = jobs.emplace_back();
+		job.animator = animator;
+		job.palette = nullptr;
+		job.rig = nullptr;
+		Mesh* mesh = animator->skinned_mesh;
+		if (mesh && mesh->bones_info.size())
+		{
+			Skeleton& skeleton = animator->getCurrentSkeleton();
+			if (skeleton.rig)
+			{
+				mesh->getBoneRemap(&skeleton);
+				job.palette = &mesh->bone_palettes[&skeleton];
+				job.rig = skeleton.rig;
+			}
+		}
+	}
+
+	if (jobs.empty())
+		return;
+
+	//the animators do not share any state, split them in contiguous chunks
+	size_t num_chunks = 1;
+	if (use_threads)
+		num_chunks = std::min(std::min(WorkerPool::Get()->getNumWorkers() + 1, (size_t)ANIM_MAX_WORKERS), std::max((size_t)1, jobs.size() / ANIM_JOBS_PER_WORKER));
+	size_t chunk = (jobs.size() + num_chunks - 1) / num_chunks;
+	WorkerPool::Get()->run(num_chunks, [this, chunk](size_t i) {
+		size_t start = i * chunk;
+		if (start < jobs.size())
+			runJobs(&jobs[start], std::min(chunk, jobs.size() - start));
+	});
+}
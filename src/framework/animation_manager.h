@@ -0,0 +1,57 @@
+/*  Schedules the sampling of all the animators, once per frame after the updates and before rendering.
+	The animators far from the cameras are sampled less often (staggered so the work is spread across frames)
+	and the ones outside every view are paused, their time keeps running so they resume in the right pose.
+	The ones due are sampled, blended and turned into skinning palettes in parallel, the GL upload of the
+	palettes is left to the first draw.
+*/
+
+#pragma once
+
+#include "framework.h"
+#include <vector>
+
+class Animator;
+class Camera;
+class Rig;
+struct sBonePalette;
+
+//projected radius (as Camera::getProjectedScale) above which an animator is sampled every 1, 2 and 4 frames
+#define ANIM_LOD_FULL_RATE_RADIUS 64.0f
+#define ANIM_LOD_HALF_RATE_RADIUS 24.0f
+#define ANIM_LOD_QUARTER_RATE_RADIUS 8.0f
+#define ANIM_LOD_MAX_INTERVAL 8		//frames between samples of the smallest ones
+
+#define ANIM_MAX_WORKERS 8			//chunks sampled at the same time by the WorkerPool, the main thread included
+#define ANIM_JOBS_PER_WORKER 4		//fewer animators do not pay for waking a worker
+
+class AnimationManager
+{
+public:
+	//one animator due this frame
+	struct sJob {
+		Animator* animator;
+		sBonePalette* palette;	//of its skinned mesh, created before the workers start
+		const Rig* rig;			//the palette is only filled if the sample keeps it
+	};
+
+	bool use_lod = true;
+	bool use_threads = true;
+	std::vector<Animator*> animators;
+	std::vector<sJob> jobs;
+	unsigned int frame = 0;
+
+	static AnimationManager* Get();
+
+	void add(Animator* animator); //done by the animators on their first update
+	void remove(Animator* animator);
+
+	//samples the animators due this frame, the cameras of all the views decide the rate (matrices must be updated)
+	void update(Camera* const* cameras, int num_cameras);
+
+	//frames between samples for a projected radius
+	static int computeInterval(float projected_radius);
+	static void runJobs(sJob* jobs, size_t count);
+
+	static long num_sampled; //stats, reset every time the GPU stats are shown
+	static long num_paused;
+};
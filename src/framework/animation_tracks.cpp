@@ -0,0 +1,260 @@
+#include "animation_tracks.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+#define SQRT2 1.41421356f
+
+static sAnimKey encodeVector(const Vector3& v, const Vector3& min, const Vector3& extent)
+{
+	sAnimKey key;
+	for (int i = 0; i < 3; ++i)
+	{
+		float range = extent.v[i];
+		float f = range > 0.0f ? (v.v[i] - min.v[i]) / range : 0.0f;
+		key.v[i] = (uint16)lroundf(clamp(f, 0.0f, 1.0f) * 65535.0f);
+	}
+	return key;
+}
+
+static Vector3 decodeVector(const sAnimKey& key, const sAnimChannel& channel)
+{
+	const float scale = 1.0f / 65535.0f;
+	return Vector3(
+		channel.min.x + key.v[0] * scale * channel.extent.x,
+		channel.min.y + key.v[1] * scale * channel.extent.y,
+		channel.min.z + key.v[2] * scale * channel.extent.z);
+}
+
+//the largest component is dropped (and made positive), the other three fit in 15 bits each
+static sAnimKey encodeRotation(Quaternion q)
+{
+	q.normalize();
+	int largest = 0;
+	for (int i = 1; i < 4; ++i)
+		if (fabsf(q.q[i]) > fabsf(q.q[largest]))
+			largest = i;
+	float sign = q.q[largest] < 0.0f ? -1.0f : 1.0f;
+
+	uint16 c[3];
+	int j = 0;
+	for (int i = 0; i < 4; ++i)
+		if (i != largest)
+		{
+			float f = clamp(q.q[i] * sign * SQRT2, -1.0f, 1.0f); //the others are below 1/sqrt(2)
+			c[j++] = (uint16)lroundf((f * 0.5f + 0.5f) * 32767.0f);
+		}
+
+	sAnimKey key;
+	key.v[0] = (uint16)((c[0] << 1) | (largest >> 1));
+	key.v[1] = (uint16)((c[1] << 1) | (largest & 1));
+	key.v[2] = c[2];
+	return key;
+}
+
+static Quaternion decodeRotation(const sAnimKey& key)
+{
+	int largest = ((key.v[0] & 1) << 1) | (key.v[1] & 1);
+	uint16 c[3] = { (uint16)(key.v[0] >> 1), (uint16)(key.v[1] >> 1), key.v[2] };
+
+	Quaternion q;
+	float sum = 0.0f;
+	int j = 0;
+	for (int i = 0; i < 4; ++i)
+		if (i != largest)
+		{
+			float f = (c[j++] / 32767.0f * 2.0f - 1.0f) / SQRT2;
+			q.q[i] = f;
+			sum += f * f;
+		}
+	q.q[largest] = sqrtf(std::max(0.0f, 1.0f - sum));
+	return q;
+}
+
+static float rotationError(const Quaternion& a, const Quaternion& b)
+{
+	float dot = std::min(fabsf(DotProduct(a, b)), 1.0f);
+	return 2.0f * acosf(dot);
+}
+
+//greedy key reduction: from every kept key, extends the segment while the interpolation stays within the tolerance
+//first and last frames are always kept
+template<typename T, typename LERP, typename ERROR>
+static void reduceKeys(const std::vector<T>& values, float tolerance, LERP lerp_fn, ERROR error_fn, std::vector<int>& kept)
+{
+	int count = (int)values.size();
+	kept.clear();
+	kept.push_back(0);
+	int start = 0;
+	while (start < count - 1)
+	{
+		int end = start + 1;
+		while (end + 1 < count)
+		{
+			int candidate = end + 1;
+			bool valid = true;
+			for (int i = start + 1; i < candidate && valid; ++i)
+			{
+				float t = (i - start) / (float)(candidate - start);
+				valid = error_fn(lerp_fn(values[start], values[candidate], t), values[i]) <= tolerance;
+			}
+			if (!valid)
+				break;
+			end = candidate;
+		}
+		kept.push_back(end);
+		start = end;
+	}
+}
+
+static float vectorError(const Vector3& a, const Vector3& b)
+{
+	Vector3 d = a - b;
+	return std::max(fabsf(d.x), std::max(fabsf(d.y), fabsf(d.z)));
+}
+
+static void addVectorChannel(const std::vector<Vector3>& values, float tolerance, bool relative, bool reduce_keys,
+	std::vector<sAnimChannel>& channels, std::vector<sAnimKey>& keys, std::vector<uint16>& key_frames)
+{
+	sAnimChannel& channel = channels.emplace_back();
+	channel.first_key = (unsigned int)keys.size();
+
+	Vector3 max_value = values[0];
+	channel.min = values[0];
+	for (const Vector3& v : values)
+	{
+		channel.min.setMin(v);
+		max_value.setMax(v);
+	}
+	channel.extent = max_value - channel.min;
+	if (relative) //to the distance to the parent bone
+		tolerance *= std::max((float)channel.min.length(), (float)max_value.length());
+
+	//constant, the value is the min
+	if (vectorError(channel.min, max_value) <= tolerance)
+	{
+		channel.extent.set(0, 0, 0);
+		channel.num_keys = 1;
+		keys.push_back(encodeVector(channel.min, channel.min, channel.extent));
+		key_frames.push_back(0);
+		return;
+	}
+
+	std::vector<int> kept;
+	if (reduce_keys)
+		reduceKeys(values, tolerance, [](const Vector3& a, const Vector3& b, float t) { return lerp(a, b, t); }, vectorError, kept);
+	else
+		for (int i = 0; i < (int)values.size(); ++i)
+			kept.push_back(i);
+
+	channel.num_keys = (unsigned int)kept.size();
+	for (int frame : kept)
+	{
+		keys.push_back(encodeVector(values[frame], channel.min, channel.extent));
+		key_frames.push_back((uint16)frame);
+	}
+}
+
+static void addRotationChannel(std::vector<Quaternion>& values, bool reduce_keys,
+	std::vector<sAnimChannel>& channels, std::vector<sAnimKey>& keys, std::vector<uint16>& key_frames)
+{
+	sAnimChannel& channel = channels.emplace_back();
+	channel.first_key = (unsigned int)keys.size();
+	channel.min.set(0, 0, 0);
+	channel.extent.set(0, 0, 0);
+
+	//same hemisphere as the previous key so the interpolation takes the short path
+	bool constant = true;
+	for (size_t i = 1; i < values.size(); ++i)
+	{
+		if (DotProduct(values[i - 1], values[i]) < 0.0f)
+			values[i] = values[i] * -1.0f;
+		if (rotationError(values[0], values[i]) > ANIM_ROTATION_TOLERANCE)
+			constant = false;
+	}
+
+	std::vector<int> kept;
+	if (constant)
+		kept.push_back(0);
+	else if (reduce_keys)
+		reduceKeys(values, ANIM_ROTATION_TOLERANCE, [](const Quaternion& a, const Quaternion& b, float t) { return Qlerp(a, b, t); }, rotationError, kept);
+	else
+		for (int i = 0; i < (int)values.size(); ++i)
+			kept.push_back(i);
+
+	channel.num_keys = (unsigned int)kept.size();
+	for (int frame : kept)
+	{
+		keys.push_back(encodeRotation(values[frame]));
+		key_frames.push_back((uint16)frame);
+	}
+}
+
+void compressKeyframes(const Matrix44* keyframes, int num_keyframes, int num_animated_bones, bool reduce_keys,
+	std::vector<sAnimChannel>& channels, std::vector<sAnimKey>& keys, std::vector<uint16>& key_frames)
+{
+	assert(num_keyframes > 0 && num_keyframes <= 0xFFFF);
+	channels.clear();
+	keys.clear();
+	key_frames.clear();
+
+	std::vector<Vector3> translations(num_keyframes), scales(num_keyframes);
+	std::vector<Quaternion> rotations(num_keyframes);
+	for (int i = 0; i < num_animated_bones; ++i)
+	{
+		//decomposed once here, never at runtime
+		for (int k = 0; k < num_keyframes; ++k)
+		{
+			Matrix44 m = keyframes[k * num_animated_bones + i];
+			m.decompose(translations[k], rotations[k], scales[k]);
+		}
+		addVectorChannel(translations, ANIM_TRANSLATION_TOLERANCE, true, reduce_keys, channels, keys, key_frames);
+		addRotationChannel(rotations, reduce_keys, channels, keys, key_frames);
+		addVectorChannel(scales, ANIM_SCALE_TOLERANCE, false, reduce_keys, channels, keys, key_frames);
+	}
+}
+
+//keys around the frame and the interpolation factor between them
+static void findKeys(const sAnimChannel& channel, const uint16* key_frames, float frame, int num_keyframes, unsigned int& a, unsigned int& b, float& t)
+{
+	a = b = channel.first_key;
+	t = 0.0f;
+	if (channel.num_keys == 1)
+		return;
+
+	const uint16* begin = key_frames + channel.first_key;
+	const uint16* end = begin + channel.num_keys;
+	const uint16* it = std::upper_bound(begin, end, (uint16)frame);
+	a = channel.first_key + (unsigned int)(it - begin) - 1;
+	float frame_a = key_frames[a];
+	float frame_b = (float)num_keyframes; //loops to the first key
+	if (it != end)
+	{
+		b = a + 1;
+		frame_b = key_frames[b];
+	}
+	t = clamp((frame - frame_a) / (frame_b - frame_a), 0.0f, 1.0f);
+}
+
+Vector3 sampleVector(const sAnimChannel& channel, const sAnimKey* keys, const uint16* key_frames, float frame, int num_keyframes)
+{
+	unsigned int a, b;
+	float t;
+	findKeys(channel, key_frames, frame, num_keyframes, a, b, t);
+	Vector3 va = decodeVector(keys[a], channel);
+	if (a == b)
+		return va;
+	return lerp(va, decodeVector(keys[b], channel), t);
+}
+
+Quaternion sampleRotation(const sAnimChannel& channel, const sAnimKey* keys, const uint16* key_frames, float frame, int num_keyframes)
+{
+	unsigned int a, b;
+	float t;
+	findKeys(channel, key_frames, frame, num_keyframes, a, b, t);
+	Quaternion qa = decodeRotation(keys[a]);
+	if (a == b)
+		return qa;
+	return Qlerp(qa, decodeRotation(keys[b]), t); //nlerp, the keys are close enough
+}
@@ -0,0 +1,42 @@
+/*  Compressed keyframes of the animations: every animated bone has a translation, a rotation and a scale channel.
+	Translations and scales are quantized to 16 bits inside the range of their channel, rotations use the
+	smallest three encoding (48 bits). Channels that do not change keep a single key, and keys that the
+	interpolation of their neighbours reproduces within the tolerances are removed, so every key stores its frame.
+*/
+
+#pragma once
+
+#include "framework.h"
+#include <vector>
+
+#define ANIM_TRANSLATION_TOLERANCE 0.002f	//fraction of the distance to the parent bone
+#define ANIM_ROTATION_TOLERANCE 0.002f		//radians
+#define ANIM_SCALE_TOLERANCE 0.001f
+
+enum eAnimChannel {
+	ANIM_TRANSLATION = 0,
+	ANIM_ROTATION,
+	ANIM_SCALE,
+	ANIM_NUM_CHANNELS
+};
+
+//3 x 16 bits, a quantized vector or a smallest three quaternion
+struct sAnimKey {
+	uint16 v[3];
+};
+
+//keys of one channel of an animated bone, fixed size to help serializing
+struct sAnimChannel {
+	unsigned int first_key;	//in the keys of the animation
+	unsigned int num_keys;	//1 if constant
+	Vector3 min;			//translation and scale: value = min + key * extent / 65535
+	Vector3 extent;
+};
+
+//builds ANIM_NUM_CHANNELS channels per animated bone from the sampled local matrices (num_keyframes x num_animated_bones)
+void compressKeyframes(const Matrix44* keyframes, int num_keyframes, int num_animated_bones, bool reduce_keys,
+	std::vector<sAnimChannel>& channels, std::vector<sAnimKey>& keys, std::vector<uint16>& key_frames);
+
+//frame is in samples (0..num_keyframes), after the last key it interpolates towards the first one (loop)
+Vector3 sampleVector(const sAnimChannel& channel, const sAnimKey* keys, const uint16* key_frames, float frame, int num_keyframes);
+Quaternion sampleRotation(const sAnimChannel& channel, const sAnimKey* keys, const uint16* key_frames, float frame, int num_keyframes);
@@ -10,6 +10,13 @@ void Entity::render(Camera* camera)
 	}
 }
 
+void Entity::addToRenderList(std::vector<sRenderItem>& items)
+{
+	for (int i = 0; i < children.size(); ++i) {
+		children[i]->addToRenderList(items);
+	}
+}
+
 void Entity::update(float delta_time)
 {
 	for (int i = 0; i < children.size(); ++i) {
@@ -8,6 +8,7 @@ class Mesh;
 class World;
 class EntityCollider;
 class Entity;
+struct sRenderItem;
 
 
 enum eCollisionFilter {
@@ -50,6 +51,9 @@ public:
 	virtual void render(Camera* camera);
 	virtual void update(float delta_time);
 
+	// Emits the instances of this entity (and its children), every view culls them later
+	virtual void addToRenderList(std::vector<sRenderItem>& items);
+
 	// Some useful methods
 	Matrix44 getGlobalMatrix();
 	float distance(Entity* e);
@@ -4,6 +4,8 @@
 #include "graphics/mesh.h"
 #include "graphics/shader.h"
 #include "graphics/material.h"
+#include "graphics/render_queue.h"
+#include "graphics/uniform_buffer.h"
 
 
 EntityMesh::EntityMesh(Mesh* mesh, const Material& material)
@@ -16,43 +18,40 @@ EntityMesh::~EntityMesh() {
 
 void EntityMesh::render(Camera* camera)
 {
+	if (!material.shader || !mesh) return;
 
 	camera->enable();
 
-	Shader* shader = material.shader;
-	shader->enable();
-
-	shader->setUniform("u_model", getGlobalMatrix());
-	shader->setUniform("u_viewprojection", camera->viewprojection_matrix);
-	shader->setUniform("u_color", material.color);
-
-	if (!material.shader || !mesh) return;
-
 	// Enable shader and pass uniforms
 	material.shader->enable();
 
 	// Set standard uniforms
-	material.shader->setUniform("u_model", getGlobalMatrix());
-	material.shader->setUniform("u_viewprojection", camera->viewprojection_matrix);
-	
-	// Set material color
-	material.shader->setUniform("u_color", material.color);
+	if (material.shader->hasUniformBlock(UBLOCK_OBJECT)) {
+		sObjectBlock object;
+		object.model = getGlobalMatrix();
+		object.color = material.color;
+		UniformBuffer* block = UniformBuffer::Get(UBLOCK_OBJECT);
+		block->bindRange(block->stream(&object, sizeof(object)), sizeof(object));
+	}
+	else {
+		material.shader->setUniform(UNIFORM("u_model"), getGlobalMatrix());
+		// Set material color
+		material.shader->setUniform(UNIFORM("u_color"), material.color);
+	}
+	material.shader->setUniform(UNIFORM("u_viewprojection"), camera->viewprojection_matrix);
 
 	// Set texture if available
 	if (material.diffuse) {
-		material.shader->setUniform("u_texture", material.diffuse, 0);
+		material.shader->setUniform(UNIFORM("u_texture"), material.diffuse, 0);
 	}
 	
+	// Render the mesh
 	if (isAnimated) {
 		mesh->renderAnimated(GL_TRIANGLES, &animator.getCurrentSkeleton());
 	} else {
 		mesh->render(GL_TRIANGLES);
 	}
 
-
-	// Render the mesh
-	mesh->render(GL_TRIANGLES);
-
 	// Disable shader
 	material.shader->disable();
 
@@ -60,8 +59,38 @@ void EntityMesh::render(Camera* camera)
 	Entity::render(camera);
 }
 
+void EntityMesh::addToRenderList(std::vector<sRenderItem>& items)
+{
+	if (material.shader && mesh) {
+		size_t num_instances = isInstanced ? models.size() : 1;
+		if (lod_levels.size() != num_instances * RENDER_MAX_VIEWS)
+			lod_levels.resize(num_instances * RENDER_MAX_VIEWS, 0);
+
+		// one item per instance, the queues keep them together
+		for (size_t i = 0; i < num_instances; ++i) {
+			sRenderItem& item = items.emplace_back();
+			item.mesh = mesh;
+			item.material = &material;
+			item.skeleton = isAnimated && !isInstanced ? &animator.getCurrentSkeleton() : nullptr;
+			item.model = isInstanced ? models[i] : getGlobalMatrix();
+			item.test_occlusion = !is_occluder;
+			item.lod_levels = &lod_levels[i * RENDER_MAX_VIEWS];
+			item.impostor = isInstanced && !isAnimated ? impostor : nullptr;
+			item.crowd = isInstanced ? crowd : nullptr;
+		}
+	}
+
+	Entity::addToRenderList(items);
+}
+
 void EntityMesh::update(float delta_time)
 {
+	// the animation manager lowers the sampling rate of the far or hidden characters
+	if (isAnimated && mesh) {
+		BoundingBox box = transformBoundingBox(getGlobalMatrix(), mesh->box);
+		animator.setBounds(box.center, (float)box.halfsize.length());
+		animator.setSkinnedMesh(mesh);
+	}
 
 	// propagate the call to update to the children using the base class method
 	Entity::update(delta_time);
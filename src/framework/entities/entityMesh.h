@@ -8,6 +8,8 @@
 #include "framework/animation.h"
 
 class Camera;
+class Impostor;
+class AnimationTexture;
 
 class EntityMesh : public Entity {
 
@@ -29,6 +31,20 @@ public:
     bool isInstanced = false;
     std::vector<Matrix44> models;
 
+    // level of detail used last time by every view, RENDER_MAX_VIEWS per instance (or the entity itself)
+    std::vector<uint8> lod_levels;
+
+    // big meshes that hide others, rasterized in the occlusion buffer
+    bool is_occluder = false;
+
+    // far instances are drawn as billboards with it, set by the world for big instanced groups
+    Impostor* impostor = nullptr;
+
+    // instanced skinned meshes animated on the GPU with a baked clip (no animator), set by the world from crowd_animation
+    std::string crowd_animation;
+    AnimationTexture* crowd = nullptr;
+
     virtual void render(Camera* camera) override;
     virtual void update(float delta_time) override;
+    virtual void addToRenderList(std::vector<sRenderItem>& items) override;
 };
\ No newline at end of file
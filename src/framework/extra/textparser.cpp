@@ -12,7 +12,7 @@
 #pragma warning(disable: 4018)
 
 //extern HWND GLOBmainwindow;
-char g_string_temporal[256];
+thread_local char g_string_temporal[256]; //per thread, meshes are parsed by the loader workers
 
 TextParser::TextParser()
 : data(NULL)
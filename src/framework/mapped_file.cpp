@@ -0,0 +1,91 @@
+#include "mapped_file.h"
+
+#include <sys/stat.h>
+
+#ifdef WIN32
+	#ifndef NOMINMAX
+		#define NOMINMAX
+	#endif
+	#include <windows.h>
+#else
+	#include <sys/mman.h>
+	#include <fcntl.h>
+	#include <unistd.h>
+#endif
+
+MappedFile::~MappedFile()
+{
+	close();
+}
+
+bool MappedFile::open(const char* filename)
+{
+	close();
+
+#ifdef WIN32
+	HANDLE file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+	LARGE_INTEGER file_size;
+	if (!GetFileSizeEx(file, &file_size) || !file_size.QuadPart)
+	{
+		CloseHandle(file);
+		return false;
+	}
+	HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	void* view = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : NULL;
+	if (!view)
+	{
+		if (mapping)
+			CloseHandle(mapping);
+		CloseHandle(file);
+		return false;
+	}
+	file_handle = file;
+	mapping_handle = mapping;
+	size = (size_t)file_size.QuadPart;
+	data = (const uint8*)view;
+#else
+	int fd = ::open(filename, O_RDONLY);
+	if (fd == -1)
+		return false;
+	struct stat stbuffer;
+	if (fstat(fd, &stbuffer) != 0 || stbuffer.st_size <= 0)
+	{
+		::close(fd);
+		return false;
+	}
+	void* view = mmap(nullptr, (size_t)stbuffer.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd); //the mapping keeps the file alive
+	if (view == MAP_FAILED)
+		return false;
+	size = (size_t)stbuffer.st_size;
+	data = (const uint8*)view;
+#endif
+	return true;
+}
+
+void MappedFile::close()
+{
+	if (!data)
+		return;
+
+#ifdef WIN32
+	UnmapViewOfFile(data);
+	CloseHandle((HANDLE)mapping_handle);
+	CloseHandle((HANDLE)file_handle);
+	mapping_handle = file_handle = nullptr;
+#else
+	munmap((void*)data, size);
+#endif
+	data = nullptr;
+	size = 0;
+}
+
+long long MappedFile::getModificationTime(const char* filename)
+{
+	struct stat stbuffer;
+	if (stat(filename, &stbuffer) != 0)
+		return 0;
+	return (long long)stbuffer.st_mtime;
+}
@@ -0,0 +1,30 @@
+/*  Read only view of a whole file mapped in memory: the pages are loaded by the OS when touched and shared
+	with its file cache, so binary assets can be used in place instead of being read and copied.
+	The data stays valid until the file is closed (or the MappedFile destroyed).
+*/
+
+#pragma once
+
+#include "framework.h"
+
+class MappedFile
+{
+public:
+	const uint8* data = nullptr;
+	size_t size = 0;
+
+	MappedFile() {}
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator = (const MappedFile&) = delete;
+	~MappedFile();
+
+	bool open(const char* filename); //false if missing or empty
+	void close();
+
+	//last modification of a file (seconds), 0 if missing
+	static long long getModificationTime(const char* filename);
+
+private:
+	void* file_handle = nullptr;	//only used under windows
+	void* mapping_handle = nullptr;
+};
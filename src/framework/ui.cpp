@@ -29,10 +29,10 @@ bool UI::addButton(Vector2 position, Vector2 size, const char* texture_path) {
     Texture* texture = Texture::Get(texture_path);
 
     shader->enable();
-    shader->setUniform("u_color", is_hovered ? Vector4::WHITE * 2.0f : Vector4::WHITE);
-    shader->setUniform("u_model", Matrix44());
-    shader->setUniform("u_viewprojection", World::get_instance()->camera->viewprojection_matrix);
-    shader->setUniform("u_texture", texture, 0);
+    shader->setUniform(UNIFORM("u_color"), is_hovered ? Vector4::WHITE * 2.0f : Vector4::WHITE);
+    shader->setUniform(UNIFORM("u_model"), Matrix44());
+    shader->setUniform(UNIFORM("u_viewprojection"), World::get_instance()->camera->viewprojection_matrix);
+    shader->setUniform(UNIFORM("u_texture"), texture, 0);
 
     Mesh quad;
     quad.createQuad(position.x, position.y, size.x, size.y, true);
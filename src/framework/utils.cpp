@@ -12,9 +12,17 @@
 #include "framework/camera.h"
 #include "graphics/shader.h"
 #include "graphics/mesh.h"
+#include "graphics/render_queue.h"
+#include "graphics/stream_buffer.h"
+#include "graphics/occlusion_culler.h"
+#include "graphics/impostor.h"
+#include "graphics/animation_texture.h"
+#include "framework/animation_manager.h"
 
 #include "extra/stb_easy_font.h"
 
+#include <map>
+
 long getTime()
 {
 	#ifdef WIN32
@@ -33,6 +41,17 @@ void* getGLProcAddress(const char* name)
 	return SDL_GL_GetProcAddress(name);
 }
 
+bool checkGLExtension(const char* name)
+{
+	static std::map<std::string, bool> supported;
+	auto it = supported.find(name);
+	if (it != supported.end())
+		return it->second;
+	bool result = SDL_GL_ExtensionSupported(name) == SDL_TRUE;
+	supported[name] = result;
+	return result;
+}
+
 //Retrieve the current path of the application
 #ifdef __APPLE__
 #include "CoreFoundation/CoreFoundation.h"
@@ -159,10 +178,12 @@ bool drawText(float x, float y, std::string text, Vector3 c, float scale )
 	glLoadMatrixf(projection_matrix.m);
 
 	glColor3f(c.x, c.y, c.z);
+	size_t offset = StreamBuffer::Get()->upload(buffer, num_quads * 4 * 16);
 	glEnableClientState(GL_VERTEX_ARRAY);
-	glVertexPointer(2, GL_FLOAT, 16, buffer);
+	glVertexPointer(2, GL_FLOAT, 16, (void*)offset);
 	glDrawArrays(GL_QUADS, 0, num_quads * 4);
 	glDisableClientState(GL_VERTEX_ARRAY);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
 
 	glPopMatrix();
 	glMatrixMode(GL_MODELVIEW);
@@ -247,8 +268,26 @@ std::string getGPUStats()
 	}
 
 	std::string str = "FPS: " + std::to_string(Game::instance->fps) + " DCS: " + std::to_string(Mesh::num_meshes_rendered) + " Tris: " + std::to_string(long(Mesh::num_triangles_rendered * 0.001)) + "Ks  VRAM: " + std::to_string(int((nTotalMemoryInKB-nCurAvailMemoryInKB) * 0.001)) + "MBs / " + std::to_string(int(nTotalMemoryInKB * 0.001)) + "MBs";
+	str += " Shaders: " + std::to_string(RenderQueue::num_shader_changes) + " Texs: " + std::to_string(RenderQueue::num_texture_changes) + " Meshes: " + std::to_string(RenderQueue::num_mesh_changes);
+	if (StreamBuffer::num_stalls)
+		str += " Stalls: " + std::to_string(StreamBuffer::num_stalls);
+	str += " Occluded: " + std::to_string(OcclusionCuller::num_occluded);
+	str += " Clusters: " + std::to_string(Mesh::num_clusters_culled);
+	str += " Impostors: " + std::to_string(Impostor::num_instances_rendered);
+	str += " Anims: " + std::to_string(AnimationManager::num_sampled) + "/" + std::to_string(AnimationManager::num_paused);
+	str += " Crowd: " + std::to_string(AnimationTexture::num_instances_rendered);
 	Mesh::num_meshes_rendered = 0;
 	Mesh::num_triangles_rendered = 0;
+	RenderQueue::num_shader_changes = 0;
+	RenderQueue::num_texture_changes = 0;
+	RenderQueue::num_mesh_changes = 0;
+	StreamBuffer::num_stalls = 0;
+	OcclusionCuller::num_occluded = 0;
+	Mesh::num_clusters_culled = 0;
+	Impostor::num_instances_rendered = 0;
+	AnimationManager::num_sampled = 0;
+	AnimationManager::num_paused = 0;
+	AnimationTexture::num_instances_rendered = 0;
 	return str;
 }
 
@@ -270,10 +309,10 @@ void drawGrid()
 	grid_shader->enable();
 	Matrix44 m;
 	m.translate(floor(Camera::current->eye.x / 100.0f) * 100.0f, 0.0f, floor(Camera::current->eye.z / 100.0f) * 100.0f);
-	grid_shader->setUniform("u_color", Vector4(0.7f, 0.7f, 0.7f, 0.7f));
-	grid_shader->setUniform("u_model", m);
-	grid_shader->setUniform("u_camera_position", Camera::current->eye);
-	grid_shader->setUniform("u_viewprojection", Camera::current->viewprojection_matrix);
+	grid_shader->setUniform(UNIFORM("u_color"), Vector4(0.7f, 0.7f, 0.7f, 0.7f));
+	grid_shader->setUniform(UNIFORM("u_model"), m);
+	grid_shader->setUniform(UNIFORM("u_camera_position"), Camera::current->eye);
+	grid_shader->setUniform(UNIFORM("u_viewprojection"), Camera::current->viewprojection_matrix);
 	grid->render(GL_LINES); //background grid
 	glDisable(GL_BLEND);
 	glDepthMask(true);
@@ -24,6 +24,9 @@ double easeInCubic(double t);
 //check opengl errors
 bool checkGLErrors();
 
+//check if the driver supports an opengl extension (cached)
+bool checkGLExtension(const char* name);
+
 Vector2 getDesktopSize( int display_index = 0 );
 
 std::vector<std::string> tokenize(const std::string& source, const char* delimiters, bool process_strings = false);
@@ -0,0 +1,105 @@
+#include "worker_pool.h"
+
+#include <cassert>
+#include <algorithm>
+
+WorkerPool* WorkerPool::Get()
+{
+	static WorkerPool* pool = nullptr;
+	if (!pool)
+		pool = new WorkerPool();
+	return pool;
+}
+
+WorkerPool::WorkerPool()
+{
+	//never joined, they live as long as the game
+	size_t cores = std::max(1u, std::thread::hardware_concurrency());
+	size_t num_workers = std::min(std::max(cores, (size_t)2) - 1, (size_t)WORKER_MAX_THREADS - 1);
+	for (size_t i = 0; i < num_workers; ++i)
+		workers.emplace_back(&WorkerPool::work, this);
+}
+
+void WorkerPool::run(size_t count, const std::function<void(size_t)>& function)
+{
+	if (count <= 1 || workers.empty())
+	{
+		for (size_t i = 0; i < count; ++i)
+			function(i);
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		assert(!job && "WorkerPool::run is not reentrant");
+		job = &function;
+		job_count = count;
+		next_index = 0;
+	}
+	wake.notify_all();
+	runIndices(function, count);
+
+	//no worker joins from now on, wait for the ones still running an index
+	std::unique_lock<std::mutex> lock(mutex);
+	job = nullptr;
+	job_done.wait(lock, [this] { return job_workers == 0; });
+}
+
+void WorkerPool::post(std::function<void()> task)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		tasks.push_back(std::move(task));
+	}
+	wake.notify_one();
+}
+
+bool WorkerPool::runTask()
+{
+	std::function<void()> task;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (tasks.empty())
+			return false;
+		task = std::move(tasks.front());
+		tasks.pop_front();
+	}
+	task();
+	return true;
+}
+
+void WorkerPool::runIndices(const std::function<void(size_t)>& function, size_t count)
+{
+	size_t index;
+	while ((index = next_index.fetch_add(1)) < count)
+		function(index);
+}
+
+void WorkerPool::work()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	while (true)
+	{
+		wake.wait(lock, [this] { return (job && next_index < job_count) || !tasks.empty(); });
+
+		//the frame waits for the job, the tasks can wait
+		if (job && next_index < job_count)
+		{
+			const std::function<void(size_t)>* function = job;
+			size_t count = job_count;
+			job_workers++;
+			lock.unlock();
+			runIndices(*function, count);
+			lock.lock();
+			if (--job_workers == 0)
+				job_done.notify_all();
+			continue;
+		}
+
+		std::function<void()> task = std::move(tasks.front());
+		tasks.pop_front();
+		lock.unlock();
+		task();
+		lock.lock();
+	}
+}
@@ -0,0 +1,52 @@
+/*  Threads created once at startup and shared by all the systems, so no thread is spawned in the frame loop.
+	The frame jobs (views, animators) are split in indices run by the idle workers and the calling thread,
+	which returns when all of them are done. Long tasks (the asset loading) are queued and picked by the
+	workers between the frame jobs, the frame jobs go first when both are waiting.
+*/
+
+#pragma once
+
+#include "framework.h"
+#include <vector>
+#include <deque>
+#include <functional>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+
+#define WORKER_MAX_THREADS 8 //the main thread works too
+
+class WorkerPool
+{
+public:
+	static WorkerPool* Get();
+
+	//runs function(i) for every i in [0, count) and waits for all of them, only from the main thread
+	void run(size_t count, const std::function<void(size_t)>& function);
+
+	//queued for the first idle worker, the caller must wait for its result on its own
+	void post(std::function<void()> task);
+	//runs one of the queued tasks in the calling thread, false if there were none
+	bool runTask();
+
+	size_t getNumWorkers() const { return workers.size(); }
+
+private:
+	std::vector<std::thread> workers;
+	std::mutex mutex;
+	std::condition_variable wake;		//new job or task
+	std::condition_variable job_done;	//the last worker left the job
+
+	//the job being run, workers only join it while it has indices left
+	const std::function<void(size_t)>* job = nullptr;
+	size_t job_count = 0;
+	std::atomic<size_t> next_index{ 0 };
+	int job_workers = 0;
+
+	std::deque< std::function<void()> > tasks;
+
+	WorkerPool();
+	void work();
+	void runIndices(const std::function<void(size_t)>& function, size_t count);
+};
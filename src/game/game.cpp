@@ -5,6 +5,9 @@
 #include "graphics/texture.h"
 #include "graphics/fbo.h"
 #include "graphics/shader.h"
+#include "graphics/stream_buffer.h"
+#include "graphics/uniform_buffer.h"
+#include "graphics/asset_loader.h"
 #include "framework/input.h"
 #include "stage.h"
 #include "world.h"
@@ -87,35 +90,49 @@ void Game::doFrame(void)
 	// Clear the window and the depth buffer
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-	if (multiplayer_enabled && camera2 && World::get_instance()->player2)
+	// views of this frame, the world culls all of them at once on the first render
+	World* world = World::get_instance();
+	world->beginViews();
+
+	if (multiplayer_enabled && camera2 && world->player2)
 	{
 	    // Set aspect ratio for split screen (half width)
 	    float split_aspect = (window_width * 0.5f) / window_height;
 	    camera->aspect = split_aspect;
 	    camera2->aspect = split_aspect;
 
-	    // Left viewport (Player 1)
-	    glViewport(0, 0, window_width/2, window_height);
-	    render();
-
-	    // Right viewport (Player 2)
-	    glViewport(window_width/2, 0, window_width/2, window_height);
-	    render();
+	    // Left viewport (Player 1), right viewport (Player 2)
+	    world->addView(camera, 0, 0, window_width/2, window_height);
+	    world->addView(camera2, window_width/2, 0, window_width/2, window_height);
 	}
 	else
 	{
 	    // Full viewport for single player
 	    camera->aspect = window_width / (float)window_height;
-	    glViewport(0, 0, window_width, window_height);
+	    world->addView(camera, 0, 0, window_width, window_height);
+	}
+
+	for (int i = 0; i < world->num_views; ++i)
+	{
+	    const int* viewport = world->views[i].viewport;
+	    glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+	    world->current_view = i;
 	    render();
 	}
 
+	// fence the streamed data of this frame
+	StreamBuffer::Get()->endFrame();
+	UniformBuffer::EndFrame();
+
 	// Swap between front buffer and back buffer
 	SDL_GL_SwapWindow(this->window);
 }
 
 void Game::update(double seconds_elapsed)
 {
+	// Assets requested while playing are uploaded a few every frame
+	AssetLoader::Get()->update();
+
 	if (current_stage) {
 		current_stage->update(seconds_elapsed);
 	}
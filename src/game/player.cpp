@@ -2,6 +2,7 @@
 #include "graphics/mesh.h"
 #include "graphics/texture.h"
 #include "graphics/shader.h"
+#include "graphics/stream_buffer.h"
 #include "framework/input.h"
 #include "game/game.h"
 #include "game/world.h"
@@ -9,6 +10,40 @@
 #include "framework/audio.h"
 
 
+//states of both players, built once, the transitions only depend on the parameters
+static AnimationGraph* getPlayerAnimationGraph()
+{
+    AnimationGraph* graph = AnimationGraph::Get("player");
+    if (graph)
+        return graph;
+
+    graph = new AnimationGraph();
+    graph->addState("idle", "data/meshes/animations/idle.skanim");
+    graph->addState("move", "data/meshes/animations/move.skanim");
+    graph->addState("brake", "data/meshes/animations/brake.skanim");
+    graph->addState("impulse", "data/meshes/animations/impulse.skanim");
+    graph->addState("fall", "data/meshes/animations/fall.skanim");
+    graph->addState("celebrate", "data/meshes/animations/celebrate.skanim");
+
+    // the conditions do not overlap, so the order does not matter
+    const sAnimConditionDesc fall[] = { { "grounded", ANIM_LESS, 0.5f }, { "air_time", ANIM_GREATER, 0.45f } };
+    const sAnimConditionDesc impulse[] = { { "grounded", ANIM_GREATER, 0.5f }, { "speed", ANIM_GREATER, 0.0f }, { "throttle", ANIM_GREATER, 0.5f } };
+    const sAnimConditionDesc brake[] = { { "grounded", ANIM_GREATER, 0.5f }, { "speed", ANIM_GREATER, 0.0f }, { "throttle", ANIM_LESS, -0.5f } };
+    const sAnimConditionDesc move[] = { { "grounded", ANIM_GREATER, 0.5f }, { "speed", ANIM_GREATER, 0.0f }, { "throttle", ANIM_GREATER_EQUAL, -0.5f }, { "throttle", ANIM_LESS_EQUAL, 0.5f } };
+    const sAnimConditionDesc celebrate[] = { { "grounded", ANIM_GREATER, 0.5f }, { "speed", ANIM_LESS_EQUAL, 0.0f }, { "celebrate", ANIM_GREATER, 0.5f } };
+    const sAnimConditionDesc idle[] = { { "grounded", ANIM_GREATER, 0.5f }, { "speed", ANIM_LESS_EQUAL, 0.0f }, { "celebrate", ANIM_LESS, 0.5f } };
+    graph->addTransition(nullptr, "fall", 0.2f, fall, 2);
+    graph->addTransition(nullptr, "impulse", 0.2f, impulse, 3);
+    graph->addTransition(nullptr, "brake", 0.2f, brake, 3);
+    graph->addTransition(nullptr, "move", 0.2f, move, 4);
+    graph->addTransition(nullptr, "celebrate", 0.2f, celebrate, 3);
+    graph->addTransition(nullptr, "idle", 0.2f, idle, 3);
+
+    graph->default_state = graph->getState("idle");
+    graph->registerGraph("player");
+    return graph;
+}
+
 Player::Player(Mesh* mesh, const Material& material, const std::string& name)
     : EntityMesh(mesh, material)
 {
@@ -17,11 +52,14 @@ Player::Player(Mesh* mesh, const Material& material, const std::string& name)
     //Animations
     isAnimated = true;
     
-    //initialize animator
-    Animation* idle = Animation::Get("data/meshes/animations/idle.skanim");
-    if (idle) {
-        animator.playAnimation("data/meshes/animations/idle.skanim", true);
-    }
+    //initialize animator, the graph picks the clips from the parameters set every update
+    AnimationGraph* graph = getPlayerAnimationGraph();
+    animator.setGraph(graph);
+    anim_grounded = graph->getParameter("grounded");
+    anim_speed = graph->getParameter("speed");
+    anim_throttle = graph->getParameter("throttle");
+    anim_celebrate = graph->getParameter("celebrate");
+    anim_air_time = graph->getParameter("air_time");
 
     //init falling snow particles
     for (int i = 0; i < MAX_FALLING_SNOW; i++) {
@@ -74,17 +112,34 @@ void Player::renderFallingSnow(Camera* camera) {
     glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
     glDepthMask(GL_FALSE);
     
-    glPointSize(2.5f);
-    glBegin(GL_POINTS);
+    // pack the active particles and stream them, no immediate mode calls per particle
+    struct sSnowVertex {
+        Vector3 position;
+        Vector4 color;
+    };
+    sSnowVertex vertices[MAX_FALLING_SNOW];
+    int num_vertices = 0;
     for (int i = 0; i < MAX_FALLING_SNOW; i++) {
         if (falling_snow[i].active) {
-            glColor4f(1.0f, 1.0f, 1.0f, falling_snow[i].alpha);
-            glVertex3f(falling_snow[i].position.x, 
-                      falling_snow[i].position.y, 
-                      falling_snow[i].position.z);
+            vertices[num_vertices].position = falling_snow[i].position;
+            vertices[num_vertices].color.set(1.0f, 1.0f, 1.0f, falling_snow[i].alpha);
+            num_vertices++;
         }
     }
-    glEnd();
+
+    if (num_vertices) {
+        size_t offset = StreamBuffer::Get()->upload(vertices, num_vertices * sizeof(sSnowVertex));
+
+        glPointSize(2.5f);
+        glEnableClientState(GL_VERTEX_ARRAY);
+        glEnableClientState(GL_COLOR_ARRAY);
+        glVertexPointer(3, GL_FLOAT, sizeof(sSnowVertex), (void*)offset);
+        glColorPointer(4, GL_FLOAT, sizeof(sSnowVertex), (void*)(offset + sizeof(Vector3)));
+        glDrawArrays(GL_POINTS, 0, num_vertices);
+        glDisableClientState(GL_COLOR_ARRAY);
+        glDisableClientState(GL_VERTEX_ARRAY);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
     
     glDepthMask(GL_TRUE);
     glDisable(GL_BLEND);
@@ -495,6 +550,10 @@ void Player::update(float seconds_elapsed)
     }
 
     /////////////////////////////////// ANIMATION STATE SYSTEM ///////////////////////////////////
+    //the animation graph picks the clip from these, set before the animator update
+    float anim_speed_value = velocity.length();
+    float throttle = 0.0f;
+    bool celebrate = false;
     if (is_grounded) {
         if (velocity.length() > 0.0f) {
             //play move sound if not already playing
@@ -507,17 +566,11 @@ void Player::update(float seconds_elapsed)
             if (this == World::get_instance()->player2) {
                 if (Input::isKeyPressed(SDL_SCANCODE_UP) || 
                     (Input::gamepads[1].connected && Input::gamepads[1].axis[LEFT_ANALOG_Y] < -0.3f)) {
-                    if (animation_state != eAnimationState::IMPULSE) {
-                        animator.playAnimation("data/meshes/animations/impulse.skanim");
-                        animation_state = eAnimationState::IMPULSE;
-                    }
+                    throttle = 1.0f;
                 } else if (Input::isKeyPressed(SDL_SCANCODE_DOWN) || 
                           (Input::gamepads[1].connected && Input::gamepads[1].axis[LEFT_ANALOG_Y] > 0.3f)) {
-                    if (animation_state != eAnimationState::BRAKE) {
-                        animator.playAnimation("data/meshes/animations/brake.skanim");
-                        animation_state = eAnimationState::BRAKE;
-                    }
-                    
+                    throttle = -1.0f;
+
                     //stop move sound if playing
                     if (is_move_sound_playing) {
                         Audio::Stop(move_sound_channel);
@@ -541,11 +594,6 @@ void Player::update(float seconds_elapsed)
                         velocity = velocity.normalize() * current_speed;
                     }
                 } else {
-                    if (animation_state != eAnimationState::MOVE) {
-                        animator.playAnimation("data/meshes/animations/move.skanim");
-                        animation_state = eAnimationState::MOVE;
-                    }
-                    
                     //stop brake sound if playing
                     if (is_brake_sound_playing) {
                         Audio::Stop(brake_sound_channel);
@@ -555,17 +603,11 @@ void Player::update(float seconds_elapsed)
             } else { //player 1 controls
                 if (Input::isKeyPressed(SDL_SCANCODE_W) || 
                     (Input::gamepads[0].connected && Input::gamepads[0].axis[LEFT_ANALOG_Y] < -0.3f)) {
-                    if (animation_state != eAnimationState::IMPULSE) {
-                        animator.playAnimation("data/meshes/animations/impulse.skanim");
-                        animation_state = eAnimationState::IMPULSE;
-                    }
+                    throttle = 1.0f;
                 } else if (Input::isKeyPressed(SDL_SCANCODE_S) || 
                           (Input::gamepads[0].connected && Input::gamepads[0].axis[LEFT_ANALOG_Y] > 0.3f)) {
-                    if (animation_state != eAnimationState::BRAKE) {
-                        animator.playAnimation("data/meshes/animations/brake.skanim");
-                        animation_state = eAnimationState::BRAKE;
-                    }
-                    
+                    throttle = -1.0f;
+
                     //stop move sound if playing
                     if (is_move_sound_playing) {
                         Audio::Stop(move_sound_channel);
@@ -589,11 +631,6 @@ void Player::update(float seconds_elapsed)
                         velocity = velocity.normalize() * current_speed;
                     }
                 } else {
-                    if (animation_state != eAnimationState::MOVE) {
-                        animator.playAnimation("data/meshes/animations/move.skanim");
-                        animation_state = eAnimationState::MOVE;
-                    }
-                    
                     //stop brake sound if playing
                     if (is_brake_sound_playing) {
                         Audio::Stop(brake_sound_channel);
@@ -616,37 +653,13 @@ void Player::update(float seconds_elapsed)
             
             //celebrate animation with different keys for each player
             if (this == World::get_instance()->player2) {
-                if (Input::isKeyPressed(SDL_SCANCODE_M)) {
-                    if (animation_state != eAnimationState::CELEBRATE) {
-                        animator.playAnimation("data/meshes/animations/celebrate.skanim");
-                        animation_state = eAnimationState::CELEBRATE;
-                    }
-                } else {
-                    if (animation_state != eAnimationState::IDLE) {
-                        animator.playAnimation("data/meshes/animations/idle.skanim");
-                        animation_state = eAnimationState::IDLE;
-                    }
-                }
+                celebrate = Input::isKeyPressed(SDL_SCANCODE_M);
             } else { // Player 1
-                if (Input::isKeyPressed(SDL_SCANCODE_V)) {
-                    if (animation_state != eAnimationState::CELEBRATE) {
-                        animator.playAnimation("data/meshes/animations/celebrate.skanim");
-                        animation_state = eAnimationState::CELEBRATE;
-                    }
-                } else {
-                    if (animation_state != eAnimationState::IDLE) {
-                        animator.playAnimation("data/meshes/animations/idle.skanim");
-                        animation_state = eAnimationState::IDLE;
-                    }
-                }
+                celebrate = Input::isKeyPressed(SDL_SCANCODE_V);
             }
         }
-    } else if (air_time > 0.45f) {        
-        if (animation_state != eAnimationState::JUMP) {
-            animator.playAnimation("data/meshes/animations/fall.skanim");
-            animation_state = eAnimationState::JUMP;
-        }
-    }else if (air_time > 0.25f) {
+    } else if (air_time > 0.25f && air_time <= 0.45f) { //longer falls only change the animation
+
         //stop all sounds when player not on ground
         //(except wind sound)
         if (is_move_sound_playing) {
@@ -680,6 +693,11 @@ void Player::update(float seconds_elapsed)
 
 
     //animations
+    animator.setParameter(anim_grounded, is_grounded ? 1.0f : 0.0f);
+    animator.setParameter(anim_speed, anim_speed_value);
+    animator.setParameter(anim_throttle, throttle);
+    animator.setParameter(anim_celebrate, celebrate ? 1.0f : 0.0f);
+    animator.setParameter(anim_air_time, air_time);
     animator.update(seconds_elapsed);
 
     updateFallingSnow(seconds_elapsed, World::get_instance()->camera->eye);
@@ -4,17 +4,6 @@
 #include "framework/animation.h"
 #include "framework/audio.h"
 
-enum eAnimationState {
-    IDLE,
-    MOVE,
-    BRAKE,
-    IMPULSE,
-    JUMP,
-    FALL,
-    COLLISION,
-    CELEBRATE
-};
-
 #define MAX_FALLING_SNOW 500  //constant for falling snow
 
 struct FallingSnow {
@@ -57,8 +46,12 @@ private:
     bool is_grounded;
     Vector3 ground_normal;
 
-    //animations
-    eAnimationState animation_state = eAnimationState::IDLE;
+    //animation graph parameters, resolved once
+    int anim_grounded = -1;
+    int anim_speed = -1;
+    int anim_throttle = -1;
+    int anim_celebrate = -1;
+    int anim_air_time = -1;
 
     //movement variables
     float bounce_force = 5.0f;
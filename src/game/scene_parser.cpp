@@ -4,13 +4,15 @@
 #include "graphics/mesh.h"
 #include "graphics/texture.h"
 #include "graphics/shader.h"
+#include "graphics/animation_texture.h"
+#include "graphics/asset_loader.h"
 #include "framework/utils.h"
 #include "framework/entities/entityMesh.h"
 #include "framework/entities/entity_collider.h"
 
 #include <fstream>
 
-bool SceneParser::parse(const char* filename, Entity* root)
+bool SceneParser::load(const char* filename)
 {
 	std::cout << " + Scene loading: " << filename << "..." << std::endl;
 
@@ -46,6 +48,27 @@ bool SceneParser::parse(const char* filename, Entity* root)
 		mesh_count++;
 	}
 
+	// Decoded by the loader workers meanwhile
+	for (auto& data : meshes_to_load) {
+		if (data.first.find("@tag") == std::string::npos)
+			AssetLoader::Get()->requestMesh(("data/" + data.first).c_str());
+	}
+
+	std::cout << "Scene [OK]" << " Meshes requested: " << mesh_count << std::endl;
+	return true;
+}
+
+bool SceneParser::parse(const char* filename, Entity* root)
+{
+	if (meshes_to_load.empty() && !load(filename))
+		return false;
+	AssetLoader::Get()->finish();
+
+	std::string mesh_name;
+	int mesh_count = 0;
+	for (auto& data : meshes_to_load)
+		mesh_count += (int)data.second.models.size();
+
 	// Iterate through meshes loaded and create corresponding entities
 	for (auto data : meshes_to_load) {
 
@@ -101,6 +124,9 @@ bool SceneParser::parse(const char* filename, Entity* root)
 		}
 
 		new_entity->name = data.first;
+		new_entity->is_occluder = data.first.find("@occluder") != std::string::npos;
+		if (data.first.find("@crowd") != std::string::npos)
+			new_entity->crowd_animation = CROWD_ANIMATION;
 
 		// Create instanced entity
 		if (render_data.models.size() > 1) {
@@ -12,5 +12,7 @@ class SceneParser {
 	std::map<std::string, sRenderData> meshes_to_load;
 
 public:
-	bool parse(const char* filename, Entity* root);
+	bool load(const char* filename); //reads the scene and requests its meshes to the AssetLoader
+	bool parse(const char* filename, Entity* root); //waits for the meshes and creates the entities
+
 };
\ No newline at end of file
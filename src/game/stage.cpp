@@ -106,13 +106,8 @@ void PlayStage::onEnter(Stage* prev_stage) {
         // ensure animations are properly initialized before adding to scene
         world->player2->isAnimated = world->player->isAnimated;
         
-        // initialize animation with same state as player1
-        Animation* currentAnim = world->player->animator.getCurrentAnimation();
-        if (currentAnim) {
-            world->player2->animator.playAnimation(currentAnim->name.c_str(), true);
-        } else {
-            world->player2->animator.playAnimation("data/meshes/animations/idle.skanim", true);
-        }
+        // initialize animation with same state as player1 (it starts idle otherwise)
+        world->player2->animator.setState(world->player->animator.getState(), 0.0f);
         
         // add to scene after full initialization
         world->root->addChild(world->player2);
@@ -427,12 +422,7 @@ void PlayStage::onKeyDown(SDL_KeyboardEvent event) {
             world->player2->isAnimated = world->player->isAnimated;
             
             // initialize animation
-            Animation* currentAnim = world->player->animator.getCurrentAnimation();
-            if (currentAnim) {
-                world->player2->animator.playAnimation(currentAnim->name.c_str(), true);
-            } else {
-                world->player2->animator.playAnimation("data/meshes/animations/idle.skanim", true);
-            }
+            world->player2->animator.setState(world->player->animator.getState(), 0.0f);
             
             // add to scene
             world->root->addChild(world->player2);
@@ -8,10 +8,17 @@
 #include "graphics/shader.h"
 #include "graphics/mesh.h"
 #include "graphics/texture.h"
+#include "graphics/uniform_buffer.h"
+#include "graphics/animation_texture.h"
+#include "graphics/asset_loader.h"
+#include "framework/animation_manager.h"
+#include "framework/worker_pool.h"
 #include "scene_parser.h"
 #include "player.h"
 #include "game.h"
 
+#include <algorithm>
+
 World* World::instance = nullptr;
 
 World::World() {
@@ -25,6 +32,25 @@ World::World() {
     // Create root entity
     root = new Entity();
 
+    // Files are read and decoded by the loader workers while the shaders compile here
+    AssetLoader* loader = AssetLoader::Get();
+    SceneParser parser;
+    bool ok = parser.load("data/myscene.scene");
+    assert(ok);
+    loader->requestMesh("data/meshes/player.mesh");
+    loader->requestMesh("data/meshes/cubemap.ASE");
+    loader->requestTexture("data/meshes/playerColor.png");
+    Texture* cube_texture = loader->requestCubemap("landscape", {
+        "data/textures/skybox/right.png",
+        "data/textures/skybox/left.png",
+        "data/textures/skybox/bottom.png",
+        "data/textures/skybox/top.png",
+        "data/textures/skybox/front.png",
+        "data/textures/skybox/back.png"
+    });
+    Shader::Get("data/shaders/basic.vs", "data/shaders/cubemap.fs");
+    Shader::Get("data/shaders/phong.vs", "data/shaders/phong.fs");
+
     // Create and setup player
     Material player_material;
     player_material.shader = Shader::Get("data/shaders/skinning_phong.vs", "data/shaders/skinning_phong.fs");
@@ -69,17 +95,7 @@ World::World() {
     }
     
     {
-        // Create skybox environment for player 1
-        Texture* cube_texture = new Texture();
-        cube_texture->loadCubemap("landscape", {
-            "data/textures/skybox/right.png",
-            "data/textures/skybox/left.png",
-            "data/textures/skybox/bottom.png",
-            "data/textures/skybox/top.png",
-            "data/textures/skybox/front.png",
-            "data/textures/skybox/back.png"
-        });
-
+        // Create skybox environment for player 1, the cubemap requested above
         Material cubemap_material;
         cubemap_material.shader = Shader::Get("data/shaders/basic.vs", "data/shaders/cubemap.fs");
         cubemap_material.diffuse = cube_texture;
@@ -97,9 +113,14 @@ World::World() {
     time = 0.0f;
 
     // Load scene
-    SceneParser parser;
-    bool ok = parser.parse("data/myscene.scene", root);
+    ok = parser.parse("data/myscene.scene", root);
     assert(ok);
+    collectOccluders(root);
+    collectStaticMeshes(root);
+    static_batch.build();
+    if (use_impostors)
+        collectImpostors(root);
+    collectCrowds(root);
 
     // Initialize phong shader
     phong_shader = Shader::Get("data/shaders/phong.vs", "data/shaders/phong.fs");
@@ -113,75 +134,320 @@ World::World() {
     light2_color = Vector3(0.85f, 0.9f, 1.0f);
 }
 
-void World::render() {
-    // determine which camera to use
-    Camera* current_camera = camera;
-    EntityMesh* current_skybox = skybox;
-    
-    // if in multiplayer mode use camera2 and skybox2
-    if (Game::instance->multiplayer_enabled) {
+void World::beginViews() {
+    num_views = 0;
+    current_view = 0;
+    views_ready = false;
+}
+
+int World::addView(Camera* view_camera, int x, int y, int width, int height) {
+    assert(num_views < RENDER_MAX_VIEWS);
+    sRenderView& view = views[num_views];
+    view.camera = view_camera;
+    view.viewport[0] = x;
+    view.viewport[1] = y;
+    view.viewport[2] = width;
+    view.viewport[3] = height;
+    // the second player has its own skybox
+    view.skybox = num_views > 0 && skybox2 ? skybox2 : skybox;
+    return num_views++;
+}
+
+void World::prepareViews() {
+    // a lone render call without views, use the whole viewport
+    if (num_views == 0) {
         int viewport[4];
         glGetIntegerv(GL_VIEWPORT, viewport);
-        
-        // If this is the right viewport (x > 0), use camera2 and skybox2
-        if (viewport[0] > 0 && Game::instance->camera2) {
-            current_camera = Game::instance->camera2;
-            current_skybox = skybox2;
-        }
+        addView(camera, viewport[0], viewport[1], viewport[2], viewport[3]);
     }
-    
+
+    // per frame data, the same for all the views
+    light_position = player->model.getTranslation() + Vector3(0, 300.0f, 0);
+    uploadLights();
+
+    // matrices and frustums must be ready before the workers read them
+    Camera* cameras[RENDER_MAX_VIEWS];
+    for (int i = 0; i < num_views; ++i) {
+        views[i].camera->updateViewMatrix();
+        views[i].camera->updateProjectionMatrix();
+        cameras[i] = views[i].camera;
+    }
+
+    // pose the characters once for all the views, at a rate that depends on how they are seen
+    AnimationManager::Get()->update(cameras, num_views);
+
+    render_items.clear();
+    root->addToRenderList(render_items);
+
+    // views are independent, every one culls and sorts in a worker of the pool
+    WorkerPool::Get()->run(num_views, [this](size_t i) { buildView((int)i); });
+
+    for (int i = 0; i < num_views; ++i)
+        OcclusionCuller::num_occluded += views[i].queue.num_occluded;
+
+    // the instances seen by several views go to a single queue
+    single_pass_frame = false;
+    if (use_single_pass && num_views > 1 && UniformBuffer::isMultiviewSupported()) {
+        RenderQueue* queues[RENDER_MAX_VIEWS];
+        for (int i = 0; i < num_views; ++i)
+            queues[i] = &views[i].queue;
+        multiview_queue.mergeViews(queues, num_views, render_items.size());
+        single_pass_frame = !multiview_queue.draw_calls.empty();
+    }
+    views_ready = true;
+}
+
+void World::buildView(int view_id) {
+    sRenderView& view = views[view_id];
+    view.queue.begin(view.camera);
+    if (use_occlusion && !occluders.empty()) {
+        renderOccluders(view);
+        view.queue.occlusion = &view.occlusion;
+    }
+    if (static_batch.isReady())
+        view.queue.batch = &static_batch;
+    view.queue.build(render_items, view_id);
+}
+
+void World::beginView(sRenderView& view) {
+    glViewport(view.viewport[0], view.viewport[1], view.viewport[2], view.viewport[3]);
+
     // set the camera as default
-    current_camera->enable();
-    
+    view.camera->enable();
+
+    // per view data shared by every program through the uniform blocks
+    UniformBuffer::UploadCamera(view.camera, (float)time);
+    UniformBuffer::UploadViewport(view.camera, view.viewport[0], view.viewport[1], view.viewport[2], view.viewport[3]);
+    uploadCameraPosition(view.camera);
+}
+
+void World::renderView(sRenderView& view) {
+    beginView(view);
+
     glDisable(GL_BLEND);
     glDisable(GL_CULL_FACE);
     glDisable(GL_DEPTH_TEST);
     
-    if(current_skybox)
-       current_skybox->render(current_camera);
+    if(view.skybox)
+       view.skybox->render(view.camera);
     
     glEnable(GL_DEPTH_TEST);
     
-    // set light parameters for phong
-    if (phong_shader) {
-        phong_shader->enable();
-        
-        // update light position to follow player
-        light_position = player->model.getTranslation() + Vector3(0, 300.0f, 0);
-        
-        phong_shader->setUniform3("u_light_position", light_position.x, light_position.y, light_position.z);
-        phong_shader->setUniform3("u_light_color", light_color.x, light_color.y, light_color.z);
-        phong_shader->setUniform3("u_light2_position", light2_position.x, light2_position.y, light2_position.z);
-        phong_shader->setUniform3("u_light2_color", light2_color.x, light2_color.y, light2_color.z);
-        phong_shader->setUniform3("u_camera_position", current_camera->eye.x, current_camera->eye.y, current_camera->eye.z);
-        
-        // set default material parameters
-        phong_shader->setUniform1("u_ambient", 0.45f);
-        phong_shader->setUniform1("u_diffuse", 0.6f);
-        phong_shader->setUniform1("u_specular", 0.2f);
-        phong_shader->setUniform1("u_shininess", 32.0f);
-        
-        phong_shader->disable();
+    // Render scene: the draw calls were culled and sorted by state in prepareViews
+    view.queue.flush();
+
+    // particles go after the opaque geometry
+    player->renderFallingSnow(view.camera);
+    if (player2)
+        player2->renderFallingSnow(view.camera);
+}
+
+void World::renderSinglePass() {
+    // backgrounds first, they are drawn without depth
+    glDisable(GL_BLEND);
+    glDisable(GL_CULL_FACE);
+    for (int i = 0; i < num_views; ++i) {
+        beginView(views[i]);
+        glDisable(GL_DEPTH_TEST);
+        if (views[i].skybox)
+            views[i].skybox->render(views[i].camera);
     }
-    
-    // set the same lighting for the player phong shader
-    Shader* player_shader = player->material.shader;
-    if (player_shader) {
-        player_shader->enable();
-        player_shader->setUniform3("u_light_position", light_position.x, light_position.y, light_position.z);
-        player_shader->setUniform3("u_light_color", light_color.x, light_color.y, light_color.z);
-        player_shader->setUniform3("u_light2_position", light2_position.x, light2_position.y, light2_position.z);
-        player_shader->setUniform3("u_light2_color", light2_color.x, light2_color.y, light2_color.z);
-        player_shader->setUniform3("u_camera_position", current_camera->eye.x, current_camera->eye.y, current_camera->eye.z);
-        player_shader->setUniform1("u_ambient", 0.45f);
-        player_shader->setUniform1("u_diffuse", 0.6f);
-        player_shader->setUniform1("u_specular", 0.2f);
-        player_shader->setUniform1("u_shininess", 32.0f);
-        player_shader->disable();
+    glEnable(GL_DEPTH_TEST);
+
+    // every view is a region of the area covering all of them
+    int min_x = views[0].viewport[0], min_y = views[0].viewport[1];
+    int max_x = min_x + views[0].viewport[2], max_y = min_y + views[0].viewport[3];
+    for (int i = 1; i < num_views; ++i) {
+        min_x = std::min(min_x, views[i].viewport[0]);
+        min_y = std::min(min_y, views[i].viewport[1]);
+        max_x = std::max(max_x, views[i].viewport[0] + views[i].viewport[2]);
+        max_y = std::max(max_y, views[i].viewport[1] + views[i].viewport[3]);
+    }
+    Camera* cameras[RENDER_MAX_VIEWS];
+    int viewports[RENDER_MAX_VIEWS * 4];
+    for (int i = 0; i < num_views; ++i) {
+        cameras[i] = views[i].camera;
+        viewports[i * 4 + 0] = views[i].viewport[0] - min_x;
+        viewports[i * 4 + 1] = views[i].viewport[1] - min_y;
+        viewports[i * 4 + 2] = views[i].viewport[2];
+        viewports[i * 4 + 3] = views[i].viewport[3];
+    }
+    UniformBuffer::UploadViews(cameras, viewports, num_views, max_x - min_x, max_y - min_y);
+
+    // the draws shared by the views, in one submission
+    bool viewport_index = UniformBuffer::useViewportIndex();
+    if (viewport_index) {
+        for (int i = 0; i < num_views; ++i)
+            glViewportIndexedf(i, (float)views[i].viewport[0], (float)views[i].viewport[1], (float)views[i].viewport[2], (float)views[i].viewport[3]);
+    }
+    else {
+        glViewport(min_x, min_y, max_x - min_x, max_y - min_y);
+        for (int i = 0; i < 4; ++i)
+            glEnable(GL_CLIP_DISTANCE0 + i);
+    }
+    multiview_queue.flush();
+    if (!viewport_index) {
+        for (int i = 0; i < 4; ++i)
+            glDisable(GL_CLIP_DISTANCE0 + i);
+    }
+
+    // what could not be shared (skinned or without the blocks) and the particles
+    for (int i = 0; i < num_views; ++i) {
+        beginView(views[i]);
+        views[i].queue.flush();
+        player->renderFallingSnow(views[i].camera);
+        if (player2)
+            player2->renderFallingSnow(views[i].camera);
+    }
+}
+
+void World::render() {
+    if (!views_ready)
+        prepareViews();
+    assert(current_view < num_views);
+
+    if (!single_pass_frame) {
+        renderView(views[current_view]);
+        return;
+    }
+
+    // everything is drawn with the first view, the rest only set their state for what comes after (HUD)
+    if (current_view == 0)
+        renderSinglePass();
+    beginView(views[current_view]);
+}
+
+void World::collectOccluders(Entity* entity) {
+    // authored ones (@occluder) or big static colliders
+    EntityMesh* entity_mesh = dynamic_cast<EntityMesh*>(entity);
+    if (entity_mesh && entity_mesh->mesh && !entity_mesh->isAnimated) {
+        Matrix44 model = entity_mesh->isInstanced && !entity_mesh->models.empty() ? entity_mesh->models[0] : entity_mesh->getGlobalMatrix();
+        BoundingBox box = transformBoundingBox(model, entity_mesh->mesh->box);
+        if (!entity_mesh->is_occluder && dynamic_cast<EntityCollider*>(entity) && box.halfsize.length() > OCCLUDER_MIN_RADIUS)
+            entity_mesh->is_occluder = true;
+        if (entity_mesh->is_occluder)
+            occluders.push_back(entity_mesh);
+    }
+
+    for (Entity* child : entity->children)
+        collectOccluders(child);
+}
+
+void World::collectStaticMeshes(Entity* entity) {
+    // skinned and moving entities (players) keep their own buffers
+    EntityMesh* entity_mesh = dynamic_cast<EntityMesh*>(entity);
+    if (entity_mesh && !entity_mesh->isAnimated && dynamic_cast<EntityCollider*>(entity))
+        static_batch.addMesh(entity_mesh->mesh);
+
+    for (Entity* child : entity->children)
+        collectStaticMeshes(child);
+}
+
+void World::collectImpostors(Entity* entity) {
+    // only worth it for meshes repeated many times
+    EntityMesh* entity_mesh = dynamic_cast<EntityMesh*>(entity);
+    if (entity_mesh && entity_mesh->mesh && entity_mesh->material.shader && entity_mesh->isInstanced &&
+        !entity_mesh->isAnimated && entity_mesh->models.size() >= IMPOSTOR_MIN_INSTANCES)
+        entity_mesh->impostor = Impostor::Get(entity_mesh->mesh, &entity_mesh->material);
+
+    for (Entity* child : entity->children)
+        collectImpostors(child);
+}
+
+void World::collectCrowds(Entity* entity) {
+    // the skinned instances keep the static pose if the clip can not be baked
+    EntityMesh* entity_mesh = dynamic_cast<EntityMesh*>(entity);
+    if (entity_mesh && entity_mesh->mesh && entity_mesh->isInstanced && !entity_mesh->crowd_animation.empty())
+        entity_mesh->crowd = AnimationTexture::Get(entity_mesh->mesh, entity_mesh->crowd_animation.c_str());
+
+    for (Entity* child : entity->children)
+        collectCrowds(child);
+}
+
+void World::renderOccluders(sRenderView& view) {
+    Camera* current_camera = view.camera;
+    struct sOccluderInstance {
+        float screen_size;
+        Mesh* mesh;
+        const Matrix44* model;
+    };
+
+    // only the biggest ones on screen are worth rasterizing (views run in parallel, nothing static here)
+    std::vector<sOccluderInstance> candidates;
+    std::vector<Matrix44> global_matrices(occluders.size());
+    for (size_t i = 0; i < occluders.size(); ++i) {
+        EntityMesh* occluder = occluders[i];
+        size_t num_instances = occluder->isInstanced ? occluder->models.size() : 1;
+        if (!occluder->isInstanced)
+            global_matrices[i] = occluder->getGlobalMatrix();
+        for (size_t j = 0; j < num_instances; ++j) {
+            const Matrix44* model = occluder->isInstanced ? &occluder->models[j] : &global_matrices[i];
+            BoundingBox box = transformBoundingBox(*model, occluder->mesh->box);
+            float radius = (float)box.halfsize.length();
+            if (current_camera->testSphereInFrustum(box.center, radius) == CLIP_OUTSIDE)
+                continue;
+            candidates.push_back({ current_camera->getProjectedScale(box.center, radius), occluder->mesh, model });
+        }
+    }
+
+    size_t count = std::min(candidates.size(), (size_t)OCCLUDER_MAX_COUNT);
+    std::partial_sort(candidates.begin(), candidates.begin() + count, candidates.end(), [](const sOccluderInstance& a, const sOccluderInstance& b) {
+        return a.screen_size > b.screen_size;
+    });
+
+    view.occlusion.begin(current_camera->viewprojection_matrix);
+    for (size_t i = 0; i < count; ++i)
+        view.occlusion.addOccluder(candidates[i].mesh, *candidates[i].model);
+    view.occlusion.end();
+}
+
+void World::uploadLights() {
+    // default material parameters go with the lights
+    sLightsBlock lights;
+    lights.light_position = light_position;
+    lights.light_color = light_color;
+    lights.light2_position = light2_position;
+    lights.light2_color = light2_color;
+    lights.ambient = 0.45f;
+    lights.diffuse = 0.6f;
+    lights.specular = 0.2f;
+    lights.shininess = 32.0f;
+
+    if (UniformBuffer::isSupported())
+        UniformBuffer::Get(UBLOCK_LIGHTS)->upload(&lights, sizeof(lights));
+
+    // shaders without the blocks still need the loose uniforms
+    Shader* shaders[] = { phong_shader, player->material.shader };
+    for (int i = 0; i < 2; ++i) {
+        Shader* shader = shaders[i];
+        if (!shader || (i == 1 && shader == phong_shader) || shader->hasUniformBlock(UBLOCK_LIGHTS))
+            continue;
+
+        shader->enable();
+        shader->setUniform(UNIFORM("u_light_position"), lights.light_position);
+        shader->setUniform(UNIFORM("u_light_color"), lights.light_color);
+        shader->setUniform(UNIFORM("u_light2_position"), lights.light2_position);
+        shader->setUniform(UNIFORM("u_light2_color"), lights.light2_color);
+        shader->setUniform(UNIFORM("u_ambient"), lights.ambient);
+        shader->setUniform(UNIFORM("u_diffuse"), lights.diffuse);
+        shader->setUniform(UNIFORM("u_specular"), lights.specular);
+        shader->setUniform(UNIFORM("u_shininess"), lights.shininess);
+        shader->disable();
+    }
+}
+
+void World::uploadCameraPosition(Camera* current_camera) {
+    // only for shaders without the camera block, it changes with every view
+    Shader* shaders[] = { phong_shader, player->material.shader };
+    for (int i = 0; i < 2; ++i) {
+        Shader* shader = shaders[i];
+        if (!shader || (i == 1 && shader == phong_shader) || shader->hasUniformBlock(UBLOCK_CAMERA))
+            continue;
+
+        shader->enable();
+        shader->setUniform(UNIFORM("u_camera_position"), current_camera->eye);
+        shader->disable();
     }
-    
-    // Render scene
-    root->render(current_camera);
 }
 
 void World::update(double seconds_elapsed) {
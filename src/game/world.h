@@ -2,6 +2,9 @@
 #include "framework/utils.h"
 #include "framework/entities/entity.h"
 #include "graphics/mesh.h"
+#include "graphics/render_queue.h"
+#include "graphics/occlusion_culler.h"
+#include "graphics/static_batch.h"
 
 class Camera;
 class Entity;
@@ -68,7 +71,57 @@ public:
 
     bool is_training_stage = true;  // by default, we assume we are in training stage
 
-    void render();
+    // a camera and a region of the window (split screen), with its own culled and sorted draw calls
+    struct sRenderView {
+        Camera* camera = nullptr;
+        int viewport[4] = { 0, 0, 0, 0 };
+        EntityMesh* skybox = nullptr;
+        RenderQueue queue;
+        OcclusionCuller occlusion;
+    };
+
+    sRenderView views[RENDER_MAX_VIEWS];
+    int num_views = 0;
+    int current_view = 0;       // the one drawn by the next call to render
+    bool views_ready = false;   // traversal and culling of this frame already done
+    std::vector<sRenderItem> render_items;  // one scene traversal shared by all the views
+
+    // draws seen by several views are submitted once, instanced per view (falls back to a pass per view)
+    bool use_single_pass = true;
+    bool single_pass_frame = false;
+    RenderQueue multiview_queue;
+
+    // big meshes of the scene rasterized on the CPU to cull what is behind them
+    bool use_occlusion = true;
+    std::vector<EntityMesh*> occluders;
+    void collectOccluders(Entity* entity);
+
+    // static meshes of the scene packed in shared buffers
+    StaticBatch static_batch;
+    void collectStaticMeshes(Entity* entity);
+    void renderOccluders(sRenderView& view);
+
+    // billboards for the far instances of the props repeated across the slope
+    bool use_impostors = true;
+    void collectImpostors(Entity* entity);
+
+    // spectators tagged @crowd, animated on the GPU with a baked clip
+    void collectCrowds(Entity* entity);
+
+    // views of the frame, set before rendering them
+    void beginViews();
+    int addView(Camera* view_camera, int x, int y, int width, int height);
+    // traverses the scene once and builds the queues of all the views in parallel
+    void prepareViews();
+    void buildView(int view_id);
+    void beginView(sRenderView& view);  // viewport, camera and its uniforms
+    void renderView(sRenderView& view);
+    void renderSinglePass();            // all the views at once
+
+    void render();  // renders the current view
+    // fills the lights block once per frame, or the loose uniforms for shaders without it
+    void uploadLights();
+    void uploadCameraPosition(Camera* current_camera);
     void update(double seconds_elapsed);
 
     // Scene management
@@ -0,0 +1,192 @@
+#include "animation_texture.h"
+#include "mesh.h"
+#include "shader.h"
+#include "texture.h"
+#include "material.h"
+#include "uniform_buffer.h"
+#include "framework/animation.h"
+#include "framework/utils.h"
+
+#include <cassert>
+#include <cmath>
+#include <cstdio>
+
+std::map<std::pair<Mesh*, std::string>, AnimationTexture*> AnimationTexture::sTexturesLoaded;
+long AnimationTexture::num_instances_rendered = 0;
+
+//texelFetch needs GLSL 1.30, the rest is the same as the other shaders
+static const char* ANIM_TEXTURE_VS =
+	"attribute vec3 a_vertex;\n"
+	"attribute vec3 a_normal;\n"
+	"attribute vec2 a_uv;\n"
+	"attribute vec4 a_bones;\n"
+	"attribute vec4 a_weights;\n"
+	"attribute mat4 a_model;\n"
+	"attribute vec4 a_anim;\n" //time offset, speed
+	"uniform sampler2D u_anim_texture;\n"
+	"uniform vec2 u_anim_info;\n" //frames, samples per second
+	"varying vec3 v_world_position;\n"
+	"varying vec3 v_normal;\n"
+	"varying vec2 v_uv;\n"
+	"mat4 fetchBone(float bone, int frame) {\n"
+	"	int x = int(bone) * 3;\n"
+	"	vec4 r0 = texelFetch(u_anim_texture, ivec2(x, frame), 0);\n"
+	"	vec4 r1 = texelFetch(u_anim_texture, ivec2(x + 1, frame), 0);\n"
+	"	vec4 r2 = texelFetch(u_anim_texture, ivec2(x + 2, frame), 0);\n"
+	"	return mat4(r0.x, r1.x, r2.x, 0.0, r0.y, r1.y, r2.y, 0.0, r0.z, r1.z, r2.z, 0.0, r0.w, r1.w, r2.w, 1.0);\n"
+	"}\n"
+	"mat4 skinMatrix(int frame) {\n"
+	"	return fetchBone(a_bones.x, frame) * a_weights.x + fetchBone(a_bones.y, frame) * a_weights.y +\n"
+	"		fetchBone(a_bones.z, frame) * a_weights.z + fetchBone(a_bones.w, frame) * a_weights.w;\n"
+	"}\n"
+	"void main() {\n"
+	"	float frame = mod((u_time * a_anim.y + a_anim.x) * u_anim_info.y, u_anim_info.x);\n"
+	"	int frame_a = int(frame);\n"
+	"	int frame_b = int(mod(float(frame_a + 1), u_anim_info.x));\n" //loops to the first frame
+	"	mat4 skin = a_model * mix(skinMatrix(frame_a), skinMatrix(frame_b), fract(frame));\n"
+	"	vec4 world_position = skin * vec4(decodePosition(a_vertex), 1.0);\n"
+	"	v_world_position = world_position.xyz;\n"
+	"	v_normal = mat3(skin) * decodeNormal(a_normal);\n"
+	"	v_uv = a_uv;\n"
+	"	gl_Position = u_viewprojection * world_position;\n"
+	"}\n";
+
+static const char* ANIM_TEXTURE_FS =
+	"uniform vec4 u_tint;\n" //u_color is in the object block
+	"uniform sampler2D u_texture;\n"
+	"varying vec3 v_world_position;\n"
+	"varying vec3 v_normal;\n"
+	"varying vec2 v_uv;\n"
+	"void main() {\n"
+	"	vec4 albedo = u_tint * texture2D(u_texture, v_uv);\n"
+	"	if (albedo.a < 0.5) discard;\n"
+	"	vec3 N = normalize(v_normal);\n"
+	"	vec3 L = normalize(u_light_position - v_world_position);\n"
+	"	vec3 L2 = normalize(u_light2_position - v_world_position);\n"
+	"	vec3 light = vec3(u_ambient) + u_diffuse * (max(dot(N, L), 0.0) * u_light_color + max(dot(N, L2), 0.0) * u_light2_color);\n"
+	"	gl_FragColor = vec4(albedo.rgb * light, 1.0);\n"
+	"}\n";
+
+static Shader* getAnimationTextureShader()
+{
+	static Shader* shader = nullptr;
+	if (!shader)
+	{
+		std::string header = std::string("#version 130\n") + UNIFORM_BLOCKS_GLSL;
+		shader = new Shader();
+		bool ok = shader->compileFromMemory(header + QUANTIZATION_GLSL + ANIM_TEXTURE_VS, header + ANIM_TEXTURE_FS);
+		assert(ok && "error in animation texture shader");
+	}
+	return shader;
+}
+
+AnimationTexture::~AnimationTexture()
+{
+	delete texture;
+}
+
+bool AnimationTexture::isSupported()
+{
+	static int supported = -1;
+	if (supported == -1)
+	{
+		int major = 0, minor = 0;
+		const char* version = (const char*)glGetString(GL_VERSION);
+		if (version)
+			sscanf(version, "%d.%d", &major, &minor);
+		supported = UniformBuffer::isSupported() && major >= 3 && checkGLExtension("GL_ARB_instanced_arrays") ? 1 : 0;
+	}
+	return supported == 1;
+}
+
+AnimationTexture* AnimationTexture::Get(Mesh* mesh, const char* animation_filename)
+{
+	assert(mesh && animation_filename);
+	auto key = std::make_pair(mesh, std::string(animation_filename));
+	auto it = sTexturesLoaded.find(key);
+	if (it != sTexturesLoaded.end())
+		return it->second;
+	if (!isSupported())
+		return nullptr;
+
+	AnimationTexture* anim_texture = new AnimationTexture();
+	anim_texture->mesh = mesh;
+	anim_texture->animation = Animation::Get(animation_filename);
+	if (!anim_texture->animation || !anim_texture->bake())
+	{
+		delete anim_texture;
+		anim_texture = nullptr;
+	}
+	sTexturesLoaded[key] = anim_texture;
+	return anim_texture;
+}
+
+bool AnimationTexture::bake()
+{
+	num_bones = (int)mesh->bones_info.size();
+	num_frames = animation->num_keyframes;
+	if (!num_bones || !num_frames || num_frames > ANIM_TEXTURE_MAX_FRAMES || !animation->skeleton.rig)
+		return false;
+	assert(num_bones <= SKINNING_MAX_BONES);
+
+	long time = getTime();
+	samples_per_second = animation->samples_per_second;
+	duration = animation->duration;
+
+	//the same palette renderAnimated would upload, first 3 rows of every matrix
+	std::vector<Vector4> texels(num_bones * 3 * num_frames);
+	Skeleton pose;
+	std::vector<Matrix44> palette;
+	for (int frame = 0; frame < num_frames; ++frame)
+	{
+		animation->sample((frame + 0.5f) / samples_per_second, pose, true, false);
+		pose.computeFinalBoneMatrices(palette, mesh);
+		Vector4* row = &texels[frame * num_bones * 3];
+		for (int i = 0; i < num_bones; ++i)
+		{
+			const float* m = palette[i].m;
+			for (int r = 0; r < 3; ++r)
+				row[i * 3 + r].set(m[r], m[4 + r], m[8 + r], m[12 + r]);
+		}
+	}
+
+	texture = new Texture(num_bones * 3, num_frames, GL_RGBA, GL_FLOAT, false, (Uint8*)&texels[0], GL_RGBA32F);
+	glBindTexture(GL_TEXTURE_2D, texture->texture_id);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	std::cout << " + Animation texture baked: " << mesh->name << " " << animation->name << " " << num_frames << " frames, "
+		<< texels.size() * sizeof(Vector4) / 1024 << "KB Time: " << (getTime() - time) * 0.001 << "sec" << std::endl;
+	return true;
+}
+
+sInstanceData AnimationTexture::getInstance(const Matrix44& model, float speed) const
+{
+	Vector3 position = model.getTranslation();
+	float hash = sinf(position.x * 12.9898f + position.y * 4.1414f + position.z * 78.233f) * 43758.5453f;
+	sInstanceData instance;
+	instance.model = model;
+	instance.data.set((hash - floorf(hash)) * duration, speed, 0.0f, 0.0f);
+	return instance;
+}
+
+void AnimationTexture::render(const sInstanceData* instances, size_t count, const Material* material)
+{
+	if (!count || !texture)
+		return;
+
+	Shader* shader = getAnimationTextureShader();
+	shader->enable();
+	shader->setUniform(UNIFORM("u_anim_texture"), texture, 1);
+	shader->setUniform(UNIFORM("u_anim_info"), Vector2((float)num_frames, samples_per_second));
+	shader->setUniform(UNIFORM("u_tint"), material->color);
+	shader->setUniform(UNIFORM("u_texture"), material->diffuse ? material->diffuse : Texture::getWhiteTexture(), 0);
+
+	mesh->renderInstanced(GL_TRIANGLES, instances, (int)count, "a_model", "a_anim");
+
+	glActiveTexture(GL_TEXTURE0);
+	shader->disable();
+
+	num_instances_rendered += static_cast<long>(count);
+}
@@ -0,0 +1,53 @@
+/*  Animation textures: a looping clip baked for a skinned mesh so crowds need no CPU animation.
+	Every frame of the clip is sampled once and its final bone matrices (the skinning palette of the mesh)
+	are stored as rows of a float texture, 3 texels per bone (the last row of the matrix is always 0,0,0,1).
+	The vertex shader fetches the two frames around the time of each instance and skins with them, so all the
+	instances of a mesh go out in a single instanced draw, every one with its own time offset and speed.
+*/
+
+#pragma once
+
+#include "framework/includes.h"
+#include "framework/framework.h"
+#include <vector>
+#include <map>
+#include <string>
+
+class Mesh;
+class Material;
+class Texture;
+class Animation;
+struct sInstanceData;
+
+#define ANIM_TEXTURE_MAX_FRAMES 4096	//rows of the texture, longer clips are not baked
+#define CROWD_ANIMATION "data/meshes/animations/idle.skanim" //clip of the entities tagged @crowd
+
+class AnimationTexture
+{
+public:
+	static std::map<std::pair<Mesh*, std::string>, AnimationTexture*> sTexturesLoaded;
+
+	Mesh* mesh = nullptr;
+	Animation* animation = nullptr;
+	Texture* texture = nullptr;		//RGBA32F, num_bones * 3 x num_frames
+	int num_bones = 0;				//of the mesh, as indexed by a_bones
+	int num_frames = 0;
+	float samples_per_second = 0.0f;
+	float duration = 0.0f;
+
+	~AnimationTexture();
+
+	static bool isSupported();
+	//bakes it the first time, nullptr if not supported or the mesh is not skinned
+	static AnimationTexture* Get(Mesh* mesh, const char* animation_filename);
+
+	bool bake();
+
+	//the time offset comes from the position, so every instance keeps its own phase whatever the order of the draws
+	sInstanceData getInstance(const Matrix44& model, float speed = 1.0f) const;
+
+	//draws all the instances in a single call with the material texture and color, uses the camera and lights blocks
+	void render(const sInstanceData* instances, size_t count, const Material* material);
+
+	static long num_instances_rendered; //stats, reset every time the GPU stats are shown
+};
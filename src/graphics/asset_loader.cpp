@@ -0,0 +1,228 @@
+#include "asset_loader.h"
+#include "mesh.h"
+#include "texture.h"
+#include "framework/utils.h"
+#include "framework/worker_pool.h"
+
+#include <cassert>
+#include <algorithm>
+#include <iostream>
+#include <thread>
+
+AssetLoader* AssetLoader::Get()
+{
+	static AssetLoader* loader = nullptr;
+	if (!loader)
+		loader = new AssetLoader();
+	return loader;
+}
+
+void AssetLoader::requestMesh(const char* filename)
+{
+	assert(filename);
+	if (Mesh::sMeshesLoaded.find(filename) != Mesh::sMeshesLoaded.end() || isLoading(filename))
+		return;
+	std::shared_ptr<sJob> job = std::make_shared<sJob>();
+	job->type = ASSET_MESH;
+	job->filename = filename;
+	queue(job);
+}
+
+Texture* AssetLoader::requestTexture(const char* filename, bool mipmaps, bool wrap)
+{
+	assert(filename);
+	auto it = Texture::sTexturesLoaded.find(filename);
+	if (it != Texture::sTexturesLoaded.end())
+		return it->second;
+
+	std::shared_ptr<sJob> job = std::make_shared<sJob>();
+	job->type = ASSET_TEXTURE;
+	job->filename = filename;
+	job->mipmaps = mipmaps;
+	job->wrap = wrap;
+	job->texture = new Texture();
+	job->texture->filename = filename;
+	job->texture->setName(filename);
+	queue(job);
+	return job->texture;
+}
+
+Texture* AssetLoader::requestCubemap(const char* name, const std::vector<std::string>& faces)
+{
+	assert(name && faces.size() == 6);
+	auto it = Texture::sTexturesLoaded.find(name);
+	if (it != Texture::sTexturesLoaded.end())
+		return it->second;
+
+	std::shared_ptr<sJob> job = std::make_shared<sJob>();
+	job->type = ASSET_CUBEMAP;
+	job->filename = name;
+	job->faces = faces;
+	job->texture = new Texture();
+	job->texture->setName(name);
+	queue(job);
+	return job->texture;
+}
+
+bool AssetLoader::isLoading(const char* filename) const
+{
+	for (const std::shared_ptr<sJob>& job : jobs)
+		if (job->filename == filename)
+			return true;
+	return false;
+}
+
+void AssetLoader::queue(const std::shared_ptr<sJob>& job)
+{
+	job->num_items = job->type == ASSET_CUBEMAP ? (int)job->faces.size() : 1;
+	if (job->type != ASSET_MESH)
+		job->images.resize(job->num_items, nullptr);
+	job->remaining = job->num_items;
+	jobs.push_back(job);
+
+	//a task per item, the ones that find all the items taken do nothing
+	for (int i = 0; i < job->num_items; ++i)
+		WorkerPool::Get()->post([this, job] { processItem(job.get()); });
+}
+
+bool AssetLoader::processItem(sJob* job)
+{
+	int index = job->next_item.fetch_add(1);
+	if (index >= job->num_items)
+		return false;
+
+	if (job->type == ASSET_MESH)
+	{
+		job->mesh = new Mesh();
+		job->ok = job->mesh->loadFile(job->filename.c_str());
+	}
+	else
+	{
+		//textures fall back to the missing one as Texture::Get does, cubemaps need all their faces
+		const char* filename = job->type == ASSET_CUBEMAP ? job->faces[index].c_str() : job->filename.c_str();
+		Image* image = new Image();
+		if (!image->load(filename) && !(job->type == ASSET_TEXTURE && image->load(ASSET_MISSING_TEXTURE)))
+		{
+			std::cout << " + Texture loading: " << filename << " [ERROR]: Texture not found" << std::endl;
+			delete image;
+			image = nullptr;
+		}
+		job->images[index] = image;
+	}
+
+	//the last item of a job publishes it
+	if (job->remaining.fetch_sub(1, std::memory_order_acq_rel) != 1)
+		return true;
+	sJob* head = finished_head.load(std::memory_order_relaxed);
+	do
+		job->next_finished = head;
+	while (!finished_head.compare_exchange_weak(head, job, std::memory_order_release, std::memory_order_relaxed));
+	return true;
+}
+
+void AssetLoader::takeFinished()
+{
+	sJob* head = finished_head.exchange(nullptr, std::memory_order_acquire);
+	for (; head; head = head->next_finished)
+		finished.push_back(head);
+}
+
+void AssetLoader::upload(sJob* job)
+{
+	if (job->type == ASSET_MESH)
+	{
+		if (job->ok)
+			job->mesh->finishLoading();
+		else
+			delete job->mesh;
+		forget(job);
+		return;
+	}
+
+	bool decoded = true;
+	for (Image* image : job->images)
+		decoded = decoded && image;
+
+	if (decoded && job->type == ASSET_TEXTURE)
+		job->texture->createFromImage(job->images[0], job->mipmaps, job->wrap);
+	else if (decoded)
+		job->texture->createCubemapFromImages(&job->images[0], job->mipmaps, job->wrap);
+	if (decoded)
+		std::cout << " + Texture loaded: " << job->filename << " Size: " << job->texture->width << "x" << job->texture->height << std::endl;
+
+	for (Image* image : job->images)
+		delete image;
+	job->images.clear();
+	forget(job);
+}
+
+void AssetLoader::update(float budget_ms)
+{
+	if (jobs.empty())
+		return;
+	takeFinished();
+
+	//at least one per call so it always progresses
+	long time = getTime();
+	while (!finished.empty())
+	{
+		sJob* job = finished.back();
+		finished.pop_back();
+		upload(job);
+		if (budget_ms > 0.0f && getTime() - time >= budget_ms)
+			break;
+	}
+}
+
+void AssetLoader::wait(const char* filename)
+{
+	std::shared_ptr<sJob> job;
+	for (const std::shared_ptr<sJob>& queued : jobs)
+		if (queued->filename == filename)
+			job = queued;
+	if (!job)
+		return;
+
+	//the items no worker took yet are done here instead of waiting behind the rest of the queue
+	while (processItem(job.get()));
+	while (true)
+	{
+		takeFinished();
+		auto it = std::find(finished.begin(), finished.end(), job.get());
+		if (it != finished.end())
+		{
+			finished.erase(it);
+			upload(job.get());
+			return;
+		}
+		std::this_thread::yield();
+	}
+}
+
+void AssetLoader::finish()
+{
+	long time = getTime();
+	size_t loaded = num_loaded;
+	while (isBusy())
+	{
+		takeFinished();
+		if (finished.size())
+			update(0.0f);
+		else if (!WorkerPool::Get()->runTask()) //the main thread decodes too while it has nothing to upload
+			std::this_thread::yield();
+	}
+	if (num_loaded != loaded)
+		std::cout << " + Assets loaded: " << num_loaded - loaded << " with " << WorkerPool::Get()->getNumWorkers() + 1 << " threads Time: " << (getTime() - time) * 0.001 << "sec" << std::endl;
+}
+
+void AssetLoader::forget(sJob* job)
+{
+	//the requests done while uploading (textures of the materials) may have moved it
+	num_loaded++;
+	for (size_t i = 0; i < jobs.size(); ++i)
+		if (jobs[i].get() == job)
+		{
+			jobs.erase(jobs.begin() + i);
+			return;
+		}
+}
@@ -0,0 +1,79 @@
+/*  Loads the assets in parallel: the WorkerPool threads do the file reads and the decoding (PNG and TGA images,
+	OBJ/ASE/MESH parsing or the .mbin mapping, LODs and collision models) and the main thread, the only one
+	with a GL context, creates the textures and buffers of the finished ones within a time budget per call.
+	Every request is queued to the workers as soon as it is made, so the textures of the materials requested
+	while uploading a mesh are decoded right away. The workers hand the finished jobs through a lock-free list,
+	the main thread never waits for them unless it calls wait or finish. Shaders are compiled on the main thread
+	by Shader::Get as before.
+*/
+
+#pragma once
+
+#include "framework/framework.h"
+#include <vector>
+#include <string>
+#include <atomic>
+#include <memory>
+
+class Mesh;
+class Texture;
+class Image;
+
+#define ASSET_UPLOAD_BUDGET_MS 4.0f	//per frame once the game is running
+#define ASSET_MISSING_TEXTURE "data/textures/missing.tga"
+
+enum eAssetType : uint8 {
+	ASSET_MESH = 0,
+	ASSET_TEXTURE,
+	ASSET_CUBEMAP
+};
+
+class AssetLoader
+{
+public:
+	struct sJob {
+		eAssetType type;
+		std::string filename;			//the name of the cubemap
+		std::vector<std::string> faces;	//of the cubemaps
+		bool mipmaps = true;
+		bool wrap = true;
+		Mesh* mesh = nullptr;			//created by the worker
+		Texture* texture = nullptr;		//registered when requested, created in VRAM when uploaded
+		std::vector<Image*> images;		//one or the six faces
+		bool ok = true;
+		int num_items = 1;				//the faces of a cubemap are decoded in parallel
+		std::atomic<int> next_item{ 0 };	//taken by the workers, or by the main thread when it waits for the job
+		std::atomic<int> remaining{ 0 };	//items not processed yet, the last one publishes the job
+		sJob* next_finished = nullptr;
+	};
+
+	static AssetLoader* Get();
+
+	//queued to the workers right away, the textures are returned (and registered) at once and filled when uploaded
+	void requestMesh(const char* filename);
+	Texture* requestTexture(const char* filename, bool mipmaps = true, bool wrap = true);
+	Texture* requestCubemap(const char* name, const std::vector<std::string>& faces);
+
+	bool isLoading(const char* filename) const; //requested and not uploaded yet
+	bool isBusy() const { return !jobs.empty(); }
+
+	//main thread: uploads the finished jobs until the budget runs out
+	void update(float budget_ms = ASSET_UPLOAD_BUDGET_MS); //0 for no budget
+	//main thread: decodes (if no worker took it yet) and uploads a single job, blocking
+	void wait(const char* filename);
+	//main thread: uploads everything requested, including the ones requested meanwhile, blocking
+	void finish();
+
+private:
+	std::vector< std::shared_ptr<sJob> > jobs;	//main thread only, not uploaded yet (the tasks of the workers keep a reference)
+	std::vector<sJob*> finished;	//taken from the workers, waiting for the budget
+	size_t num_loaded = 0;
+
+	std::atomic<sJob*> finished_head{ nullptr };	//pushed by the workers, taken all at once by the main thread
+
+	void queue(const std::shared_ptr<sJob>& job);
+	bool processItem(sJob* job); //false if all the items were taken
+	void takeFinished();
+	void upload(sJob* job);
+	void forget(sJob* job); //uploaded, the tasks left may still hold it
+};
@@ -0,0 +1,306 @@
+#include "impostor.h"
+#include "mesh.h"
+#include "shader.h"
+#include "texture.h"
+#include "material.h"
+#include "fbo.h"
+#include "uniform_buffer.h"
+#include "stream_buffer.h"
+#include "framework/camera.h"
+#include "framework/utils.h"
+
+#include <cassert>
+#include <cmath>
+#include <string>
+
+std::map<std::pair<Mesh*, const Material*>, Impostor*> Impostor::sImpostorsLoaded;
+long Impostor::num_instances_rendered = 0;
+
+static std::string getImpostorDefines()
+{
+	return "#define AZIMUTHS " + std::to_string(IMPOSTOR_AZIMUTHS) + ".0\n"
+		"#define ELEVATIONS " + std::to_string(IMPOSTOR_ELEVATIONS) + ".0\n"
+		"#define MAX_ELEVATION " + std::to_string(IMPOSTOR_MAX_ELEVATION * DEG2RAD) + "\n"
+		"#define PI 3.14159265\n";
+}
+
+//renders the views of the atlas: albedo and normals in mesh space
+static const char* IMPOSTOR_BAKE_VS =
+	"attribute vec3 a_vertex;\n"
+	"attribute vec3 a_normal;\n"
+	"attribute vec2 a_uv;\n"
+	"uniform mat4 u_viewprojection;\n"
+	"varying vec3 v_normal;\n"
+	"varying vec2 v_uv;\n"
+	"void main() {\n"
+	"	v_normal = decodeNormal(a_normal);\n"
+	"	v_uv = a_uv;\n"
+	"	gl_Position = u_viewprojection * vec4(decodePosition(a_vertex), 1.0);\n"
+	"}\n";
+
+static const char* IMPOSTOR_BAKE_FS =
+	"uniform vec4 u_color;\n"
+	"uniform sampler2D u_texture;\n"
+	"varying vec3 v_normal;\n"
+	"varying vec2 v_uv;\n"
+	"void main() {\n"
+	"	vec4 color = u_color * texture2D(u_texture, v_uv);\n"
+	"	if (color.a < 0.5) discard;\n"
+	"	gl_FragData[0] = vec4(color.rgb, 1.0);\n"
+	"	gl_FragData[1] = vec4(normalize(v_normal) * 0.5 + 0.5, 1.0);\n"
+	"}\n";
+
+//picks the closest baked view and orients the quad like the bake camera did
+static const char* IMPOSTOR_VS =
+	"attribute vec3 a_vertex;\n"
+	"attribute vec4 a_instance;\n"
+	"attribute vec4 a_instance_data;\n"
+	"varying vec2 v_uv;\n"
+	"varying vec3 v_world_position;\n"
+	"varying float v_yaw;\n"
+	"varying float v_fade;\n"
+	"void main() {\n"
+	"	vec3 to_camera = u_camera_position - a_instance.xyz;\n"
+	"	float azimuth = atan(to_camera.z, to_camera.x) - a_instance_data.x;\n"
+	"	float elevation = atan(to_camera.y, length(to_camera.xz));\n"
+	"	float column = mod(floor(azimuth / (2.0 * PI) * AZIMUTHS + 0.5), AZIMUTHS);\n"
+	"	float row = clamp(floor(elevation / MAX_ELEVATION * (ELEVATIONS - 1.0) + 0.5), 0.0, ELEVATIONS - 1.0);\n"
+	"	vec3 forward = normalize(to_camera);\n"
+	"	vec3 right = cross(vec3(0.0, 1.0, 0.0), forward);\n"
+	"	right = dot(right, right) > 0.0001 ? normalize(right) : vec3(1.0, 0.0, 0.0);\n"
+	"	vec3 up = cross(forward, right);\n"
+	"	v_world_position = a_instance.xyz + (right * a_vertex.x + up * a_vertex.y) * a_instance.w;\n"
+	"	v_uv = (vec2(column, row) + a_vertex.xy * 0.5 + 0.5) / vec2(AZIMUTHS, ELEVATIONS);\n"
+	"	v_yaw = a_instance_data.x;\n"
+	"	v_fade = a_instance_data.y;\n"
+	"	gl_Position = u_viewprojection * vec4(v_world_position, 1.0);\n"
+	"}\n";
+
+static const char* IMPOSTOR_FS =
+	"uniform sampler2D u_texture;\n"
+	"uniform sampler2D u_normal_texture;\n"
+	"varying vec2 v_uv;\n"
+	"varying vec3 v_world_position;\n"
+	"varying float v_yaw;\n"
+	"varying float v_fade;\n"
+	"void main() {\n"
+	"	vec4 albedo = texture2D(u_texture, v_uv);\n"
+	"	float dither = fract(sin(dot(floor(gl_FragCoord.xy), vec2(12.9898, 78.233))) * 43758.5453);\n"
+	"	if (albedo.a < 0.5 || dither >= v_fade) discard;\n"
+	"	vec3 n = texture2D(u_normal_texture, v_uv).xyz * 2.0 - 1.0;\n"
+	"	float c = cos(v_yaw);\n"
+	"	float s = sin(v_yaw);\n"
+	"	vec3 N = normalize(vec3(n.x * c - n.z * s, n.y, n.x * s + n.z * c));\n"
+	"	vec3 L = normalize(u_light_position - v_world_position);\n"
+	"	vec3 L2 = normalize(u_light2_position - v_world_position);\n"
+	"	vec3 light = vec3(u_ambient) + u_diffuse * (max(dot(N, L), 0.0) * u_light_color + max(dot(N, L2), 0.0) * u_light2_color);\n"
+	"	gl_FragColor = vec4(albedo.rgb * light, 1.0);\n"
+	"}\n";
+
+static Shader* getBakeShader()
+{
+	static Shader* shader = nullptr;
+	if (!shader)
+	{
+		shader = new Shader();
+		bool ok = shader->compileFromMemory(std::string(QUANTIZATION_GLSL) + IMPOSTOR_BAKE_VS, IMPOSTOR_BAKE_FS);
+		assert(ok && "error in impostor bake shader");
+	}
+	return shader;
+}
+
+static Shader* getImpostorShader()
+{
+	static Shader* shader = nullptr;
+	if (!shader)
+	{
+		std::string header = std::string(UNIFORM_BLOCKS_GLSL) + getImpostorDefines();
+		shader = new Shader();
+		bool ok = shader->compileFromMemory(header + IMPOSTOR_VS, header + IMPOSTOR_FS);
+		assert(ok && "error in impostor shader");
+	}
+	return shader;
+}
+
+//corners of the quad, drawn as a strip
+static GLuint getQuadBuffer()
+{
+	static GLuint buffer = 0;
+	if (!buffer)
+	{
+		const float corners[] = { -1, -1, 0, 1, -1, 0, -1, 1, 0, 1, 1, 0 };
+		glGenBuffers(1, &buffer);
+		glBindBuffer(GL_ARRAY_BUFFER, buffer);
+		glBufferData(GL_ARRAY_BUFFER, sizeof(corners), corners, GL_STATIC_DRAW);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	}
+	return buffer;
+}
+
+Impostor::~Impostor()
+{
+	delete albedo;
+	delete normals;
+}
+
+bool Impostor::isSupported()
+{
+	static int supported = -1;
+	if (supported == -1)
+		supported = UniformBuffer::isSupported() && checkGLExtension("GL_ARB_instanced_arrays") && checkGLExtension("GL_ARB_framebuffer_object") ? 1 : 0;
+	return supported == 1;
+}
+
+Impostor* Impostor::Get(Mesh* mesh, const Material* material)
+{
+	assert(mesh && material);
+	auto key = std::make_pair(mesh, material);
+	auto it = sImpostorsLoaded.find(key);
+	if (it != sImpostorsLoaded.end())
+		return it->second;
+	if (!isSupported())
+		return nullptr;
+
+	Impostor* impostor = new Impostor();
+	impostor->mesh = mesh;
+	impostor->material = material;
+	if (!impostor->bake())
+	{
+		delete impostor;
+		impostor = nullptr;
+	}
+	sImpostorsLoaded[key] = impostor;
+	return impostor;
+}
+
+bool Impostor::bake()
+{
+	if (!mesh->getNumVertices())
+		return false;
+
+	long time = getTime();
+	center = mesh->box.center;
+	radius = (float)mesh->box.halfsize.length();
+	if (radius <= 0.0f)
+		return false;
+
+	FBO fbo;
+	fbo.create(IMPOSTOR_AZIMUTHS * IMPOSTOR_FRAME_SIZE, IMPOSTOR_ELEVATIONS * IMPOSTOR_FRAME_SIZE, 2, GL_RGBA, GL_UNSIGNED_BYTE, false);
+	fbo.bind();
+	float clear_color[4];
+	glGetFloatv(GL_COLOR_CLEAR_VALUE, clear_color);
+	glClearColor(0, 0, 0, 0);
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	glDisable(GL_BLEND);
+	glDisable(GL_CULL_FACE);
+	glEnable(GL_DEPTH_TEST);
+
+	Shader* shader = getBakeShader();
+	shader->enable();
+	shader->setUniform(UNIFORM("u_color"), material->color);
+	shader->setUniform(UNIFORM("u_texture"), material->diffuse ? material->diffuse : Texture::getWhiteTexture(), 0);
+
+	Camera camera;
+	camera.setOrthographic(-radius, radius, -radius, radius, radius * 0.5f, radius * 3.5f);
+	Vector3 up(0, 1, 0);
+	for (int row = 0; row < IMPOSTOR_ELEVATIONS; ++row)
+		for (int column = 0; column < IMPOSTOR_AZIMUTHS; ++column)
+		{
+			//same directions the vertex shader picks
+			float azimuth = column * 2.0f * PI / IMPOSTOR_AZIMUTHS;
+			float elevation = row * IMPOSTOR_MAX_ELEVATION * DEG2RAD / (IMPOSTOR_ELEVATIONS - 1);
+			Vector3 direction(cosf(elevation) * cosf(azimuth), sinf(elevation), cosf(elevation) * sinf(azimuth));
+			Vector3 eye = center + direction * (radius * 2.0f);
+			camera.lookAt(eye, center, up);
+
+			glViewport(column * IMPOSTOR_FRAME_SIZE, row * IMPOSTOR_FRAME_SIZE, IMPOSTOR_FRAME_SIZE, IMPOSTOR_FRAME_SIZE);
+			shader->setUniform(UNIFORM("u_viewprojection"), camera.viewprojection_matrix);
+			mesh->render(GL_TRIANGLES);
+		}
+
+	shader->disable();
+	fbo.unbind();
+	glClearColor(clear_color[0], clear_color[1], clear_color[2], clear_color[3]);
+
+	//the atlas outlives the FBO
+	albedo = fbo.color_textures[0];
+	normals = fbo.color_textures[1];
+	fbo.owns_textures = false;
+	Texture* textures[] = { albedo, normals };
+	for (Texture* texture : textures)
+	{
+		texture->generateMipmaps();
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 4); //smaller levels mix the views
+	}
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	std::cout << " + Impostor baked: " << mesh->name << " Time: " << (getTime() - time) * 0.001 << "sec" << std::endl;
+	return true;
+}
+
+static float getMaxScale(const Matrix44& model)
+{
+	return (float)std::max(Vector3(model.m[0], model.m[1], model.m[2]).length(), std::max(Vector3(model.m[4], model.m[5], model.m[6]).length(), Vector3(model.m[8], model.m[9], model.m[10]).length()));
+}
+
+float Impostor::computeFade(Camera* camera, const Matrix44& model) const
+{
+	float pixels = camera->getProjectedScale(model * center, radius * getMaxScale(model));
+	return clamp((IMPOSTOR_PIXEL_RADIUS * (1.0f + IMPOSTOR_FADE_RANGE) - pixels) / (IMPOSTOR_PIXEL_RADIUS * IMPOSTOR_FADE_RANGE), 0.0f, 1.0f);
+}
+
+sImpostorInstance Impostor::getInstance(const Matrix44& model, float fade) const
+{
+	//only the rotation around y is kept, the props stand upright
+	sImpostorInstance instance;
+	Vector3 world_center = model * center;
+	instance.center_radius.set(world_center.x, world_center.y, world_center.z, radius * getMaxScale(model));
+	instance.yaw_fade.set(atan2f(model.m[2], model.m[0]), fade, 0.0f, 0.0f);
+	return instance;
+}
+
+void Impostor::render(const sImpostorInstance* instances, size_t count)
+{
+	if (!count || !albedo)
+		return;
+
+	Shader* shader = getImpostorShader();
+	shader->enable();
+	shader->setUniform(UNIFORM("u_texture"), albedo, 0);
+	shader->setUniform(UNIFORM("u_normal_texture"), normals, 1);
+
+	int vertex_location = shader->getAttribLocation("a_vertex");
+	int instance_location = shader->getAttribLocation("a_instance");
+	int data_location = shader->getAttribLocation("a_instance_data");
+
+	glBindBuffer(GL_ARRAY_BUFFER, getQuadBuffer());
+	glEnableVertexAttribArray(vertex_location);
+	glVertexAttribPointer(vertex_location, 3, GL_FLOAT, GL_FALSE, 0, (void*)0);
+
+	//leaves the stream buffer bound
+	size_t offset = StreamBuffer::Get()->upload(instances, count * sizeof(sImpostorInstance));
+	const int stride = sizeof(sImpostorInstance);
+	glEnableVertexAttribArray(instance_location);
+	glVertexAttribPointer(instance_location, 4, GL_FLOAT, GL_FALSE, stride, (void*)offset);
+	glVertexAttribDivisor(instance_location, 1);
+	glEnableVertexAttribArray(data_location);
+	glVertexAttribPointer(data_location, 4, GL_FLOAT, GL_FALSE, stride, (void*)(offset + sizeof(Vector4)));
+	glVertexAttribDivisor(data_location, 1);
+
+	glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, (GLsizei)count);
+
+	glVertexAttribDivisor(instance_location, 0);
+	glVertexAttribDivisor(data_location, 0);
+	glDisableVertexAttribArray(vertex_location);
+	glDisableVertexAttribArray(instance_location);
+	glDisableVertexAttribArray(data_location);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glActiveTexture(GL_TEXTURE0);
+	shader->disable();
+
+	Mesh::num_meshes_rendered++;
+	Mesh::num_triangles_rendered += static_cast<long>(count * 2);
+	num_instances_rendered += static_cast<long>(count);
+}
@@ -0,0 +1,63 @@
+/*  Impostors: distant instances of a mesh drawn as camera facing quads.
+	The mesh is rendered once from IMPOSTOR_AZIMUTHS x IMPOSTOR_ELEVATIONS directions into an atlas
+	(albedo and normals, through an FBO) and every far instance picks the closest view in the vertex
+	shader, so all of them go out in a single instanced draw lit with the lights block.
+	While an instance is in the transition range the quad fades in over the real mesh with a dither.
+*/
+
+#pragma once
+
+#include "framework/includes.h"
+#include "framework/framework.h"
+#include <vector>
+#include <map>
+
+class Mesh;
+class Material;
+class Texture;
+class Shader;
+class Camera;
+
+#define IMPOSTOR_AZIMUTHS 8				//views around the mesh
+#define IMPOSTOR_ELEVATIONS 4			//rows from the horizon up to IMPOSTOR_MAX_ELEVATION
+#define IMPOSTOR_MAX_ELEVATION 67.5f	//degrees of the highest row, steeper views use it too
+#define IMPOSTOR_FRAME_SIZE 128			//pixels of every view in the atlas
+#define IMPOSTOR_PIXEL_RADIUS 48.0f		//projected radius in pixels under which an instance is only the impostor
+#define IMPOSTOR_FADE_RANGE 0.5f		//the quad starts fading in at IMPOSTOR_PIXEL_RADIUS * (1 + range)
+#define IMPOSTOR_MIN_INSTANCES 16		//instanced entities with fewer copies keep the meshes
+
+//per instance data of the instanced draw
+struct sImpostorInstance {
+	Vector4 center_radius;	//world space bounding sphere
+	Vector4 yaw_fade;		//rotation around y of the instance, fade in (0..1), unused
+};
+
+class Impostor
+{
+public:
+	static std::map<std::pair<Mesh*, const Material*>, Impostor*> sImpostorsLoaded;
+
+	Mesh* mesh = nullptr;
+	const Material* material = nullptr;
+	Texture* albedo = nullptr;		//alpha is the coverage
+	Texture* normals = nullptr;		//mesh space normals, packed to 0..1
+	Vector3 center;					//bounding sphere in mesh space
+	float radius = 0.0f;
+
+	~Impostor();
+
+	static bool isSupported();
+	//bakes it the first time, nullptr if not supported
+	static Impostor* Get(Mesh* mesh, const Material* material);
+
+	bool bake();
+
+	//0 draws only the mesh, 1 only the impostor, in between both
+	float computeFade(Camera* camera, const Matrix44& model) const;
+	sImpostorInstance getInstance(const Matrix44& model, float fade) const;
+
+	//draws all the instances in a single call, uses the camera and lights blocks
+	void render(const sImpostorInstance* instances, size_t count);
+
+	static long num_instances_rendered; //stats, reset every time the GPU stats are shown
+};
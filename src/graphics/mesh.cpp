@@ -10,19 +10,30 @@
 #include <limits>
 #include <sys/stat.h>
 #include <filesystem>
+#include <unordered_map>
+#include <sstream>
 
 #include "framework/camera.h"
 #include "texture.h"
+#include "stream_buffer.h"
+#include "uniform_buffer.h"
+#include "mesh_simplify.h"
+#include "mesh_optimize.h"
 #include "framework/animation.h"
+#include "framework/mapped_file.h"
+#include "asset_loader.h"
 #include "framework/extra/coldet/coldet.h"
 
 bool Mesh::use_binary = true;			//checks if there is .wbin, it there is one tries to read it instead of the other file
 bool Mesh::auto_upload_to_vram = true;	//uploads the mesh to the GPU VRAM to speed up rendering
 bool Mesh::interleave_meshes = true;	//places the geometry in an interleaved array
+bool Mesh::quantize_meshes = false;		//half the vertex size in VRAM, the shaders must #include "quantization"
+bool Mesh::cluster_cone_culling = true;	//only where the render queue culls the backfaces, the scene passes draw two sided
 
 std::map<std::string, Mesh*> Mesh::sMeshesLoaded;
 long Mesh::num_meshes_rendered = 0;
 long Mesh::num_triangles_rendered = 0;
+long Mesh::num_clusters_culled = 0;
 
 #define FORMAT_ASE 1
 #define FORMAT_OBJ 2
@@ -33,7 +44,12 @@ Mesh::Mesh()
 {
 	radius = 0;
 	vertices_vbo_id = uvs_vbo_id = uvs1_vbo_id = normals_vbo_id = colors_vbo_id = interleaved_vbo_id = indices_vbo_id = bones_vbo_id = weights_vbo_id = 0;
+	index_size = sizeof(unsigned int);
+	quantized_vbo_id = 0;
+	quantized_weights = false;
 	collision_model = NULL;
+	mapped_file = NULL;
+	num_bin_vertices = num_bin_indices = 0;
 	clear();
 }
 
@@ -64,23 +80,49 @@ void Mesh::clear()
 		glDeleteBuffersARB(1, &weights_vbo_id);
 	if (uvs1_vbo_id)
 		glDeleteBuffersARB(1, &uvs1_vbo_id);
+	if (quantized_vbo_id)
+		glDeleteBuffersARB(1, &quantized_vbo_id);
+	for (auto& it : bone_palettes)
+		if (it.second.buffer_id)
+			glDeleteBuffersARB(1, &it.second.buffer_id);
+
+	releaseVertexArrays();
 
 	//VBOs ids
-	vertices_vbo_id = uvs_vbo_id = normals_vbo_id = colors_vbo_id = interleaved_vbo_id = indices_vbo_id = weights_vbo_id = bones_vbo_id = uvs1_vbo_id = 0;
+	vertices_vbo_id = uvs_vbo_id = normals_vbo_id = colors_vbo_id = interleaved_vbo_id = indices_vbo_id = weights_vbo_id = bones_vbo_id = uvs1_vbo_id = quantized_vbo_id = 0;
+	quantized_weights = false;
+
+	bone_palettes.clear();
+
+	clearBuffers();
+}
 
-	//buffers
+void Mesh::clearBuffers()
+{
+	//no GL calls here, the loader workers use it too
 	vertices.clear();
 	normals.clear();
 	uvs.clear();
 	colors.clear();
 	interleaved.clear();
 	indices.clear();
+	lods.clear();
+	lod_ranges.clear();
+	lod_indices.clear();
 	bones.clear();
 	weights.clear();
 	uvs1.clear();
+	bone_remaps.clear();
+
+	delete mapped_file;
+	mapped_file = NULL;
+	mapped_streams = sMappedStreams();
+	bin_filename.clear();
+	num_bin_vertices = num_bin_indices = 0;
 
 	if (collision_model)
 		delete (CollisionModel3D*)collision_model;
+	collision_model = NULL;
 }
 
 int vertex_location = -1;
@@ -90,72 +132,180 @@ int color_location = -1;
 int bones_location = -1;
 int weights_location = -1;
 int uv1_location = -1;
+unsigned int bound_vertex_array = 0;
 
-void Mesh::enableBuffers(Shader* sh)
+bool Mesh::useVertexArrays()
 {
-	vertex_location = sh->getAttribLocation("a_vertex");
-	assert(vertex_location != -1 && "No a_vertex found in shader");
+	static int supported = -1;
+	if (supported == -1)
+		supported = checkGLExtension("GL_ARB_vertex_array_object") ? 1 : 0;
+	return supported == 1;
+}
 
-	if (vertex_location == -1)
-		return;
+void Mesh::releaseVertexArrays()
+{
+	for (sVertexArray& va : vertex_arrays)
+		glDeleteVertexArrays(1, &va.vao);
+	vertex_arrays.clear();
+}
 
-	int spacing = 0;
-	int offset_normal = 0;
-	int offset_uv = 0;
+const char* QUANTIZATION_GLSL =
+	"uniform vec4 u_quant_scale;\n"
+	"uniform vec3 u_quant_offset;\n"
+	"vec3 decodePosition(vec3 p) { return p * u_quant_scale.xyz + u_quant_offset; }\n"
+	"vec3 decodeNormal(vec3 n) {\n"
+	"	if (u_quant_scale.w == 0.0) return n;\n"
+	"	vec3 v = vec3(n.xy, 1.0 - abs(n.x) - abs(n.y));\n"
+	"	float t = max(-v.z, 0.0);\n"
+	"	v.x += v.x >= 0.0 ? -t : t;\n"
+	"	v.y += v.y >= 0.0 ? -t : t;\n"
+	"	return normalize(v);\n"
+	"}\n";
+
+bool Mesh::supportsQuantization(Shader* shader)
+{
+	return shader->getLocation(UNIFORM("u_quant_scale")) != -1;
+}
 
-	if (interleaved.size())
+void Mesh::enableBuffers(Shader* sh)
+{
+	//shaders that can decode the compact layout get the float version as identity
+	bool quantized = quantized_vbo_id && supportsQuantization(sh);
+	if (supportsQuantization(sh))
 	{
-		spacing = sizeof(tInterleaved);
-		offset_normal = sizeof(Vector3);
-		offset_uv = sizeof(Vector3) + sizeof(Vector3);
+		sh->setUniform(UNIFORM("u_quant_scale"), quantized ? quantization_scale : Vector4(1, 1, 1, 0));
+		sh->setUniform(UNIFORM("u_quant_offset"), quantized ? quantization_offset : Vector3(0, 0, 0));
+	}
+	else if (quantized_vbo_id && !interleaved_vbo_id)
+	{
+		//first draw with a shader that cannot decode it, the float vertices may have to be read from the .mbin again
+		sGeometry geometry;
+		if (getGeometry(geometry) && geometry.interleaved)
+		{
+			glGenBuffersARB(1, &interleaved_vbo_id);
+			glBindBufferARB(GL_ARRAY_BUFFER_ARB, interleaved_vbo_id);
+			glBufferDataARB(GL_ARRAY_BUFFER_ARB, geometry.num_vertices * sizeof(tInterleaved), geometry.interleaved, GL_STATIC_DRAW_ARB);
+			glBindBufferARB(GL_ARRAY_BUFFER_ARB, 0);
+		}
+		assert(interleaved_vbo_id && "the float vertices of the quantized mesh are missing");
 	}
 
-	glEnableVertexAttribArray(vertex_location);
-
-	if (vertices_vbo_id || interleaved_vbo_id)
+	//meshes in VRAM store the attribute setup in a VAO, built the first time a layout is used
+	if ((interleaved_vbo_id || vertices_vbo_id || quantized) && useVertexArrays())
 	{
-		glBindBuffer(GL_ARRAY_BUFFER, interleaved_vbo_id ? interleaved_vbo_id : vertices_vbo_id);
-		glVertexAttribPointer(vertex_location, 3, GL_FLOAT, GL_FALSE, spacing, 0);
+		uint32_t signature = sh->getAttribSignature();
+		for (sVertexArray& va : vertex_arrays)
+			if (va.signature == signature && va.quantized == quantized)
+			{
+				glBindVertexArray(va.vao);
+				bound_vertex_array = va.vao;
+				return;
+			}
+
+		sVertexArray& va = vertex_arrays.emplace_back();
+		va.signature = signature;
+		va.quantized = quantized;
+		glGenVertexArrays(1, &va.vao);
+		glBindVertexArray(va.vao);
+		bound_vertex_array = va.vao;
+		setupAttributes(sh);
+		if (indices_vbo_id)
+			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indices_vbo_id); //stored in the VAO
+		return;
 	}
-	else
-		glVertexAttribPointer(vertex_location, 3, GL_FLOAT, GL_FALSE, spacing, interleaved.size() ? &interleaved[0].vertex : &vertices[0]);
 
-	normal_location = -1;
-	if (normals.size() || spacing)
+	setupAttributes(sh);
+}
+
+void Mesh::setupAttributes(Shader* sh)
+{
+	vertex_location = sh->getAttribLocation("a_vertex");
+	assert(vertex_location != -1 && "No a_vertex found in shader");
+
+	if (vertex_location == -1)
+		return;
+
+	int spacing = 0;
+	if (quantized_vbo_id && supportsQuantization(sh))
 	{
+		const int stride = sizeof(tQuantized);
+		glEnableVertexAttribArray(vertex_location);
+		glBindBuffer(GL_ARRAY_BUFFER, quantized_vbo_id);
+		glVertexAttribPointer(vertex_location, 3, GL_SHORT, GL_TRUE, stride, 0);
+
 		normal_location = sh->getAttribLocation("a_normal");
 		if (normal_location != -1)
 		{
 			glEnableVertexAttribArray(normal_location);
-			if (normals_vbo_id || interleaved_vbo_id)
-			{
-				glBindBuffer(GL_ARRAY_BUFFER, interleaved_vbo_id ? interleaved_vbo_id : normals_vbo_id);
-				glVertexAttribPointer(normal_location, 3, GL_FLOAT, GL_FALSE, spacing, (void*)offset_normal);
-			}
-			else
-				glVertexAttribPointer(normal_location, 3, GL_FLOAT, GL_FALSE, spacing, interleaved.size() ? &interleaved[0].normal : &normals[0]);
+			glVertexAttribPointer(normal_location, 2, GL_SHORT, GL_TRUE, stride, (void*)offsetof(tQuantized, normal));
 		}
-	}
 
-	uv_location = -1;
-	if (uvs.size() || spacing)
-	{
 		uv_location = sh->getAttribLocation("a_uv");
 		if (uv_location != -1)
 		{
 			glEnableVertexAttribArray(uv_location);
-			if (uvs_vbo_id || interleaved_vbo_id)
+			glVertexAttribPointer(uv_location, 2, GL_HALF_FLOAT, GL_FALSE, stride, (void*)offsetof(tQuantized, uv));
+		}
+	}
+	else
+	{
+		int offset_normal = 0;
+		int offset_uv = 0;
+
+		if (hasInterleaved())
+		{
+			spacing = sizeof(tInterleaved);
+			offset_normal = sizeof(Vector3);
+			offset_uv = sizeof(Vector3) + sizeof(Vector3);
+		}
+
+		glEnableVertexAttribArray(vertex_location);
+
+		if (vertices_vbo_id || interleaved_vbo_id)
+		{
+			glBindBuffer(GL_ARRAY_BUFFER, interleaved_vbo_id ? interleaved_vbo_id : vertices_vbo_id);
+			glVertexAttribPointer(vertex_location, 3, GL_FLOAT, GL_FALSE, spacing, 0);
+		}
+		else
+			glVertexAttribPointer(vertex_location, 3, GL_FLOAT, GL_FALSE, spacing, interleaved.size() ? &interleaved[0].vertex : &vertices[0]);
+
+		normal_location = -1;
+		if (hasNormals() || spacing)
+		{
+			normal_location = sh->getAttribLocation("a_normal");
+			if (normal_location != -1)
 			{
-				glBindBuffer(GL_ARRAY_BUFFER, interleaved_vbo_id ? interleaved_vbo_id : uvs_vbo_id);
-				glVertexAttribPointer(uv_location, 2, GL_FLOAT, GL_FALSE, spacing, (void*)offset_uv);
+				glEnableVertexAttribArray(normal_location);
+				if (normals_vbo_id || interleaved_vbo_id)
+				{
+					glBindBuffer(GL_ARRAY_BUFFER, interleaved_vbo_id ? interleaved_vbo_id : normals_vbo_id);
+					glVertexAttribPointer(normal_location, 3, GL_FLOAT, GL_FALSE, spacing, (void*)offset_normal);
+				}
+				else
+					glVertexAttribPointer(normal_location, 3, GL_FLOAT, GL_FALSE, spacing, interleaved.size() ? &interleaved[0].normal : &normals[0]);
+			}
+		}
+
+		uv_location = -1;
+		if (hasUVs() || spacing)
+		{
+			uv_location = sh->getAttribLocation("a_uv");
+			if (uv_location != -1)
+			{
+				glEnableVertexAttribArray(uv_location);
+				if (uvs_vbo_id || interleaved_vbo_id)
+				{
+					glBindBuffer(GL_ARRAY_BUFFER, interleaved_vbo_id ? interleaved_vbo_id : uvs_vbo_id);
+					glVertexAttribPointer(uv_location, 2, GL_FLOAT, GL_FALSE, spacing, (void*)offset_uv);
+				}
+				else
+					glVertexAttribPointer(uv_location, 2, GL_FLOAT, GL_FALSE, spacing, interleaved.size() ? &interleaved[0].uv : &uvs[0]);
 			}
-			else
-				glVertexAttribPointer(uv_location, 2, GL_FLOAT, GL_FALSE, spacing, interleaved.size() ? &interleaved[0].uv : &uvs[0]);
 		}
 	}
 
 	uv1_location = -1;
-	if (uvs1.size())
+	if (hasUVs1())
 	{
 		uv1_location = sh->getAttribLocation("a_uv1");
 		if (uv1_location != -1)
@@ -172,7 +322,7 @@ void Mesh::enableBuffers(Shader* sh)
 	}
 
 	color_location = -1;
-	if (colors.size())
+	if (hasColors())
 	{
 		color_location = sh->getAttribLocation("a_color");
 		if (color_location != -1)
@@ -189,7 +339,7 @@ void Mesh::enableBuffers(Shader* sh)
 	}
 
 	bones_location = -1;
-	if (bones.size())
+	if (hasBones())
 	{
 		bones_location = sh->getAttribLocation("a_bones");
 		if (bones_location != -1)
@@ -205,7 +355,7 @@ void Mesh::enableBuffers(Shader* sh)
 		}
 	}
 	weights_location = -1;
-	if (weights.size())
+	if (weights.size() || weights_vbo_id)
 	{
 		weights_location = sh->getAttribLocation("a_weights");
 		if (weights_location != -1)
@@ -214,7 +364,10 @@ void Mesh::enableBuffers(Shader* sh)
 			if (weights_vbo_id)
 			{
 				glBindBuffer(GL_ARRAY_BUFFER, weights_vbo_id);
-				glVertexAttribPointer(weights_location, 4, GL_FLOAT, GL_FALSE, 0, NULL);
+				if (quantized_weights)
+					glVertexAttribPointer(weights_location, 4, GL_UNSIGNED_BYTE, GL_TRUE, 0, NULL);
+				else
+					glVertexAttribPointer(weights_location, 4, GL_FLOAT, GL_FALSE, 0, NULL);
 			}
 			else
 				glVertexAttribPointer(weights_location, 4, GL_FLOAT, GL_FALSE, 0, &weights[0]);
@@ -223,7 +376,7 @@ void Mesh::enableBuffers(Shader* sh)
 
 }
 
-void Mesh::render(unsigned int primitive, int submesh_id, int num_instances)
+void Mesh::render(unsigned int primitive, int submesh_id, int num_instances, int lod)
 {
 	Shader* shader = Shader::current;
 	if (!shader || !shader->compiled)
@@ -231,53 +384,269 @@ void Mesh::render(unsigned int primitive, int submesh_id, int num_instances)
 		assert(0 && "no shader or shader not compiled or enabled");
 		return;
 	}
-	assert((interleaved.size() || vertices.size()) && "No vertices in this mesh");
+	assert(getNumVertices() && "No vertices in this mesh");
 
 	//bind buffers to attribute locations
 	enableBuffers(shader);
 
+	drawSubmeshes(primitive, submesh_id, num_instances, lod);
+
+	//unbind them
+	disableBuffers(shader);
+}
+
+//constants of the materials of all the meshes, one aligned block each
+static std::vector<uint8> material_blocks;
+static size_t material_block_stride = 0;
+static bool material_blocks_dirty = false;
+
+//last material state sent, to skip redundant changes
+static int bound_material_block = -1;
+static unsigned int material_uniforms_program = 0;
+static int material_uniforms_block = -1;
+
+void Mesh::resolveMaterials()
+{
+	//decoded by the loader workers, drawn with a white texture (as untextured) until uploaded
+	for (sMaterialInfo& material : materials)
+		if (!material.Kd_texture && material.Kd_texture_name.size())
+			material.Kd_texture = AssetLoader::Get()->requestTexture(material.Kd_texture_name.c_str());
+
+	draw_call_materials.clear();
+	for (sSubmeshInfo& submesh : submeshes)
+		for (uint32_t j = 0; j < submesh.num_draw_calls; ++j)
+		{
+			int index = -1;
+			for (int k = 0; k < (int)materials.size(); ++k)
+				if (materials[k].name == submesh.draw_calls[j].material)
+				{
+					index = k;
+					break;
+				}
+			draw_call_materials.push_back(index);
+		}
+
+	if (!material_block_stride)
+	{
+		size_t alignment = UniformBuffer::isSupported() ? UniformBuffer::getOffsetAlignment() : 16;
+		material_block_stride = ((sizeof(sMaterialBlock) + alignment - 1) / alignment) * alignment;
+	}
+
+	for (sMaterialInfo& material : materials)
+	{
+		if (material.block_index != -1)
+			continue;
+		material.block_index = (int)(material_blocks.size() / material_block_stride);
+		material_blocks.resize(material_blocks.size() + material_block_stride);
+		sMaterialBlock* block = (sMaterialBlock*)&material_blocks[material.block_index * material_block_stride];
+		block->Ka = material.Ka;
+		block->Kd = material.Kd;
+		block->Ks = material.Ks;
+		block->maps.set(material.Kd_texture ? 1.0f : 0.0f, 0.0f);
+		material_blocks_dirty = true;
+	}
+}
+
+void Mesh::drawSubmeshes(unsigned int primitive, int submesh_id, int num_instances, int lod)
+{
+	Shader* shader = Shader::current;
+
 	//draw call
 	if (submesh_id == -1 && !materials.empty()) // if there's mesh mtl
 	{
+		bool use_block = shader->hasUniformBlock(UBLOCK_MATERIAL);
+		if (use_block && material_blocks_dirty)
+		{
+			UniformBuffer::Get(UBLOCK_MATERIAL)->upload(material_blocks.data(), material_blocks.size());
+			material_blocks_dirty = false;
+			bound_material_block = -1;
+		}
+
+		Texture* bound_texture = nullptr;
+		bool texture_set = false;
+		int flat_id = 0;
 		for (int i = 0; i < submeshes.size(); ++i) {
 			sSubmeshInfo& submesh = submeshes[i];
-			for (uint32_t j = 0; j < submesh.num_draw_calls; ++j) {
-				const sSubmeshDrawCallInfo& dc = submesh.draw_calls[j];
-				if (materials.count(dc.material) > 0) {
-					shader->setUniform("u_Ka", materials[dc.material].Ka);
-					shader->setUniform("u_Kd", materials[dc.material].Kd);
-					shader->setUniform("u_Ks", materials[dc.material].Ks);
-
-					if (materials[dc.material].Kd_texture && materials[dc.material].Kd_texture->texture_id != 0) {
-						shader->setUniform("u_texture", materials[dc.material].Kd_texture, 0);
+			for (uint32_t j = 0; j < submesh.num_draw_calls; ++j, ++flat_id) {
+				int material_id = flat_id < (int)draw_call_materials.size() ? draw_call_materials[flat_id] : -1;
+				if (material_id != -1) {
+					const sMaterialInfo& material = materials[material_id];
+					if (use_block) {
+						if (material.block_index != bound_material_block) {
+							UniformBuffer::Get(UBLOCK_MATERIAL)->bindRange(material.block_index * material_block_stride, sizeof(sMaterialBlock));
+							bound_material_block = material.block_index;
+						}
 					}
-					else {
-						glActiveTexture(GL_TEXTURE0);
-						glBindTexture(GL_TEXTURE_2D, 0);
+					else if (material.block_index != material_uniforms_block || shader->getProgram() != material_uniforms_program) {
+						shader->setUniform(UNIFORM("u_Ka"), material.Ka);
+						shader->setUniform(UNIFORM("u_Kd"), material.Kd);
+						shader->setUniform(UNIFORM("u_Ks"), material.Ks);
+						shader->setUniform(UNIFORM("u_maps"), Vector2(!!material.Kd_texture, 0));
+						material_uniforms_block = material.block_index;
+						material_uniforms_program = shader->getProgram();
 					}
 
-					shader->setUniform("u_maps", Vector2(!!materials[dc.material].Kd_texture, 0));
+					//u_maps says textured from the request on, the pending (or failed) ones sample white
+					Texture* texture = material.Kd_texture ? (material.Kd_texture->texture_id != 0 ? material.Kd_texture : Texture::getWhiteTexture()) : nullptr;
+					if (!texture_set || texture != bound_texture) {
+						if (texture)
+							shader->setUniform(UNIFORM("u_texture"), texture, 0);
+						else {
+							glActiveTexture(GL_TEXTURE0);
+							glBindTexture(GL_TEXTURE_2D, 0);
+						}
+						bound_texture = texture;
+						texture_set = true;
+					}
 				}
-				drawCall(primitive, i, j, num_instances);
+				drawCall(primitive, i, j, num_instances, lod);
 			}
 		}
 	}
 	else {
-		drawCall(primitive, submesh_id, 0, num_instances);
+		drawCall(primitive, submesh_id, 0, num_instances, lod);
 	}
+}
 
-	//unbind them
-	disableBuffers(shader);
+//view used to cull the clusters, set by the render queue before the draws of clustered meshes
+static Camera* cluster_camera = NULL;
+static Matrix44 cluster_model;
+static Vector3 cluster_eye; //in mesh space, computed by the first draw with clusters
+static bool cluster_eye_dirty = false;
+static bool cluster_backfaces = false; //GL culls the backfaces with GL_BACK and GL_CCW
+static bool cluster_cones = false; //and the model keeps the winding
+static std::vector<GLsizei> cluster_counts;
+static std::vector<const void*> cluster_offsets;
+
+void Mesh::setClusterView(Camera* camera, const Matrix44& model, bool cull_backfaces)
+{
+	cluster_camera = camera;
+	if (!camera)
+		return;
+	cluster_model = model;
+	cluster_backfaces = cull_backfaces;
+	cluster_eye_dirty = true;
 }
 
-void Mesh::drawCall(unsigned int primitive, int submesh_id, int draw_call_id, int num_instances)
+bool Mesh::drawClusters(unsigned int primitive, size_t start, size_t size)
 {
+	auto it = std::lower_bound(clusters.begin(), clusters.end(), start, [](const sMeshCluster& c, size_t value) { return c.start < value; });
+	if (it == clusters.end() || it->start >= start + size)
+		return false;
+
+	//the cones hold unsigned normals, they only tell what GL would discard anyway
+	if (cluster_eye_dirty)
+	{
+		Matrix44 inv = cluster_model;
+		inv.inverse();
+		cluster_eye = inv * cluster_camera->eye;
+		const float* m = cluster_model.m;
+		Vector3 right(m[0], m[1], m[2]), top(m[4], m[5], m[6]), front(m[8], m[9], m[10]);
+		cluster_cones = cluster_cone_culling && cluster_backfaces && right.dot(top.cross(front)) > 0.0f;
+		cluster_eye_dirty = false;
+	}
+
+	//visible clusters, the consecutive ones are merged in a single range
+	cluster_counts.clear();
+	cluster_offsets.clear();
+	size_t range_start = 0, range_end = 0, num_triangles = 0;
+	for (; it != clusters.end() && it->start < start + size; ++it)
+	{
+		const sMeshCluster& cluster = *it;
+
+		//all the triangles face away from the camera
+		Vector3 to_cluster = cluster.center - cluster_eye;
+		if (cluster_cones && to_cluster.dot(cluster.cone_axis) >= cluster.cone_cutoff * (float)to_cluster.length() + (float)cluster.halfsize.length())
+		{
+			num_clusters_culled++;
+			continue;
+		}
+
+		BoundingBox box = transformBoundingBox(cluster_model, BoundingBox(cluster.center, cluster.halfsize));
+		if (cluster_camera->testBoxInFrustum(box.center, box.halfsize) == CLIP_OUTSIDE)
+		{
+			num_clusters_culled++;
+			continue;
+		}
+
+		if (range_end != cluster.start)
+		{
+			if (range_end > range_start)
+			{
+				cluster_counts.push_back((GLsizei)(range_end - range_start) * 3);
+				cluster_offsets.push_back((const void*)(range_start * 3 * index_size));
+			}
+			range_start = cluster.start;
+		}
+		range_end = cluster.start + cluster.length;
+		num_triangles += cluster.length;
+	}
+	if (range_end > range_start)
+	{
+		cluster_counts.push_back((GLsizei)(range_end - range_start) * 3);
+		cluster_offsets.push_back((const void*)(range_start * 3 * index_size));
+	}
+
+	if (cluster_counts.size())
+	{
+		if (!bound_vertex_array)
+			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indices_vbo_id);
+		glMultiDrawElements(primitive, &cluster_counts[0], getIndexType(), &cluster_offsets[0], (GLsizei)cluster_counts.size());
+		if (!bound_vertex_array)
+			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+	}
+
+	num_triangles_rendered += static_cast<long>(num_triangles);
+	num_meshes_rendered++;
+	return true;
+}
+
+unsigned int Mesh::getIndexType() const
+{
+	return index_size == sizeof(unsigned short) ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+}
+
+void Mesh::drawCall(unsigned int primitive, int submesh_id, int draw_call_id, int num_instances, int lod)
+{
+	//simplified levels are always indexed, their indices go after the mesh ones in the same buffer
+	if (lod > 0 && lod <= (int)lods.size())
+	{
+		const sMeshLOD& level = lods[lod - 1];
+		size_t start = level.start;
+		size_t size = level.length;
+		if (submesh_id > -1)
+		{
+			assert(submesh_id < submeshes.size() && "this mesh doesnt have as many submeshes");
+			unsigned int flat_id = draw_call_id;
+			for (int i = 0; i < submesh_id; ++i)
+				flat_id += submeshes[i].num_draw_calls;
+			const sLODRange& range = lod_ranges[(lod - 1) * getNumDrawCalls() + flat_id];
+			start = range.start;
+			size = range.length;
+		}
+
+		if (indices_vbo_id)
+		{
+			void* offset = (void*)((getNumIndices() + start) * 3 * index_size);
+			if (!bound_vertex_array)
+				glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indices_vbo_id);
+			if (num_instances > 0)
+				glDrawElementsInstanced(primitive, size * 3, getIndexType(), offset, num_instances);
+			else
+				glDrawElements(primitive, size * 3, getIndexType(), offset);
+			if (!bound_vertex_array)
+				glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+		}
+		else
+			glDrawElements(primitive, size * 3, GL_UNSIGNED_INT, (void*)(&lod_indices[0] + start));
+
+		num_triangles_rendered += static_cast<long>(size * (num_instances ? num_instances : 1));
+		num_meshes_rendered++;
+		return;
+	}
+
 	size_t start = 0; //in primitives
-	size_t size = vertices.size();
-	if (indices.size())
-		size = indices.size();
-	else if (interleaved.size())
-		size = interleaved.size();
+	size_t size = getNumIndices() ? getNumIndices() : getNumVertices();
 
 	if (submesh_id > -1)
 	{
@@ -288,23 +657,32 @@ void Mesh::drawCall(unsigned int primitive, int submesh_id, int draw_call_id, in
 		size = dc.length;
 	}
 
+	//big meshes only send their visible clusters
+	if (cluster_camera && num_instances == 0 && clusters.size() && indices_vbo_id && drawClusters(primitive, start, size))
+		return;
+
 	//DRAW
-	if (indices.size())
+	if (getNumIndices())
 	{
 		if (num_instances > 0)
 		{
 			assert(indices_vbo_id && "indices must be uploaded to the GPU");
-			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indices_vbo_id);
-			glDrawElementsInstanced(primitive, size * 3, GL_UNSIGNED_INT, (void*)(start * sizeof(Vector3)), num_instances);
-			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+			if (!bound_vertex_array)
+				glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indices_vbo_id);
+			glDrawElementsInstanced(primitive, size * 3, getIndexType(), (void*)(start * 3 * index_size), num_instances);
+			if (!bound_vertex_array)
+				glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 		}
 		else
 		{
 			if (indices_vbo_id)
 			{
-				glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indices_vbo_id);
-				glDrawElements(primitive, size * 3, GL_UNSIGNED_INT, (void*)(start * sizeof(Vector3)));
-				glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+				//the VAO already has the index buffer
+				if (!bound_vertex_array)
+					glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indices_vbo_id);
+				glDrawElements(primitive, size * 3, getIndexType(), (void*)(start * 3 * index_size));
+				if (!bound_vertex_array)
+					glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 			}
 			else
 				glDrawElements(primitive, size * 3, GL_UNSIGNED_INT, (void*)(&indices[0] + start)); //no multiply, its a vector3u pointer)
@@ -318,12 +696,20 @@ void Mesh::drawCall(unsigned int primitive, int submesh_id, int draw_call_id, in
 			glDrawArrays(primitive, start, size);
 	}
 
-	num_triangles_rendered += static_cast<long>((size / 3) * (num_instances ? num_instances : 1));
+	size_t num_triangles = getNumIndices() ? size : size / 3; //ranges are in triangles when indexed
+	num_triangles_rendered += static_cast<long>(num_triangles * (num_instances ? num_instances : 1));
 	num_meshes_rendered++;
 }
 
 void Mesh::disableBuffers(Shader* shader)
 {
+	if (bound_vertex_array)
+	{
+		glBindVertexArray(0);
+		bound_vertex_array = 0;
+		return;
+	}
+
 	glDisableVertexAttribArray(vertex_location);
 	if (normal_location != -1) glDisableVertexAttribArray(normal_location);
 	if (uv_location != -1) glDisableVertexAttribArray(uv_location);
@@ -334,8 +720,6 @@ void Mesh::disableBuffers(Shader* shader)
 	glBindBuffer(GL_ARRAY_BUFFER, 0);    //if crashes here, COMMENT THIS LINE ****************************
 }
 
-GLuint instances_buffer_id = 0;
-
 //should be faster but in some system it is slower
 void Mesh::renderInstanced(unsigned int primitive, const Matrix44* instanced_models, int num_instances)
 {
@@ -345,28 +729,28 @@ void Mesh::renderInstanced(unsigned int primitive, const Matrix44* instanced_mod
 	Shader* shader = Shader::current;
 	assert(shader && "shader must be enabled");
 
-	if (instances_buffer_id == 0)
-		glGenBuffersARB(1, &instances_buffer_id);
-	glBindBufferARB(GL_ARRAY_BUFFER_ARB, instances_buffer_id);
-	glBufferDataARB(GL_ARRAY_BUFFER_ARB, num_instances * sizeof(Matrix44), instanced_models, GL_STREAM_DRAW_ARB);
-
 	int attribLocation = shader->getAttribLocation("u_model");
 	assert(attribLocation != -1 && "shader must have attribute mat4 u_model (not a uniform)");
 	if (attribLocation == -1)
 		return; //this shader doesnt support instanced model
 
+	//the instanced attribs go in the mesh VAO, so it must be bound first
+	enableBuffers(shader);
+
+	//streamed, it never stalls waiting for the previous frames
+	size_t offset = StreamBuffer::Get()->upload(instanced_models, num_instances * sizeof(Matrix44));
+
 	//mat4 count as 4 different attributes of vec4... (thanks opengl...)
 	for (int k = 0; k < 4; ++k)
 	{
 		glEnableVertexAttribArray(attribLocation + k);
-		int offset = sizeof(float) * 4 * k;
-		const Uint8* addr = (Uint8*)offset;
+		const Uint8* addr = (Uint8*)(offset + sizeof(float) * 4 * k);
 		glVertexAttribPointer(attribLocation + k, 4, GL_FLOAT, false, sizeof(Matrix44), addr);
 		glVertexAttribDivisor(attribLocation + k, 1); // This makes it instanced!
 	}
 
 	//regular render
-	render(primitive, -1, num_instances);
+	drawSubmeshes(primitive, -1, num_instances);
 
 	//disable instanced attribs
 	for (int k = 0; k < 4; ++k)
@@ -374,6 +758,46 @@ void Mesh::renderInstanced(unsigned int primitive, const Matrix44* instanced_mod
 		glDisableVertexAttribArray(attribLocation + k);
 		glVertexAttribDivisor(attribLocation + k, 0);
 	}
+
+	disableBuffers(shader);
+}
+
+void Mesh::renderInstanced(unsigned int primitive, const sInstanceData* instances, int num_instances, const char* model_name, const char* data_name)
+{
+	if (!num_instances)
+		return;
+
+	Shader* shader = Shader::current;
+	assert(shader && "shader must be enabled");
+
+	int model_location = shader->getAttribLocation(model_name);
+	int data_location = shader->getAttribLocation(data_name);
+	assert(model_location != -1 && data_location != -1 && "shader must have the mat4 and vec4 instanced attributes");
+	if (model_location == -1 || data_location == -1)
+		return;
+
+	enableBuffers(shader);
+
+	//both in a single upload, a second one could move the buffer
+	size_t offset = StreamBuffer::Get()->upload(instances, num_instances * sizeof(sInstanceData));
+	for (int k = 0; k < 5; ++k)
+	{
+		int location = k < 4 ? model_location + k : data_location;
+		glEnableVertexAttribArray(location);
+		glVertexAttribPointer(location, 4, GL_FLOAT, false, sizeof(sInstanceData), (void*)(offset + sizeof(Vector4) * k));
+		glVertexAttribDivisor(location, 1);
+	}
+
+	drawSubmeshes(primitive, -1, num_instances);
+
+	for (int k = 0; k < 5; ++k)
+	{
+		int location = k < 4 ? model_location + k : data_location;
+		glDisableVertexAttribArray(location);
+		glVertexAttribDivisor(location, 0);
+	}
+
+	disableBuffers(shader);
 }
 
 void Mesh::renderInstanced(unsigned int primitive, const std::vector<Vector3> positions, const char* uniform_name)
@@ -385,35 +809,36 @@ void Mesh::renderInstanced(unsigned int primitive, const std::vector<Vector3> po
 	Shader* shader = Shader::current;
 	assert(shader && "shader must be enabled");
 
-	if (instances_buffer_id == 0)
-		glGenBuffersARB(1, &instances_buffer_id);
-	glBindBufferARB(GL_ARRAY_BUFFER_ARB, instances_buffer_id);
-	glBufferDataARB(GL_ARRAY_BUFFER_ARB, num_instances * sizeof(Vector3), &positions[0], GL_STREAM_DRAW_ARB);
-
 	int attribLocation = shader->getAttribLocation(uniform_name);
 	assert(attribLocation != -1 && "shader uniform not found");
 	if (attribLocation == -1)
 		return; //this shader doesnt have instanced uniform
 
+	enableBuffers(shader);
+
+	size_t offset = StreamBuffer::Get()->upload(&positions[0], num_instances * sizeof(Vector3));
+
 	glEnableVertexAttribArray(attribLocation);
-	glVertexAttribPointer(attribLocation, 3, GL_FLOAT, false, sizeof(Vector3), 0);
+	glVertexAttribPointer(attribLocation, 3, GL_FLOAT, false, sizeof(Vector3), (void*)offset);
 	glVertexAttribDivisor(attribLocation, 1); // This makes it instanced!
 
 	//regular render
-	render(primitive, -1, num_instances);
+	drawSubmeshes(primitive, -1, num_instances);
 
 	//disable instanced attribs
 	glDisableVertexAttribArray(attribLocation);
 	glVertexAttribDivisor(attribLocation, 0);
+
+	disableBuffers(shader);
 }
 
 
 //super obsolete rendering method, do not use
 void Mesh::renderFixedPipeline(int primitive)
 {
-	assert((vertices.size() || interleaved.size()) && "No vertices in this mesh");
+	assert(getNumVertices() && "No vertices in this mesh");
 
-	int interleave_offset = interleaved.size() ? sizeof(tInterleaved) : 0;
+	int interleave_offset = interleaved.size() || interleaved_vbo_id ? sizeof(tInterleaved) : 0;
 	int offset_normal = sizeof(Vector3);
 	int offset_uv = sizeof(Vector3) + sizeof(Vector3);
 
@@ -427,7 +852,7 @@ void Mesh::renderFixedPipeline(int primitive)
 	else
 		glVertexPointer(3, GL_FLOAT, interleave_offset, interleave_offset ? &interleaved[0].vertex : &vertices[0]);
 
-	if (normals.size() || interleave_offset)
+	if (hasNormals() || interleave_offset)
 	{
 		glEnableClientState(GL_NORMAL_ARRAY);
 		if (normals_vbo_id || interleaved_vbo_id)
@@ -439,7 +864,7 @@ void Mesh::renderFixedPipeline(int primitive)
 			glNormalPointer(GL_FLOAT, interleave_offset, interleave_offset ? &interleaved[0].normal : &normals[0]);
 	}
 
-	if (uvs.size() || interleave_offset)
+	if (hasUVs() || interleave_offset)
 	{
 		glEnableClientState(GL_TEXTURE_COORD_ARRAY);
 		if (uvs_vbo_id || interleaved_vbo_id)
@@ -451,7 +876,7 @@ void Mesh::renderFixedPipeline(int primitive)
 			glTexCoordPointer(2, GL_FLOAT, interleave_offset, interleave_offset ? &interleaved[0].uv : &uvs[0]);
 	}
 
-	if (colors.size())
+	if (hasColors())
 	{
 		glEnableClientState(GL_COLOR_ARRAY);
 		if (colors_vbo_id)
@@ -463,39 +888,108 @@ void Mesh::renderFixedPipeline(int primitive)
 			glColorPointer(4, GL_FLOAT, 0, &colors[0]);
 	}
 
-	int size = (int)vertices.size();
-	if (!size)
-		size = (int)interleaved.size();
-
-	glDrawArrays(primitive, 0, (GLsizei)size);
+	glDrawArrays(primitive, 0, (GLsizei)getNumVertices());
 	glDisableClientState(GL_VERTEX_ARRAY);
-	if (normals.size())
+	if (hasNormals() || interleave_offset)
 		glDisableClientState(GL_NORMAL_ARRAY);
-	if (uvs.size())
+	if (hasUVs() || interleave_offset)
 		glDisableClientState(GL_TEXTURE_COORD_ARRAY);
-	if (colors.size())
+	if (hasColors())
 		glDisableClientState(GL_COLOR_ARRAY);
 	glBindBuffer(GL_ARRAY_BUFFER, 0); //if it crashes, comment this line
 }
 
-void Mesh::renderAnimated(unsigned int primitive, Skeleton* skeleton)
+void Mesh::renderAnimated(unsigned int primitive, Skeleton* skeleton, int lod)
 {
 	Shader* shader = Shader::current;
-	std::vector<Matrix44> bone_matrices;
-	assert(bones.size());
-	int bones_loc = shader->getUniformLocation("u_bones");
-	if (bones_loc != -1)
+	assert(hasBones());
+	bool use_block = shader->hasUniformBlock(UBLOCK_BONES);
+	int bones_loc = use_block ? -1 : shader->getUniformLocation(UNIFORM("u_bones"));
+	if (use_block || bones_loc != -1)
 	{
-		skeleton->computeFinalBoneMatrices(bone_matrices, this);
-		shader->setUniform("u_bones", bone_matrices);
+		sBonePalette& palette = getBonePalette(skeleton, use_block);
+		if (use_block)
+			glBindBufferBase(GL_UNIFORM_BUFFER, UBLOCK_BONES, palette.buffer_id);
+		else if (palette.matrices.size())
+			glUniformMatrix4fv(bones_loc, (GLsizei)palette.matrices.size(), GL_FALSE, palette.matrices[0].m);
 	}
 
-	render(primitive);
+	render(primitive, -1, 0, lod);
+}
+
+const sBoneRemap& Mesh::getBoneRemap(Skeleton* skeleton)
+{
+	const Rig* rig = skeleton->rig;
+	assert(rig && "skeleton without rig");
+	for (const sBoneRemap& remap : bone_remaps)
+		if (remap.layout == rig->layout)
+			return remap;
+
+	//names are only compared here, once per layout
+	sBoneRemap& remap = bone_remaps.emplace_back();
+	remap.layout = rig->layout;
+	remap.indices.resize(bones_info.size());
+	remap.offsets.resize(bones_info.size());
+	for (size_t i = 0; i < bones_info.size(); ++i)
+	{
+		auto it = rig->bones_by_name.find(bones_info[i].name);
+		remap.indices[i] = it != rig->bones_by_name.end() ? it->second : -1;
+		remap.offsets[i] = bind_matrix * bones_info[i].bind_pose;
+	}
+	return remap;
+}
+
+void Mesh::updateBonePalette(sBonePalette& palette, Skeleton* skeleton)
+{
+	if (palette.version && palette.version == skeleton->version)
+		return;
+	skeleton->computeFinalBoneMatrices(palette.matrices, this);
+	palette.version = skeleton->version;
+	palette.uploaded = false;
+}
+
+void Mesh::releaseBonePalette(const Skeleton* skeleton)
+{
+	auto it = bone_palettes.find(skeleton);
+	if (it == bone_palettes.end())
+		return;
+	if (it->second.buffer_id)
+		glDeleteBuffersARB(1, &it->second.buffer_id);
+	bone_palettes.erase(it);
+}
+
+sBonePalette& Mesh::getBonePalette(Skeleton* skeleton, bool upload)
+{
+	//the animators release their entries, a new skeleton at the same address starts with a fresh one
+	sBonePalette& palette = bone_palettes[skeleton];
+	updateBonePalette(palette, skeleton);
+
+	if (upload && !palette.uploaded)
+	{
+		assert(palette.matrices.size() <= SKINNING_MAX_BONES && "too many bones for the bones block");
+		if (!palette.buffer_id)
+		{
+			//always the size of the whole block
+			glGenBuffersARB(1, &palette.buffer_id);
+			glBindBufferARB(GL_UNIFORM_BUFFER, palette.buffer_id);
+			glBufferDataARB(GL_UNIFORM_BUFFER, sizeof(sBonesBlock), nullptr, GL_DYNAMIC_DRAW);
+		}
+		else
+			glBindBufferARB(GL_UNIFORM_BUFFER, palette.buffer_id);
+		if (palette.matrices.size())
+			glBufferSubDataARB(GL_UNIFORM_BUFFER, 0, palette.matrices.size() * sizeof(Matrix44), &palette.matrices[0]);
+		glBindBufferARB(GL_UNIFORM_BUFFER, 0);
+		palette.uploaded = true;
+	}
+	return palette;
 }
 
 void Mesh::uploadToVRAM()
 {
-	assert(vertices.size() || interleaved.size());
+	assert(getNumVertices());
+
+	//the buffers may change, the VAOs are rebuilt on the next render
+	releaseVertexArrays();
 
 	if (glGenBuffersARB == 0)
 	{
@@ -503,13 +997,31 @@ void Mesh::uploadToVRAM()
 		exit(0);
 	}
 
-	if (interleaved.size())
+	//the streams of a mapped .mbin go from the file to VRAM
+	size_t num_vertices = getNumVertices();
+	const tInterleaved* interleaved_data = interleaved.size() ? &interleaved[0] : mapped_streams.interleaved;
+	const Vector3* vertices_data = vertices.size() ? &vertices[0] : mapped_streams.vertices;
+	const Vector3* normals_data = normals.size() ? &normals[0] : mapped_streams.normals;
+	const Vector2* uvs_data = uvs.size() ? &uvs[0] : mapped_streams.uvs;
+	const Vector2* uvs1_data = uvs1.size() ? &uvs1[0] : mapped_streams.uvs1;
+	const Vector4* colors_data = colors.size() ? &colors[0] : mapped_streams.colors;
+	const Vector4ub* bones_data = bones.size() ? &bones[0] : mapped_streams.bones;
+	const Vector4* weights_data = weights.size() ? &weights[0] : mapped_streams.weights;
+	if (!interleaved_data && !vertices_data)
+		return; //uploaded from the .mbin already, there is nothing in RAM
+
+	if (interleaved_data)
 	{
 		// Vertex,Normal,UV
-		if (interleaved_vbo_id == 0)
-			glGenBuffersARB(1, &interleaved_vbo_id);
-		glBindBufferARB(GL_ARRAY_BUFFER_ARB, interleaved_vbo_id);
-		glBufferDataARB(GL_ARRAY_BUFFER_ARB, interleaved.size() * sizeof(tInterleaved), &interleaved[0], GL_STATIC_DRAW_ARB);
+		if (quantize_meshes)
+			uploadQuantized(interleaved_data, num_vertices);
+		else
+		{
+			if (interleaved_vbo_id == 0)
+				glGenBuffersARB(1, &interleaved_vbo_id);
+			glBindBufferARB(GL_ARRAY_BUFFER_ARB, interleaved_vbo_id);
+			glBufferDataARB(GL_ARRAY_BUFFER_ARB, num_vertices * sizeof(tInterleaved), interleaved_data, GL_STATIC_DRAW_ARB);
+		}
 	}
 	else
 	{
@@ -517,69 +1029,118 @@ void Mesh::uploadToVRAM()
 		if (vertices_vbo_id == 0)
 			glGenBuffersARB(1, &vertices_vbo_id);
 		glBindBufferARB(GL_ARRAY_BUFFER_ARB, vertices_vbo_id);
-		glBufferDataARB(GL_ARRAY_BUFFER_ARB, vertices.size() * sizeof(Vector3), &vertices[0], GL_STATIC_DRAW_ARB);
+		glBufferDataARB(GL_ARRAY_BUFFER_ARB, num_vertices * sizeof(Vector3), vertices_data, GL_STATIC_DRAW_ARB);
 
 		// UVs
-		if (uvs.size())
+		if (uvs_data)
 		{
 			if (uvs_vbo_id == 0)
 				glGenBuffersARB(1, &uvs_vbo_id);
 			glBindBufferARB(GL_ARRAY_BUFFER_ARB, uvs_vbo_id);
-			glBufferDataARB(GL_ARRAY_BUFFER_ARB, uvs.size() * sizeof(Vector2), &uvs[0], GL_STATIC_DRAW_ARB);
+			glBufferDataARB(GL_ARRAY_BUFFER_ARB, num_vertices * sizeof(Vector2), uvs_data, GL_STATIC_DRAW_ARB);
 		}
 
 		// Normals
-		if (normals.size())
+		if (normals_data)
 		{
 			if (normals_vbo_id == 0)
 				glGenBuffersARB(1, &normals_vbo_id);
 			glBindBufferARB(GL_ARRAY_BUFFER_ARB, normals_vbo_id);
-			glBufferDataARB(GL_ARRAY_BUFFER_ARB, normals.size() * sizeof(Vector3), &normals[0], GL_STATIC_DRAW_ARB);
+			glBufferDataARB(GL_ARRAY_BUFFER_ARB, num_vertices * sizeof(Vector3), normals_data, GL_STATIC_DRAW_ARB);
 		}
 	}
 
 	// UVs
-	if (uvs1.size())
+	if (uvs1_data)
 	{
 		if (uvs1_vbo_id == 0)
 			glGenBuffersARB(1, &uvs1_vbo_id);
 		glBindBufferARB(GL_ARRAY_BUFFER_ARB, uvs1_vbo_id);
-		glBufferDataARB(GL_ARRAY_BUFFER_ARB, uvs1.size() * sizeof(Vector2), &uvs1[0], GL_STATIC_DRAW_ARB);
+		glBufferDataARB(GL_ARRAY_BUFFER_ARB, num_vertices * sizeof(Vector2), uvs1_data, GL_STATIC_DRAW_ARB);
 	}
 
 	// Colors
-	if (colors.size())
+	if (colors_data)
 	{
 		if (colors_vbo_id == 0)
 			glGenBuffersARB(1, &colors_vbo_id);
 		glBindBufferARB(GL_ARRAY_BUFFER_ARB, colors_vbo_id);
-		glBufferDataARB(GL_ARRAY_BUFFER_ARB, colors.size() * sizeof(Vector4), &colors[0], GL_STATIC_DRAW_ARB);
+		glBufferDataARB(GL_ARRAY_BUFFER_ARB, num_vertices * sizeof(Vector4), colors_data, GL_STATIC_DRAW_ARB);
 	}
 
-	if (bones.size())
+	if (bones_data)
 	{
 		if (bones_vbo_id == 0)
 			glGenBuffersARB(1, &bones_vbo_id);
 		glBindBufferARB(GL_ARRAY_BUFFER_ARB, bones_vbo_id);
-		glBufferDataARB(GL_ARRAY_BUFFER_ARB, bones.size() * sizeof(Vector4ub), &bones[0], GL_STATIC_DRAW_ARB);
+		glBufferDataARB(GL_ARRAY_BUFFER_ARB, num_vertices * sizeof(Vector4ub), bones_data, GL_STATIC_DRAW_ARB);
 	}
-	if (weights.size())
+	if (weights_data)
 	{
 		if (weights_vbo_id == 0)
 			glGenBuffersARB(1, &weights_vbo_id);
 		glBindBufferARB(GL_ARRAY_BUFFER_ARB, weights_vbo_id);
-		glBufferDataARB(GL_ARRAY_BUFFER_ARB, weights.size() * sizeof(Vector4), &weights[0], GL_STATIC_DRAW_ARB);
+		quantized_weights = quantize_meshes;
+		if (quantized_weights)
+		{
+			//unorm8, rounded so they still add up to one
+			std::vector<Vector4ub> weights8(num_vertices);
+			for (size_t i = 0; i < num_vertices; ++i)
+			{
+				int sum = 0, biggest = 0;
+				for (int k = 0; k < 4; ++k)
+				{
+					int w = (int)(clamp(weights_data[i].v[k], 0.0f, 1.0f) * 255.0f + 0.5f);
+					weights8[i].v[k] = (uint8)w;
+					sum += w;
+					if (w > weights8[i].v[biggest])
+						biggest = k;
+				}
+				if (sum)
+					weights8[i].v[biggest] = (uint8)clamp(weights8[i].v[biggest] + 255 - sum, 0, 255);
+			}
+			glBufferDataARB(GL_ARRAY_BUFFER_ARB, weights8.size() * sizeof(Vector4ub), &weights8[0], GL_STATIC_DRAW_ARB);
+		}
+		else
+			glBufferDataARB(GL_ARRAY_BUFFER_ARB, num_vertices * sizeof(Vector4), weights_data, GL_STATIC_DRAW_ARB);
 	}
 
 	glBindBufferARB(GL_ARRAY_BUFFER_ARB, 0);
 
-	// Indices
-	if (indices.size())
+	// Indices, followed by the ones of the LODs
+	size_t num_triangles = getNumIndices();
+	size_t num_lod_triangles = lod_indices.size() ? lod_indices.size() : mapped_streams.num_lod_indices;
+	const Vector3u* indices_data = indices.size() ? &indices[0] : mapped_streams.indices;
+	const Vector3u* lod_indices_data = lod_indices.size() ? &lod_indices[0] : mapped_streams.lod_indices;
+	if (num_triangles || num_lod_triangles)
 	{
 		if (indices_vbo_id == 0)
 			glGenBuffersARB(1, &indices_vbo_id);
 		glBindBufferARB(GL_ELEMENT_ARRAY_BUFFER, indices_vbo_id);
-		glBufferDataARB(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(Vector3u), &indices[0], GL_STATIC_DRAW_ARB);
+
+		//16 bits when all the vertices can be addressed, halves the index fetch
+		size_t num_indices = (num_triangles + num_lod_triangles) * 3;
+		if (num_vertices <= 0xFFFF)
+		{
+			index_size = sizeof(unsigned short);
+			std::vector<unsigned short> indices16(num_indices);
+			const unsigned int* src = num_triangles ? &indices_data[0].x : NULL;
+			for (size_t i = 0; i < num_triangles * 3; ++i)
+				indices16[i] = (unsigned short)src[i];
+			src = num_lod_triangles ? &lod_indices_data[0].x : NULL;
+			for (size_t i = 0; i < num_lod_triangles * 3; ++i)
+				indices16[num_triangles * 3 + i] = (unsigned short)src[i];
+			glBufferDataARB(GL_ELEMENT_ARRAY_BUFFER, num_indices * index_size, &indices16[0], GL_STATIC_DRAW_ARB);
+		}
+		else
+		{
+			index_size = sizeof(unsigned int);
+			glBufferDataARB(GL_ELEMENT_ARRAY_BUFFER, num_indices * index_size, NULL, GL_STATIC_DRAW_ARB);
+			if (num_triangles)
+				glBufferSubDataARB(GL_ELEMENT_ARRAY_BUFFER, 0, num_triangles * sizeof(Vector3u), indices_data);
+			if (num_lod_triangles)
+				glBufferSubDataARB(GL_ELEMENT_ARRAY_BUFFER, num_triangles * sizeof(Vector3u), num_lod_triangles * sizeof(Vector3u), lod_indices_data);
+		}
 	}
 	glBindBufferARB(GL_ELEMENT_ARRAY_BUFFER, 0);
 
@@ -588,63 +1149,139 @@ void Mesh::uploadToVRAM()
 	checkGLErrors();
 
 	//clear buffers to save memory
+	releaseMappedFile();
 }
 
-bool Mesh::createCollisionModel(bool is_static)
+void Mesh::releaseMappedFile()
 {
-	if (collision_model)
-		return true;
+	if (!mapped_file)
+		return;
 
-	CollisionModel3D* collision_model = newCollisionModel3D(is_static);
+	//not uploaded, they are needed in RAM to render
+	size_t size = mapped_streams.size;
+	if (mapped_streams.interleaved && !interleaved_vbo_id && !quantized_vbo_id)
+		interleaved.assign(mapped_streams.interleaved, mapped_streams.interleaved + size);
+	if (mapped_streams.vertices && !vertices_vbo_id)
+		vertices.assign(mapped_streams.vertices, mapped_streams.vertices + size);
+	if (mapped_streams.normals && !normals_vbo_id)
+		normals.assign(mapped_streams.normals, mapped_streams.normals + size);
+	if (mapped_streams.uvs && !uvs_vbo_id)
+		uvs.assign(mapped_streams.uvs, mapped_streams.uvs + size);
+	if (mapped_streams.indices && !indices_vbo_id)
+		indices.assign(mapped_streams.indices, mapped_streams.indices + mapped_streams.num_indices);
+	if (mapped_streams.lod_indices && !indices_vbo_id)
+		lod_indices.assign(mapped_streams.lod_indices, mapped_streams.lod_indices + mapped_streams.num_lod_indices);
+	if (mapped_streams.uvs1 && !uvs1_vbo_id)
+		uvs1.assign(mapped_streams.uvs1, mapped_streams.uvs1 + size);
+	if (mapped_streams.colors && !colors_vbo_id)
+		colors.assign(mapped_streams.colors, mapped_streams.colors + size);
+	if (mapped_streams.bones && !bones_vbo_id)
+		bones.assign(mapped_streams.bones, mapped_streams.bones + size);
+	if (mapped_streams.weights && !weights_vbo_id)
+		weights.assign(mapped_streams.weights, mapped_streams.weights + size);
+
+	delete mapped_file;
+	mapped_file = NULL;
+	mapped_streams = sMappedStreams();
+}
 
-	if (indices.size()) //indexed
-	{
-		collision_model->setTriangleNumber((int)indices.size());
+static unsigned short floatToHalf(float value)
+{
+	uint32_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+	uint32_t sign = (bits >> 16) & 0x8000;
+	int exponent = (int)((bits >> 23) & 0xFF) - 127 + 15;
+	uint32_t mantissa = bits & 0x7FFFFF;
+	if (exponent <= 0)
+		return (unsigned short)sign; //too small, flushed to zero
+	if (exponent >= 31)
+		return (unsigned short)(sign | 0x7C00); //too big or nan, infinity
+	uint32_t half = sign | (exponent << 10) | (mantissa >> 13);
+	if (mantissa & 0x1000)
+		half++; //round to nearest, carries into the exponent if needed
+	return (unsigned short)half;
+}
 
-		if (interleaved.size())
-			for (unsigned int i = 0; i < indices.size(); ++i)
-			{
-				auto v1 = interleaved[indices[i].x];
-				auto v2 = interleaved[indices[i].y];
-				auto v3 = interleaved[indices[i].z];
-				collision_model->addTriangle(v1.vertex.v, v2.vertex.v, v3.vertex.v);
-			}
-		else
-			for (unsigned int i = 0; i < indices.size(); ++i)
-			{
-				auto v1 = vertices[indices[i].x];
-				auto v2 = vertices[indices[i].y];
-				auto v3 = vertices[indices[i].z];
-				collision_model->addTriangle(v1.v, v2.v, v3.v);
-			}
-	}
-	else if (interleaved.size()) //is interleaved
-	{
-		collision_model->setTriangleNumber(interleaved.size() / 3);
-		for (unsigned int i = 0; i < interleaved.size(); i += 3)
-		{
-			auto v1 = interleaved[i];
-			auto v2 = interleaved[i + 1];
-			auto v3 = interleaved[i + 2];
-			collision_model->addTriangle(v1.vertex.v, v2.vertex.v, v3.vertex.v);
-		}
-	}
-	else if (vertices.size()) //non interleaved
-	{
-		collision_model->setTriangleNumber((int)vertices.size() / 3);
-		for (unsigned int i = 0; i < (int)vertices.size(); i += 3)
+static short floatToSnorm16(float value)
+{
+	return (short)(clamp(value, -1.0f, 1.0f) * 32767.0f + (value >= 0.0f ? 0.5f : -0.5f));
+}
+
+void Mesh::uploadQuantized(const tInterleaved* source, size_t count)
+{
+	//bounds of the positions, the smallest axis cannot be zero
+	Vector3 min_pos = source[0].vertex;
+	Vector3 max_pos = min_pos;
+	for (size_t i = 1; i < count; ++i)
+	{
+		min_pos.setMin(source[i].vertex);
+		max_pos.setMax(source[i].vertex);
+	}
+	Vector3 halfsize = (max_pos - min_pos) * 0.5f;
+	halfsize.set(std::max(halfsize.x, 1e-6f), std::max(halfsize.y, 1e-6f), std::max(halfsize.z, 1e-6f));
+	quantization_offset = (max_pos + min_pos) * 0.5f;
+	quantization_scale.set(halfsize.x, halfsize.y, halfsize.z, 1.0f);
+
+	std::vector<tQuantized> data(count);
+	for (size_t i = 0; i < count; ++i)
+	{
+		const tInterleaved& v = source[i];
+		tQuantized& q = data[i];
+		Vector3 p = v.vertex - quantization_offset;
+		q.vertex[0] = floatToSnorm16(p.x / halfsize.x);
+		q.vertex[1] = floatToSnorm16(p.y / halfsize.y);
+		q.vertex[2] = floatToSnorm16(p.z / halfsize.z);
+		q.vertex[3] = 32767;
+
+		//octahedral: project on the octahedron and fold the lower half
+		Vector3 n = v.normal;
+		float l1 = fabsf(n.x) + fabsf(n.y) + fabsf(n.z);
+		float ox = l1 > 0.0f ? n.x / l1 : 0.0f;
+		float oy = l1 > 0.0f ? n.y / l1 : 0.0f;
+		if (n.z < 0.0f)
 		{
-			auto v1 = vertices[i];
-			auto v2 = vertices[i + 1];
-			auto v3 = vertices[i + 2];
-			collision_model->addTriangle(v1.v, v2.v, v3.v);
+			float fx = (1.0f - fabsf(oy)) * (ox >= 0.0f ? 1.0f : -1.0f);
+			float fy = (1.0f - fabsf(ox)) * (oy >= 0.0f ? 1.0f : -1.0f);
+			ox = fx;
+			oy = fy;
 		}
+		q.normal[0] = floatToSnorm16(ox);
+		q.normal[1] = floatToSnorm16(oy);
+
+		q.uv[0] = floatToHalf(v.uv.x);
+		q.uv[1] = floatToHalf(v.uv.y);
 	}
-	else
+
+	if (quantized_vbo_id == 0)
+		glGenBuffersARB(1, &quantized_vbo_id);
+	glBindBufferARB(GL_ARRAY_BUFFER_ARB, quantized_vbo_id);
+	glBufferDataARB(GL_ARRAY_BUFFER_ARB, data.size() * sizeof(tQuantized), &data[0], GL_STATIC_DRAW_ARB);
+}
+
+bool Mesh::createCollisionModel(bool is_static)
+{
+	if (collision_model)
+		return true;
+
+	//coldet keeps its own copy of the triangles, the .mbin ones are read from the mapping
+	sGeometry geometry;
+	if (!getGeometry(geometry))
 	{
 		assert(0 && "mesh without vertices, cannot create collision model");
 		return false;
 	}
+
+	CollisionModel3D* collision_model = newCollisionModel3D(is_static);
+	size_t num_triangles = geometry.indices ? geometry.num_indices : geometry.num_vertices / 3;
+	collision_model->setTriangleNumber((int)num_triangles);
+	for (size_t i = 0; i < num_triangles; ++i)
+	{
+		Vector3u t = geometry.indices ? geometry.indices[i] : Vector3u((unsigned int)(i * 3), (unsigned int)(i * 3 + 1), (unsigned int)(i * 3 + 2));
+		Vector3 v1 = geometry.getPosition(t.x);
+		Vector3 v2 = geometry.getPosition(t.y);
+		Vector3 v3 = geometry.getPosition(t.z);
+		collision_model->addTriangle(v1.v, v2.v, v3.v);
+	}
 	collision_model->finalize();
 	this->collision_model = collision_model;
 	return true;
@@ -745,39 +1382,66 @@ struct sMeshInfo
 	float radius = 0.0;
 	size_t num_bones = 0;
 	size_t num_submeshes = 0;
+	size_t num_lods = 0;
+	size_t num_lod_ranges = 0;
+	size_t num_lod_indices = 0;
+	size_t num_clusters = 0;
 	Matrix44 bind_matrix;
 	char streams[8]; //Vertex/Interlaved|Normal|Uvs|Color|Indices|Bones|Weights|Extra|Uvs1
 	char extra[32]; //unused
 };
 
-bool Mesh::readBin(const char* filename)
+//bounds checked reads from a mapped .mbin
+struct sBinReader
 {
-	FILE* f;
-	assert(filename);
+	const uint8* pos;
+	const uint8* end;
+	bool valid = true;
 
-	struct stat stbuffer;
+	const void* take(size_t bytes)
+	{
+		if (!valid || (size_t)(end - pos) < bytes)
+		{
+			valid = false;
+			return NULL;
+		}
+		const void* data = pos;
+		pos += bytes;
+		return data;
+	}
+};
 
-	stat(filename, &stbuffer);
-	f = fopen(filename, "rb");
-	if (f == NULL)
-		return false;
+//where everything is in a mapped .mbin, nothing is copied
+//the tables may be only 4 byte aligned (they hold size_t), so they are raw bytes until copied with memcpy
+struct sBinLayout
+{
+	sMeshInfo info;
+	Mesh::sMappedStreams streams;
+	const void* bones_info = NULL;
+	const void* submeshes = NULL;
+	const void* lods = NULL;
+	const void* lod_ranges = NULL;
+	const void* clusters = NULL;
+};
 
-	unsigned int size = (unsigned int)stbuffer.st_size;
-	char* data = new char[size];
-	fread(data, size, 1, f);
-	fclose(f);
+template<typename T> static void copyTable(std::vector<T>& table, const void* data, size_t count)
+{
+	table.resize(data ? count : 0);
+	if (table.size())
+		memcpy((void*)&table[0], data, sizeof(T) * table.size());
+}
 
+static bool parseBin(const MappedFile& file, const char* filename, sBinLayout& layout)
+{
 	//watermark
-	if (memcmp(data, "MBIN", 4) != 0)
+	if (file.size < 4 + sizeof(sMeshInfo) || memcmp(file.data, "MBIN", 4) != 0)
 	{
 		std::cout << "[ERROR] loading BIN: invalid content: " << filename << std::endl;
 		return false;
 	}
 
-	char* pos = data + 4;
-	sMeshInfo info;
-	memcpy(&info, pos, sizeof(sMeshInfo));
-	pos += sizeof(sMeshInfo);
+	sMeshInfo& info = layout.info;
+	memcpy(&info, file.data + 4, sizeof(sMeshInfo));
 
 	if (info.version != MESH_BIN_VERSION || info.header_bytes != sizeof(sMeshInfo))
 	{
@@ -785,74 +1449,85 @@ bool Mesh::readBin(const char* filename)
 		return false;
 	}
 
+	sBinReader reader;
+	reader.pos = file.data + 4 + sizeof(sMeshInfo);
+	reader.end = file.data + file.size;
+
+	Mesh::sMappedStreams& streams = layout.streams;
+	streams.size = info.size;
 	if (info.streams[0] == 'I')
-	{
-		interleaved.resize(info.size);
-		memcpy((void*)&interleaved[0], pos, sizeof(tInterleaved) * info.size);
-		pos += sizeof(tInterleaved) * info.size;
-	}
+		streams.interleaved = (const Mesh::tInterleaved*)reader.take(sizeof(Mesh::tInterleaved) * info.size);
 	else if (info.streams[0] == 'V')
-	{
-		vertices.resize(info.size);
-		memcpy((void*)&vertices[0], pos, sizeof(Vector3) * info.size);
-		pos += sizeof(Vector3) * info.size;
-	}
-
+		streams.vertices = (const Vector3*)reader.take(sizeof(Vector3) * info.size);
 	if (info.streams[1] == 'N')
-	{
-		normals.resize(info.size);
-		memcpy((void*)&normals[0], pos, sizeof(Vector3) * info.size);
-		pos += sizeof(Vector3) * info.size;
-	}
-
+		streams.normals = (const Vector3*)reader.take(sizeof(Vector3) * info.size);
 	if (info.streams[2] == 'U')
-	{
-		uvs.resize(info.size);
-		memcpy((void*)&uvs[0], pos, sizeof(Vector2) * info.size);
-		pos += sizeof(Vector2) * info.size;
-	}
-
+		streams.uvs = (const Vector2*)reader.take(sizeof(Vector2) * info.size);
 	if (info.streams[3] == 'C')
-	{
-		colors.resize(info.size);
-		memcpy((void*)&colors[0], pos, sizeof(Vector4) * info.size);
-		pos += sizeof(Vector4) * info.size;
-	}
-
+		streams.colors = (const Vector4*)reader.take(sizeof(Vector4) * info.size);
 	if (info.streams[4] == 'I')
 	{
-		indices.resize(info.num_indices);
-		memcpy((void*)&indices[0], pos, sizeof(Vector3u) * info.num_indices);
-		pos += sizeof(Vector3u) * info.num_indices;
+		streams.indices = (const Vector3u*)reader.take(sizeof(Vector3u) * info.num_indices);
+		streams.num_indices = info.num_indices;
 	}
-
 	if (info.streams[5] == 'B')
+		streams.bones = (const Vector4ub*)reader.take(sizeof(Vector4ub) * info.size);
+	if (info.streams[6] == 'W')
+		streams.weights = (const Vector4*)reader.take(sizeof(Vector4) * info.size);
+	if (info.streams[7] == 'u')
+		streams.uvs1 = (const Vector2*)reader.take(sizeof(Vector2) * info.size);
+
+	layout.bones_info = reader.take(sizeof(BoneInfo) * info.num_bones);
+	layout.submeshes = reader.take(sizeof(sSubmeshInfo) * info.num_submeshes);
+	if (info.num_lods)
 	{
-		bones.resize(info.size);
-		memcpy((void*)&bones[0], pos, sizeof(Vector4ub) * info.size);
-		pos += sizeof(Vector4ub) * info.size;
+		layout.lods = reader.take(sizeof(sMeshLOD) * info.num_lods);
+		layout.lod_ranges = reader.take(sizeof(sLODRange) * info.num_lod_ranges);
+		streams.lod_indices = (const Vector3u*)reader.take(sizeof(Vector3u) * info.num_lod_indices);
+		streams.num_lod_indices = info.num_lod_indices;
 	}
+	layout.clusters = reader.take(sizeof(sMeshCluster) * info.num_clusters);
 
-	if (info.streams[6] == 'W')
+	if (!reader.valid || (!streams.interleaved && !streams.vertices))
 	{
-		weights.resize(info.size);
-		memcpy((void*)&weights[0], pos, sizeof(Vector4) * info.size);
-		pos += sizeof(Vector4) * info.size;
+		std::cout << "[ERROR] loading BIN: truncated: " << filename << std::endl;
+		return false;
 	}
+	return true;
+}
 
-	if (info.streams[7] == 'u')
+bool Mesh::readBin(const char* filename)
+{
+	assert(filename);
+
+	//the file is used in place, the OS loads the pages when touched and there is no intermediate copy
+	MappedFile* file = new MappedFile();
+	if (!file->open(filename))
 	{
-		uvs1.resize(info.size);
-		memcpy((void*)&uvs1[0], pos, sizeof(Vector2) * info.size);
-		pos += sizeof(Vector2) * info.size;
+		delete file;
+		return false;
 	}
 
-	if (info.num_bones)
+	//the mesh is not touched until the whole file is known to be valid, the ascii version is loaded otherwise
+	sBinLayout layout;
+	if (!parseBin(*file, filename, layout))
 	{
-		bones_info.resize(info.num_bones);
-		memcpy((void*)&bones_info[0], pos, sizeof(BoneInfo) * info.num_bones);
-		pos += sizeof(BoneInfo) * info.num_bones;
+		delete file;
+		return false;
 	}
+	const sMeshInfo& info = layout.info;
+
+	//only the small tables are copied, the streams go from the mapping to VRAM (or to RAM in releaseMappedFile)
+	copyTable(bones_info, layout.bones_info, info.num_bones);
+	copyTable(submeshes, layout.submeshes, info.num_submeshes);
+	copyTable(lods, layout.lods, info.num_lods);
+	copyTable(lod_ranges, layout.lod_ranges, info.num_lod_ranges);
+	copyTable(clusters, layout.clusters, info.num_clusters);
+	mapped_streams = layout.streams;
+	mapped_file = file; //until uploadToVRAM or releaseMappedFile
+	bin_filename = filename;
+	num_bin_vertices = (unsigned int)info.size;
+	num_bin_indices = (unsigned int)mapped_streams.num_indices;
 
 	aabb_max = info.aabb_max;
 	aabb_min = info.aabb_min;
@@ -861,13 +1536,6 @@ bool Mesh::readBin(const char* filename)
 	radius = info.radius;
 	bind_matrix = info.bind_matrix;
 
-	submeshes.resize(info.num_submeshes);
-	if (info.num_submeshes)
-	{
-		memcpy(&submeshes[0], pos, sizeof(sSubmeshInfo) * info.num_submeshes);
-		pos += sizeof(sSubmeshInfo) * info.num_submeshes;
-	}
-
 	// if the mtl is not specified in the obj but it's needed
 	if (!materials.size()) {
 		std::string mesh_name = filename;
@@ -885,9 +1553,50 @@ bool Mesh::readBin(const char* filename)
 	return true;
 }
 
+Mesh::sGeometry::~sGeometry()
+{
+	delete file;
+}
+
+bool Mesh::getGeometry(sGeometry& geometry) const
+{
+	//in RAM: the ascii meshes, or the .mbin ones not uploaded to VRAM
+	if (interleaved.size() || vertices.size())
+	{
+		geometry.interleaved = interleaved.size() ? &interleaved[0] : NULL;
+		geometry.vertices = interleaved.size() ? NULL : &vertices[0];
+		geometry.num_vertices = getNumVertices();
+		geometry.indices = indices.size() ? &indices[0] : NULL;
+		geometry.num_indices = indices.size();
+		geometry.lod_indices = lod_indices.size() ? &lod_indices[0] : NULL;
+		return true;
+	}
+
+	//still mapped while loading, or mapped again once they are only in VRAM
+	const sMappedStreams* streams = &mapped_streams;
+	sBinLayout layout;
+	if (!mapped_file)
+	{
+		if (bin_filename.empty())
+			return false;
+		geometry.file = new MappedFile();
+		if (!geometry.file->open(bin_filename.c_str()) || !parseBin(*geometry.file, bin_filename.c_str(), layout) || layout.streams.size != num_bin_vertices)
+			return false;
+		streams = &layout.streams;
+	}
+	geometry.interleaved = streams->interleaved;
+	geometry.vertices = streams->vertices;
+	geometry.num_vertices = streams->size;
+	geometry.indices = streams->num_indices ? streams->indices : NULL;
+	geometry.num_indices = streams->num_indices;
+	geometry.lod_indices = streams->num_lod_indices ? streams->lod_indices : NULL;
+	return geometry.interleaved || geometry.vertices;
+}
+
 bool Mesh::writeBin(const char* filename)
 {
 	assert(vertices.size() || interleaved.size());
+	assert(!mapped_file && !(uvs1.empty() && uvs1_vbo_id) && !(colors.empty() && colors_vbo_id) && !(bones.empty() && bones_vbo_id) && "streams only in VRAM cannot be written");
 	std::string s_filename = filename;
 	s_filename += ".mbin";
 
@@ -915,6 +1624,10 @@ bool Mesh::writeBin(const char* filename)
 	info.num_bones = bones_info.size();
 	info.bind_matrix = bind_matrix;
 	info.num_submeshes = submeshes.size();
+	info.num_lods = lods.size();
+	info.num_lod_ranges = lod_ranges.size();
+	info.num_lod_indices = lod_indices.size();
+	info.num_clusters = clusters.size();
 
 	info.streams[0] = interleaved.size() ? 'I' : 'V';
 	info.streams[1] = normals.size() ? 'N' : ' ';
@@ -950,14 +1663,24 @@ bool Mesh::writeBin(const char* filename)
 		fwrite((void*)&bones[0], bones.size() * sizeof(Vector4ub), 1, f);
 	if (weights.size())
 		fwrite((void*)&weights[0], weights.size() * sizeof(Vector4), 1, f);
-	if (bones_info.size())
-		fwrite((void*)&bones_info[0], bones_info.size() * sizeof(BoneInfo), 1, f);
 	if (uvs1.size())
 		fwrite((void*)&uvs1[0], uvs1.size() * sizeof(Vector2), 1, f);
+	if (bones_info.size())
+		fwrite((void*)&bones_info[0], bones_info.size() * sizeof(BoneInfo), 1, f);
 
 	if (submeshes.size())
 		fwrite((void*)&submeshes[0], submeshes.size() * sizeof(sSubmeshInfo), 1, f);
 
+	if (lods.size())
+	{
+		fwrite((void*)&lods[0], lods.size() * sizeof(sMeshLOD), 1, f);
+		fwrite((void*)&lod_ranges[0], lod_ranges.size() * sizeof(sLODRange), 1, f);
+		fwrite((void*)&lod_indices[0], lod_indices.size() * sizeof(Vector3u), 1, f);
+	}
+
+	if (clusters.size())
+		fwrite((void*)&clusters[0], clusters.size() * sizeof(sMeshCluster), 1, f);
+
 	fclose(f);
 	return true;
 }
@@ -1153,19 +1876,21 @@ bool Mesh::parseMTL(const char* filename)
 		else if (tokens[0] == "map_Kd")
 		{
 			std::filesystem::path mesh_path = std::filesystem::path(filename);
-			info.Kd_texture = Texture::Get((mesh_path.parent_path().string() + "/" + tokens[1]).c_str());
+			info.Kd_texture_name = mesh_path.parent_path().string() + "/" + tokens[1]; //resolved in the main thread
 		}
 		else if (tokens[0] == "newmtl") //material file
 		{
 			if (parsingMaterial) {
-				materials[material_name] = info;
+				info.name = material_name;
+				materials.push_back(info);
 			}
 			parsingMaterial = true;
 			material_name = tokens[1];
 		}
 	}
 
-	materials[material_name] = info;
+	info.name = material_name;
+	materials.push_back(info);
 
 	std::cout << "[MTL] ";
 
@@ -1368,6 +2093,7 @@ bool Mesh::loadOBJ(const char* filename)
 	submesh_info.draw_calls[submesh_draw_calls] = submesh_dc_info;
 	submesh_info.num_draw_calls = submesh_draw_calls + 1;
 	submeshes.push_back(submesh_info);
+
 	return true;
 }
 
@@ -1640,6 +2366,225 @@ void Mesh::createGrid(float dist)
 	}
 }
 
+unsigned int Mesh::getNumDrawCalls() const
+{
+	unsigned int num = 0;
+	for (const sSubmeshInfo& submesh : submeshes)
+		num += submesh.num_draw_calls;
+	return num ? num : 1;
+}
+
+bool Mesh::optimizeIndices()
+{
+	size_t num_corners = vertices.size();
+	if (indices.size() || interleaved.size() || num_corners < 3 || num_corners % 3)
+		return false;
+
+	//every stream must have a value per corner to be welded
+	bool uniform = (normals.empty() || normals.size() == num_corners) && (uvs.empty() || uvs.size() == num_corners) &&
+		(uvs1.empty() || uvs1.size() == num_corners) && (colors.empty() || colors.size() == num_corners) &&
+		(bones.empty() || bones.size() == num_corners) && (weights.empty() || weights.size() == num_corners);
+	if (!uniform)
+		return false;
+
+	//corners with exactly the same attributes become the same vertex
+	std::vector<unsigned int> unique_corners; //first corner of every vertex
+	std::vector<unsigned int> corner_vertex(num_corners);
+	std::unordered_map<std::string, unsigned int> welded;
+	welded.reserve(num_corners);
+	std::string key;
+	auto appendKey = [&](const auto& stream, size_t i) {
+		if (stream.size())
+			key.append((const char*)&stream[i], sizeof(stream[i]));
+	};
+	for (size_t i = 0; i < num_corners; ++i)
+	{
+		key.clear();
+		appendKey(vertices, i);
+		appendKey(normals, i);
+		appendKey(uvs, i);
+		appendKey(uvs1, i);
+		appendKey(colors, i);
+		appendKey(bones, i);
+		appendKey(weights, i);
+		auto it = welded.emplace(key, (unsigned int)unique_corners.size());
+		if (it.second)
+			unique_corners.push_back((unsigned int)i);
+		corner_vertex[i] = it.first->second;
+	}
+
+	size_t num_vertices = unique_corners.size();
+	indices.resize(num_corners / 3);
+	for (size_t i = 0; i < indices.size(); ++i)
+		indices[i].set(corner_vertex[i * 3], corner_vertex[i * 3 + 1], corner_vertex[i * 3 + 2]);
+
+	//draw calls go from vertices to triangles, each one is ordered on its own
+	if (submeshes.empty())
+		optimizeVertexCache(indices, 0, indices.size(), num_vertices);
+	for (sSubmeshInfo& submesh : submeshes)
+		for (unsigned int j = 0; j < submesh.num_draw_calls; ++j)
+		{
+			sSubmeshDrawCallInfo& dc = submesh.draw_calls[j];
+			dc.start /= 3;
+			dc.length /= 3;
+			optimizeVertexCache(indices, dc.start, dc.length, num_vertices);
+		}
+
+	//vertices in the order they are used
+	std::vector<int> remap;
+	optimizeVertexFetch(indices, num_vertices, remap);
+	std::vector<unsigned int> source_corners(num_vertices);
+	for (size_t i = 0; i < num_vertices; ++i)
+		source_corners[remap[i]] = unique_corners[i];
+
+	auto compact = [&](auto& stream) {
+		if (stream.empty())
+			return;
+		std::remove_reference_t<decltype(stream)> result(num_vertices);
+		for (size_t i = 0; i < num_vertices; ++i)
+			result[i] = stream[source_corners[i]];
+		stream.swap(result);
+	};
+	compact(vertices);
+	compact(normals);
+	compact(uvs);
+	compact(uvs1);
+	compact(colors);
+	compact(bones);
+	compact(weights);
+	return true;
+}
+
+bool Mesh::generateClusters()
+{
+	clusters.clear();
+	if (indices.size() < MESH_CLUSTER_MIN_TRIANGLES)
+		return false;
+
+	size_t num_vertices = getNumVertices();
+	std::vector<Vector3> positions(num_vertices);
+	for (size_t i = 0; i < num_vertices; ++i)
+		positions[i] = interleaved.size() ? interleaved[i].vertex : vertices[i];
+
+	//the same for all the draw calls and levels
+	sWeldMap weld;
+	weldPositions(&positions[0], num_vertices, weld);
+
+	//clusters never cross a draw call, they can have different materials
+	if (submeshes.empty())
+		buildClusters(positions, indices, 0, indices.size(), clusters);
+	for (const sSubmeshInfo& submesh : submeshes)
+		for (unsigned int j = 0; j < submesh.num_draw_calls; ++j)
+		{
+			const sSubmeshDrawCallInfo& dc = submesh.draw_calls[j];
+			if (dc.length >= MESH_CLUSTER_MIN_TRIANGLES)
+				buildClusters(positions, indices, dc.start, dc.length, clusters);
+		}
+
+	std::sort(clusters.begin(), clusters.end(), [](const sMeshCluster& a, const sMeshCluster& b) { return a.start < b.start; });
+	return clusters.size() > 0;
+}
+
+bool Mesh::generateLODs()
+{
+	lods.clear();
+	lod_ranges.clear();
+	lod_indices.clear();
+
+	size_t num_vertices = getNumVertices();
+	size_t num_triangles = indices.size() ? indices.size() : num_vertices / 3;
+	if (num_triangles < MESH_LOD_MIN_TRIANGLES)
+		return false;
+
+	//positions in a single array, whatever the layout
+	std::vector<Vector3> positions(num_vertices);
+	for (size_t i = 0; i < num_vertices; ++i)
+		positions[i] = interleaved.size() ? interleaved[i].vertex : vertices[i];
+
+	//the same for all the draw calls and levels
+	sWeldMap weld;
+	weldPositions(&positions[0], num_vertices, weld);
+
+	//triangles of every draw call, each one is simplified on its own to keep the material boundaries
+	std::vector< std::vector<Vector3u> > draw_call_triangles;
+	auto addRange = [&](size_t first_triangle, size_t length) {
+		std::vector<Vector3u>& tris = draw_call_triangles.emplace_back(length);
+		for (size_t i = 0; i < length; ++i)
+		{
+			size_t t = first_triangle + i;
+			tris[i] = indices.size() ? indices[t] : Vector3u((unsigned int)(t * 3), (unsigned int)(t * 3 + 1), (unsigned int)(t * 3 + 2));
+		}
+	};
+	if (submeshes.empty())
+		addRange(0, num_triangles);
+	for (const sSubmeshInfo& submesh : submeshes)
+		for (unsigned int j = 0; j < submesh.num_draw_calls; ++j)
+		{
+			const sSubmeshDrawCallInfo& dc = submesh.draw_calls[j];
+			if (indices.size())
+				addRange(dc.start, dc.length);
+			else
+				addRange(dc.start / 3, dc.length / 3); //in vertices when not indexed
+		}
+
+	size_t previous_triangles = num_triangles;
+	std::vector<Vector3u> simplified;
+	for (int level = 1; level <= MESH_LOD_MAX_LEVELS; ++level)
+	{
+		float ratio = 1.0f / (float)(1 << level); //half the triangles every level
+		sMeshLOD lod;
+		lod.error = 0.0f;
+		lod.start = (unsigned int)lod_indices.size();
+
+		for (std::vector<Vector3u>& tris : draw_call_triangles)
+		{
+			sLODRange range;
+			range.start = (unsigned int)lod_indices.size();
+			size_t target = (size_t)(tris.size() * ratio);
+			float error = simplifyTriangles(&positions[0], weld, tris, target, simplified);
+			lod.error = std::max(lod.error, error);
+			lod_indices.insert(lod_indices.end(), simplified.begin(), simplified.end());
+			range.length = (unsigned int)simplified.size();
+			lod_ranges.push_back(range);
+		}
+
+		lod.length = (unsigned int)lod_indices.size() - lod.start;
+
+		//not worth it if it cannot be reduced anymore
+		if (lod.length > previous_triangles * 0.9f)
+		{
+			lod_indices.resize(lod.start);
+			lod_ranges.resize(lods.size() * draw_call_triangles.size());
+			break;
+		}
+		lods.push_back(lod);
+		previous_triangles = lod.length;
+	}
+
+	return lods.size() > 0;
+}
+
+int Mesh::selectLOD(Camera* camera, const Matrix44& model, int current_lod)
+{
+	if (lods.empty() || !camera)
+		return 0;
+
+	//errors are in mesh units, use the biggest scale of the model
+	float scale = (float)std::max(Vector3(model.m[0], model.m[1], model.m[2]).length(), std::max(Vector3(model.m[4], model.m[5], model.m[6]).length(), Vector3(model.m[8], model.m[9], model.m[10]).length()));
+	Vector3 center = model * box.center;
+
+	//coarsest level whose error is not visible, going coarser than the current one needs some margin
+	int lod = 0;
+	for (int i = 0; i < (int)lods.size(); ++i)
+	{
+		float threshold = MESH_LOD_PIXEL_ERROR * (i + 1 > current_lod ? 1.0f - MESH_LOD_HYSTERESIS : 1.0f + MESH_LOD_HYSTERESIS);
+		if (camera->getProjectedScale(center, lods[i].error * scale) > threshold)
+			break;
+		lod = i + 1;
+	}
+	return lod;
+}
+
 void Mesh::updateBoundingBox()
 {
 	if (vertices.size())
@@ -1677,14 +2622,14 @@ void Mesh::renderBounding(const Matrix44& model, bool world_bounding)
 
 	Shader* sh = Shader::getDefaultShader("flat");
 	sh->enable();
-	sh->setUniform("u_viewprojection", Camera::current->viewprojection_matrix);
+	sh->setUniform(UNIFORM("u_viewprojection"), Camera::current->viewprojection_matrix);
 
 	Matrix44 matrix;
 	matrix.translate(box.center.x, box.center.y, box.center.z);
 	matrix.scale(box.halfsize.x, box.halfsize.y, box.halfsize.z);
 
-	sh->setUniform("u_color", Vector4(1, 1, 0, 1));
-	sh->setUniform("u_model", matrix * model);
+	sh->setUniform(UNIFORM("u_color"), Vector4(1, 1, 0, 1));
+	sh->setUniform(UNIFORM("u_model"), matrix * model);
 	wire_box->render(GL_LINES);
 
 	if (world_bounding)
@@ -1693,8 +2638,8 @@ void Mesh::renderBounding(const Matrix44& model, bool world_bounding)
 		matrix.setIdentity();
 		matrix.translate(AABB.center.x, AABB.center.y, AABB.center.z);
 		matrix.scale(AABB.halfsize.x, AABB.halfsize.y, AABB.halfsize.z);
-		sh->setUniform("u_model", matrix);
-		sh->setUniform("u_color", Vector4(0, 1, 1, 1));
+		sh->setUniform(UNIFORM("u_model"), matrix);
+		sh->setUniform(UNIFORM("u_color"), Vector4(0, 1, 1, 1));
 		wire_box->render(GL_LINES);
 	}
 
@@ -1722,9 +2667,28 @@ Mesh* Mesh::Get(const char* filename)
 	if (it != sMeshesLoaded.end())
 		return it->second;
 
+	//already requested, wait for that job instead of loading it twice
+	AssetLoader* loader = AssetLoader::Get();
+	if (loader->isLoading(filename))
+	{
+		loader->wait(filename);
+		it = sMeshesLoaded.find(filename);
+		return it != sMeshesLoaded.end() ? it->second : NULL;
+	}
+
 	Mesh* m = new Mesh();
-	std::string name = filename;
-	m->name = name;
+	if (!m->loadFile(filename))
+	{
+		delete m;
+		return NULL;
+	}
+	m->finishLoading();
+	return m;
+}
+
+bool Mesh::loadFile(const char* filename)
+{
+	name = filename;
 
 	//detect format
 	char file_format = 0;
@@ -1740,77 +2704,86 @@ Mesh* Mesh::Get(const char* filename)
 	else
 	{
 		std::cerr << "Unknown mesh format: " << filename << std::endl;
-		return NULL;
+		return false;
 	}
 
-	//stats
+	//stats, printed at once as several meshes may be loading in parallel
 	long time = getTime();
-	std::cout << " + Mesh loading: " << filename << " ... ";
+	std::ostringstream log;
+	log << " + Mesh loading: " << filename << " ... ";
 	std::string binfilename = filename;
 
 	if (file_format != FORMAT_MBIN)
 		binfilename = binfilename + ".mbin";
 
-	//try loading the binary version
-	if (use_binary && m->readBin(binfilename.c_str()))
+	//try loading the binary version, its streams go from the mapping to VRAM in the layout they were written with
+	if (use_binary && readBin(binfilename.c_str()))
 	{
-		if (interleave_meshes && m->interleaved.size() == 0)
-		{
-			std::cout << "[INTERL] ";
-			m->interleaveBuffers();
-		}
-
-		if (auto_upload_to_vram)
-		{
-			std::cout << "[VRAM] ";
-			m->uploadToVRAM();
-		}
-
-		std::cout << "[OK BIN]  Faces: " << (m->interleaved.size() ? m->interleaved.size() : m->vertices.size()) / 3 << " Time: " << (getTime() - time) * 0.001 << "sec" << std::endl;
-		sMeshesLoaded[filename] = m;
-		return m;
+		log << "[OK BIN]  Faces: " << (getNumIndices() ? getNumIndices() : getNumVertices() / 3) << " Time: " << (getTime() - time) * 0.001 << "sec";
+		std::cout << log.str() << std::endl;
+		return true;
 	}
 
 	//load the ascii version
 	bool loaded = false;
 	if (file_format == FORMAT_OBJ)
-		loaded = m->loadOBJ(filename);
+		loaded = loadOBJ(filename);
 	else if (file_format == FORMAT_ASE)
-		loaded = m->loadASE(filename);
+		loaded = loadASE(filename);
 	else if (file_format == FORMAT_MESH)
-		loaded = m->loadMESH(filename);
+		loaded = loadMESH(filename);
 
 	if (!loaded)
 	{
-		delete m;
-		std::cout << "[ERROR]: Mesh not found" << std::endl;
-		return NULL;
+		log << "[ERROR]: Mesh not found";
+		std::cout << log.str() << std::endl;
+		return false;
 	}
 
+	//indices are stored in the .mbin too, the simplification also works better on welded vertices
+	float acmr = indices.size() ? 0.0f : 3.0f;
+	if (optimizeIndices())
+		log << "[IDX ACMR " << acmr << "->" << computeACMR(indices, vertices.size()) << "] ";
+
+	if (generateClusters())
+		log << "[CLUSTERS " << clusters.size() << "] ";
+
+	//simplified levels are stored in the .mbin, so this is only done once
+	if (generateLODs())
+		log << "[LOD " << lods.size() << "] ";
+
 	//to optimize, interleave the meshes
 	if (interleave_meshes)
 	{
-		std::cout << "[INTERL] ";
-		m->interleaveBuffers();
+		log << "[INTERL] ";
+		interleaveBuffers();
 	}
 
-	//and upload them to VRAM
-	if (auto_upload_to_vram)
-	{
-		std::cout << "[VRAM] ";
-		m->uploadToVRAM();
-	}
+	//the .mbin path builds it when reading
+	createCollisionModel();
 
-	std::cout << "[OK]  Faces: " << m->vertices.size() / 3 << " Time: " << (getTime() - time) * 0.001 << "sec" << std::endl;
+	log << "[OK]  Faces: " << (indices.size() ? indices.size() : getNumVertices() / 3) << " Time: " << (getTime() - time) * 0.001 << "sec";
 	if (use_binary)
 	{
-		std::cout << "\t\t Writing .BIN ... ";
-		m->writeBin(filename);
-		std::cout << "[OK]" << std::endl;
+		log << std::endl << "\t\t Writing .BIN ... ";
+		writeBin(filename);
+		log << "[OK]";
 	}
+	std::cout << log.str() << std::endl;
+	return true;
+}
 
-	m->registerMesh(name);
-	return m;
+void Mesh::finishLoading()
+{
+	resolveMaterials();
+
+	//and upload them to VRAM
+	if (auto_upload_to_vram)
+		uploadToVRAM();
+	else
+		releaseMappedFile();
+
+	registerMesh(name);
 }
 
 void Mesh::registerMesh(std::string name)
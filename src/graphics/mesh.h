@@ -10,9 +10,21 @@ class Shader; //for binding
 class Image; //for displace
 class Skeleton; //for skinned meshes
 class Texture;
+class Camera;
+class MappedFile; //for the .mbin streams used in place
 
 //version from 21/01/2024
-#define MESH_BIN_VERSION 12 //this is used to regenerate bins if the format changes
+#define MESH_BIN_VERSION 15 //this is used to regenerate bins if the format changes
+
+//level of detail
+#define MESH_LOD_MAX_LEVELS 4			//simplified levels generated at cook time
+#define MESH_LOD_MIN_TRIANGLES 256		//smaller meshes do not get LODs
+#define MESH_LOD_PIXEL_ERROR 1.5f		//max projected error allowed when choosing a level
+#define MESH_LOD_HYSTERESIS 0.25f		//margin to avoid popping between two levels
+
+//clusters
+#define MESH_CLUSTER_TRIANGLES 128		//triangles per cluster
+#define MESH_CLUSTER_MIN_TRIANGLES 4096	//smaller draw calls are not split
 
 #define MAX_SUBMESH_DRAW_CALLS 16
 
@@ -35,12 +47,76 @@ struct sSubmeshInfo
 	sSubmeshDrawCallInfo draw_calls[MAX_SUBMESH_DRAW_CALLS];
 };
 
+//a simplified level of the whole mesh
+struct sMeshLOD
+{
+	float error;			//max distance to the original surface, in mesh units
+	unsigned int start;		//first triangle in lod_indices
+	unsigned int length;	//triangles of the whole level
+};
+
+//triangles of one submesh draw call in a simplified level
+struct sLODRange
+{
+	unsigned int start;
+	unsigned int length;
+};
+
+//group of nearby triangles of a big mesh, culled on its own
+struct sMeshCluster
+{
+	Vector3 center;			//bounding box in mesh space
+	Vector3 halfsize;
+	Vector3 cone_axis;		//average normal of the triangles
+	float cone_cutoff;		//1 when the triangles face too many directions to be backface culled together
+	unsigned int start;		//first triangle in indices
+	unsigned int length;
+};
+
+//bones of a mesh resolved against one skeleton layout, built on first use
+struct sBoneRemap
+{
+	unsigned int layout;			//Rig::layout
+	std::vector<int> indices;		//skeleton bone of every bones_info entry, -1 if missing
+	std::vector<Matrix44> offsets;	//bind_matrix * bind_pose of every bones_info entry
+};
+
+//final bone matrices of the mesh posed by one skeleton, all the views of a frame reuse them
+struct sBonePalette
+{
+	unsigned int version = 0;		//Skeleton::version when computed
+	std::vector<Matrix44> matrices;
+	unsigned int buffer_id = 0;		//UBLOCK_BONES data, only created when a shader uses the block
+	bool uploaded = false;
+};
+
+//per instance data of an instanced draw with something more than the model
+struct sInstanceData
+{
+	Matrix44 model;		//attribute mat4, 4 locations
+	Vector4 data;
+};
+
+//vertex array object with the attribute setup for one attribute signature
+struct sVertexArray
+{
+	uint32_t signature;
+	unsigned int vao;
+	bool quantized = false; //uses the compact buffer
+};
+
+//GLSL helpers to decode the compact vertex layout: decodePosition(a_vertex) and decodeNormal(a_normal)
+extern const char* QUANTIZATION_GLSL;
+
 struct sMaterialInfo
 {
+	std::string name;
 	Vector3 Ka;
 	Vector3 Kd;
 	Vector3 Ks;
 	Texture* Kd_texture = nullptr;
+	std::string Kd_texture_name;	//map_Kd of the mtl, Kd_texture is requested by resolveMaterials
+	int block_index = -1;	//entry in the shared table of material blocks
 };
 
 class Mesh
@@ -50,13 +126,17 @@ public:
 	static bool use_binary; //always load the binary version of a mesh when possible
 	static bool interleave_meshes; //loaded meshes will me automatically interleaved
 	static bool auto_upload_to_vram; //loaded meshes will be stored in the VRAM
+	static bool quantize_meshes; //interleaved meshes and weights are stored in VRAM with the compact layout
 	static long num_meshes_rendered;
 	static long num_triangles_rendered;
+	static long num_clusters_culled;
+	static bool cluster_cone_culling; //false culls the clusters by the frustum only
 
 	std::string name;
 
 	std::vector<sSubmeshInfo> submeshes; //contains info about every submesh
-	std::map<std::string, sMaterialInfo> materials; //contains info about every material
+	std::vector<sMaterialInfo> materials; //contains info about every material
+	std::vector<int> draw_call_materials; //index in materials of every draw call of the submeshes (in order), -1 if none
 
 	std::vector< Vector3 > vertices; //here we store the vertices
 	std::vector< Vector3 > normals;	 //here we store the normals
@@ -72,13 +152,29 @@ public:
 
 	std::vector< tInterleaved > interleaved; //to render interleaved
 
+	//compact version of tInterleaved used in VRAM when quantize_meshes is set
+	struct tQuantized {
+		short vertex[4];		//normalized inside the bounds of the mesh, w unused
+		short normal[2];		//octahedral encoding
+		unsigned short uv[2];	//half floats, tiled uvs go beyond 0..1
+	};
+
 	std::vector< Vector3u > indices; //for indexed meshes
 
+	//simplified levels, level 0 is the mesh itself and is not stored here
+	std::vector< sMeshLOD > lods;
+	std::vector< sLODRange > lod_ranges; //per level, one per draw call of the submeshes (in order)
+	std::vector< Vector3u > lod_indices; //triangles of all the levels, they index the same vertices
+
+	std::vector< sMeshCluster > clusters; //sorted by start, only the big draw calls have them
+
 	//for animated meshes
 	std::vector< Vector4ub > bones; //tells which bones afect the vertex (4 max)
 	std::vector< Vector4 > weights; //tells how much affect every bone
 	std::vector< BoneInfo > bones_info; //tells 
 	Matrix44 bind_matrix;
+	std::vector< sBoneRemap > bone_remaps; //one per skeleton layout, usually one
+	std::map< const Skeleton*, sBonePalette > bone_palettes;
 
 	Vector3 aabb_min;
 	Vector3	aabb_max;
@@ -96,28 +192,100 @@ public:
 	unsigned int bones_vbo_id;
 	unsigned int weights_vbo_id;
 	unsigned int uvs1_vbo_id;
+	unsigned int index_size;	//bytes per index in indices_vbo_id, 2 when the vertices fit in 16 bits
+	unsigned int quantized_vbo_id;	//tQuantized, the float version is only uploaded if a shader cannot decode it
+	bool quantized_weights;			//weights_vbo_id stores bytes
+
+	//decoding of the quantized positions: position = vertex * scale + offset, scale.w is 1 when the normals are octahedral
+	Vector4 quantization_scale;
+	Vector3 quantization_offset;
+
+	std::vector<sVertexArray> vertex_arrays; //usually one or two, one per attribute signature used
+
+	//the streams of a .mbin are uploaded straight from the mapped file, their vectors stay empty and the VBO ids tell
+	//if the mesh has them. uploadToVRAM releases the mapping, getGeometry maps the file again for the CPU users
+	struct sMappedStreams {
+		const tInterleaved* interleaved = nullptr;
+		const Vector3* vertices = nullptr;
+		const Vector3* normals = nullptr;
+		const Vector2* uvs = nullptr;
+		const Vector2* uvs1 = nullptr;
+		const Vector4* colors = nullptr;
+		const Vector4ub* bones = nullptr;
+		const Vector4* weights = nullptr;
+		const Vector3u* indices = nullptr;
+		const Vector3u* lod_indices = nullptr;
+		size_t size = 0;
+		size_t num_indices = 0;
+		size_t num_lod_indices = 0;
+	} mapped_streams;
+	MappedFile* mapped_file;
+	std::string bin_filename;		//the .mbin read, mapped again by getGeometry
+	unsigned int num_bin_vertices;	//sizes of the streams of the .mbin, also once they are only in VRAM
+	unsigned int num_bin_indices;
+
+	//positions and triangles for the CPU (collision, occluders, static batches), they point to RAM or to the .mbin
+	//mapped again when the mesh only has them in VRAM, so keep it only while using them
+	struct sGeometry {
+		const tInterleaved* interleaved = nullptr; //one of these two
+		const Vector3* vertices = nullptr;
+		const Vector3u* indices = nullptr; //null for triangle soups
+		const Vector3u* lod_indices = nullptr;
+		size_t num_vertices = 0;
+		size_t num_indices = 0;
+		MappedFile* file = nullptr;
+
+		sGeometry() {}
+		sGeometry(const sGeometry&) = delete;
+		sGeometry& operator = (const sGeometry&) = delete;
+		~sGeometry();
+		const Vector3& getPosition(size_t i) const { return interleaved ? interleaved[i].vertex : vertices[i]; }
+	};
 
 	Mesh();
 	~Mesh();
 
 	void clear();
+	void clearBuffers(); //only the CPU side (vectors, mapping, collision), safe from other threads
 
-	void render(unsigned int primitive, int submesh_id = -1, int num_instances = 0);
+	void render(unsigned int primitive, int submesh_id = -1, int num_instances = 0, int lod = 0);
 	void renderInstanced(unsigned int primitive, const Matrix44* instanced_models, int number);
+	void renderInstanced(unsigned int primitive, const sInstanceData* instances, int number, const char* model_name, const char* data_name);
 	void renderInstanced(unsigned int primitive, const std::vector<Vector3> positions, const char* uniform_name);
 	void renderBounding(const Matrix44& model, bool world_bounding = true);
 	void renderFixedPipeline(int primitive); //sloooooooow
-	void renderAnimated(unsigned int primitive, Skeleton* sk);
+	void renderAnimated(unsigned int primitive, Skeleton* sk, int lod = 0); //u_bones from the palette, as a block if the shader includes "skinning"
 
 	void enableBuffers(Shader* shader);
-	void drawCall(unsigned int primitive, int submesh_id, int draw_call_id, int num_instances);
+	void drawCall(unsigned int primitive, int submesh_id, int draw_call_id, int num_instances, int lod = 0);
+	static void setClusterView(Camera* camera, const Matrix44& model, bool cull_backfaces = false); //culls the clusters in the next renders, nullptr disables it
 	void disableBuffers(Shader* shader);
+	void releaseVertexArrays();
+	static bool useVertexArrays();
+	static bool supportsQuantization(Shader* shader); //the shader includes "quantization"
+
+	//skinning
+	const sBoneRemap& getBoneRemap(Skeleton* skeleton);
+	sBonePalette& getBonePalette(Skeleton* skeleton, bool upload); //recomputed only when the skeleton pose changed
+	void releaseBonePalette(const Skeleton* skeleton); //when the skeleton is destroyed, frees its buffer
+	void updateBonePalette(sBonePalette& palette, Skeleton* skeleton); //CPU part, safe from other threads once the remap of the rig exists
 
 	bool readBin(const char* filename);
 	bool writeBin(const char* filename);
 
 	unsigned int getNumSubmeshes() { return (unsigned int)submeshes.size(); }
-	unsigned int getNumVertices() { return (unsigned int)interleaved.size() ? (unsigned int)interleaved.size() : (unsigned int)vertices.size(); }
+	unsigned int getNumDrawCalls() const; //of all the submeshes, at least one
+	unsigned int getIndexType() const; //GL type of the indices in VRAM
+	unsigned int getNumLODs() const { return (unsigned int)lods.size() + 1; }
+	unsigned int getNumVertices() const { return interleaved.size() ? (unsigned int)interleaved.size() : (vertices.size() ? (unsigned int)vertices.size() : num_bin_vertices); }
+	unsigned int getNumIndices() const { return indices.size() ? (unsigned int)indices.size() : num_bin_indices; } //triangles, 0 for triangle soups
+	bool getGeometry(sGeometry& geometry) const; //false if it has no vertices, safe from other threads
+	bool hasInterleaved() const { return interleaved.size() || interleaved_vbo_id || quantized_vbo_id; } //in RAM or only in VRAM
+	bool hasNormals() const { return normals.size() || normals_vbo_id; } //separated streams, the interleaved ones always have them
+	bool hasUVs() const { return uvs.size() || uvs_vbo_id; }
+	bool hasUVs1() const { return uvs1.size() || uvs1_vbo_id; }
+	bool hasColors() const { return colors.size() || colors_vbo_id; }
+	bool hasBones() const { return bones.size() || bones_vbo_id; }
 
 	//collision testing
 	void* collision_model;
@@ -128,6 +296,8 @@ public:
 
 	//loader
 	static Mesh* Get(const char* filename);
+	bool loadFile(const char* filename); //CPU part (parsing, .mbin, LODs, collision), safe from other threads
+	void finishLoading(); //GL part, main thread: materials, VRAM and registering it
 	void registerMesh(std::string name);
 
 	//create help meshes
@@ -144,11 +314,22 @@ public:
 
 	//optimize meshes
 	void uploadToVRAM();
+	void uploadQuantized(const tInterleaved* source, size_t count); //compact layout of the interleaved vertices
+	void releaseMappedFile(); //the streams still in the .mbin are copied to RAM first if they are not in VRAM
+	bool optimizeIndices(); //welds the corners of a triangle soup into indices ordered for the vertex caches, done before writing the .mbin
+	bool generateClusters(); //splits the big draw calls in clusters with bounds and normal cones, done before writing the .mbin
+	bool generateLODs(); //builds the simplified levels, slow, done before writing the .mbin
+	int selectLOD(Camera* camera, const Matrix44& model, int current_lod); //picks the level for an instance, current_lod adds hysteresis
 	bool interleaveBuffers();
 
 private:
+	void setupAttributes(Shader* shader);
+	void drawSubmeshes(unsigned int primitive, int submesh_id, int num_instances, int lod = 0);
+	bool drawClusters(unsigned int primitive, size_t start, size_t size); //false if the range has no clusters
+
 	bool loadASE(const char* filename);
 	bool loadOBJ(const char* filename);
 	bool parseMTL(const char* filename);
+	void resolveMaterials(); //names of the draw calls to indices, and their constants to the material blocks
 	bool loadMESH(const char* filename); //personal format used for animations
 };
\ No newline at end of file
@@ -0,0 +1,304 @@
+#include "mesh_optimize.h"
+#include "mesh.h"
+
+#include <algorithm>
+#include <cmath>
+#include <unordered_map>
+
+//scoring from "Linear-Speed Vertex Cache Optimisation" by Tom Forsyth
+#define CACHE_DECAY_POWER 1.5f
+#define LAST_TRIANGLE_SCORE 0.75f
+#define VALENCE_BOOST_SCALE 2.0f
+#define VALENCE_BOOST_POWER 0.5f
+
+static float vertexScore(int cache_position, unsigned int remaining_triangles)
+{
+	if (remaining_triangles == 0)
+		return -1.0f; //not needed anymore
+
+	float score = 0.0f;
+	if (cache_position >= 0)
+	{
+		if (cache_position < 3)
+			score = LAST_TRIANGLE_SCORE; //used by the last triangle, no benefit if used again right away
+		else
+		{
+			float scaler = 1.0f / (VERTEX_CACHE_SIZE - 3);
+			score = powf(1.0f - (cache_position - 3) * scaler, CACHE_DECAY_POWER);
+		}
+	}
+
+	//vertices with few triangles left are finished first
+	score += VALENCE_BOOST_SCALE * powf((float)remaining_triangles, -VALENCE_BOOST_POWER);
+	return score;
+}
+
+void optimizeVertexCache(std::vector<Vector3u>& triangles, size_t first, size_t count, size_t num_vertices)
+{
+	if (count < 2)
+		return;
+
+	//triangles of every vertex (compact adjacency)
+	std::vector<unsigned int> offsets(num_vertices + 1, 0);
+	for (size_t i = 0; i < count; ++i)
+		for (int k = 0; k < 3; ++k)
+			offsets[triangles[first + i].v[k] + 1]++;
+	for (size_t i = 0; i < num_vertices; ++i)
+		offsets[i + 1] += offsets[i];
+	std::vector<unsigned int> adjacency(count * 3);
+	std::vector<unsigned int> fill(offsets.begin(), offsets.end() - 1);
+	for (size_t i = 0; i < count; ++i)
+		for (int k = 0; k < 3; ++k)
+			adjacency[fill[triangles[first + i].v[k]]++] = (unsigned int)i;
+
+	std::vector<unsigned int> remaining(num_vertices);
+	std::vector<int> cache_position(num_vertices, -1);
+	std::vector<float> vertex_scores(num_vertices);
+	for (size_t v = 0; v < num_vertices; ++v)
+	{
+		remaining[v] = offsets[v + 1] - offsets[v];
+		vertex_scores[v] = vertexScore(-1, remaining[v]);
+	}
+
+	std::vector<float> triangle_scores(count);
+	std::vector<char> emitted(count, 0);
+	for (size_t i = 0; i < count; ++i)
+	{
+		const Vector3u& t = triangles[first + i];
+		triangle_scores[i] = vertex_scores[t.x] + vertex_scores[t.y] + vertex_scores[t.z];
+	}
+
+	std::vector<Vector3u> result;
+	result.reserve(count);
+	std::vector<unsigned int> cache, new_cache;
+	cache.reserve(VERTEX_CACHE_SIZE + 3);
+	new_cache.reserve(VERTEX_CACHE_SIZE + 3);
+	size_t scan_cursor = 0; //for the slow search when nothing in the cache is useful
+
+	int best = 0;
+	float best_score = triangle_scores[0];
+	for (size_t i = 1; i < count; ++i)
+		if (triangle_scores[i] > best_score)
+		{
+			best_score = triangle_scores[i];
+			best = (int)i;
+		}
+
+	while (best != -1)
+	{
+		const Vector3u t = triangles[first + best];
+		result.push_back(t);
+		emitted[best] = 1;
+
+		//the triangle vertices go to the front of the cache
+		new_cache.clear();
+		for (int k = 0; k < 3; ++k)
+		{
+			unsigned int v = t.v[k];
+			new_cache.push_back(v);
+			//remove the triangle from the vertex list
+			unsigned int* begin = &adjacency[offsets[v]];
+			unsigned int* end = begin + remaining[v];
+			unsigned int* it = std::find(begin, end, (unsigned int)best);
+			if (it != end)
+			{
+				*it = *(end - 1);
+				remaining[v]--;
+			}
+		}
+		for (unsigned int v : cache)
+			if (v != t.x && v != t.y && v != t.z)
+				new_cache.push_back(v);
+
+		//vertices pushed out of the cache
+		for (size_t i = VERTEX_CACHE_SIZE; i < new_cache.size(); ++i)
+		{
+			unsigned int v = new_cache[i];
+			cache_position[v] = -1;
+			vertex_scores[v] = vertexScore(-1, remaining[v]);
+		}
+		if (new_cache.size() > VERTEX_CACHE_SIZE)
+			new_cache.resize(VERTEX_CACHE_SIZE);
+		std::swap(cache, new_cache);
+
+		//update the scores of the cached vertices and their triangles, the best of them goes next
+		best = -1;
+		best_score = -1.0f;
+		for (size_t i = 0; i < cache.size(); ++i)
+		{
+			unsigned int v = cache[i];
+			cache_position[v] = (int)i;
+			vertex_scores[v] = vertexScore((int)i, remaining[v]);
+		}
+		for (unsigned int v : cache)
+			for (unsigned int j = offsets[v]; j < offsets[v] + remaining[v]; ++j)
+			{
+				unsigned int tri = adjacency[j];
+				const Vector3u& other = triangles[first + tri];
+				float score = vertex_scores[other.x] + vertex_scores[other.y] + vertex_scores[other.z];
+				triangle_scores[tri] = score;
+				if (score > best_score)
+				{
+					best_score = score;
+					best = (int)tri;
+				}
+			}
+
+		//nothing connected to the cache, take the next triangle left
+		if (best == -1)
+		{
+			while (scan_cursor < count && emitted[scan_cursor])
+				scan_cursor++;
+			if (scan_cursor < count)
+				best = (int)scan_cursor;
+		}
+	}
+
+	std::copy(result.begin(), result.end(), triangles.begin() + first);
+}
+
+size_t optimizeVertexFetch(std::vector<Vector3u>& triangles, size_t num_vertices, std::vector<int>& remap)
+{
+	remap.assign(num_vertices, -1);
+	int next = 0;
+	for (Vector3u& t : triangles)
+		for (int k = 0; k < 3; ++k)
+		{
+			int& index = remap[t.v[k]];
+			if (index == -1)
+				index = next++;
+			t.v[k] = index;
+		}
+	return next;
+}
+
+float computeACMR(const std::vector<Vector3u>& triangles, size_t num_vertices, size_t cache_size)
+{
+	if (triangles.empty())
+		return 0.0f;
+
+	std::vector<size_t> timestamps(num_vertices, 0);
+	size_t time = cache_size + 1;
+	size_t misses = 0;
+	for (const Vector3u& t : triangles)
+		for (int k = 0; k < 3; ++k)
+			if (time - timestamps[t.v[k]] > cache_size)
+			{
+				timestamps[t.v[k]] = time++;
+				misses++;
+			}
+	return misses / (float)triangles.size();
+}
+
+//interleaves the bits of three 10 bits coordinates
+static unsigned int mortonCode(unsigned int x, unsigned int y, unsigned int z)
+{
+	auto spread = [](unsigned int v) {
+		v = (v | (v << 16)) & 0x030000FF;
+		v = (v | (v << 8)) & 0x0300F00F;
+		v = (v | (v << 4)) & 0x030C30C3;
+		v = (v | (v << 2)) & 0x09249249;
+		return v;
+	};
+	return spread(x) | (spread(y) << 1) | (spread(z) << 2);
+}
+
+void buildClusters(const std::vector<Vector3>& positions, std::vector<Vector3u>& triangles, size_t first, size_t count, std::vector<sMeshCluster>& clusters)
+{
+	if (count == 0)
+		return;
+
+	//morton order of the centroids keeps the clusters compact
+	std::vector<Vector3> centroids(count);
+	Vector3 min_pos = positions[triangles[first].x];
+	Vector3 max_pos = min_pos;
+	for (size_t i = 0; i < count; ++i)
+	{
+		const Vector3u& t = triangles[first + i];
+		centroids[i] = (positions[t.x] + positions[t.y] + positions[t.z]) * (1.0f / 3.0f);
+		min_pos.setMin(centroids[i]);
+		max_pos.setMax(centroids[i]);
+	}
+	Vector3 size = max_pos - min_pos;
+	float extent = std::max(size.x, std::max(size.y, size.z));
+	float scale = extent > 0.0f ? 1023.0f / extent : 0.0f;
+
+	std::vector<std::pair<unsigned int, unsigned int>> codes(count); //code, triangle
+	for (size_t i = 0; i < count; ++i)
+	{
+		Vector3 p = (centroids[i] - min_pos) * scale;
+		codes[i] = std::make_pair(mortonCode((unsigned int)p.x, (unsigned int)p.y, (unsigned int)p.z), (unsigned int)i);
+	}
+	std::sort(codes.begin(), codes.end());
+
+	std::vector<Vector3u> sorted(count);
+	for (size_t i = 0; i < count; ++i)
+		sorted[i] = triangles[first + codes[i].second];
+
+	std::vector<Vector3u> local;
+	std::unordered_map<unsigned int, unsigned int> local_ids;
+	std::vector<unsigned int> global_ids;
+	for (size_t start = 0; start < count; start += MESH_CLUSTER_TRIANGLES)
+	{
+		size_t length = std::min((size_t)MESH_CLUSTER_TRIANGLES, count - start);
+
+		//cache order with the vertices renumbered inside the cluster, the mesh can be huge
+		local.resize(length);
+		local_ids.clear();
+		global_ids.clear();
+		for (size_t i = 0; i < length; ++i)
+			for (int k = 0; k < 3; ++k)
+			{
+				unsigned int v = sorted[start + i].v[k];
+				auto it = local_ids.emplace(v, (unsigned int)global_ids.size());
+				if (it.second)
+					global_ids.push_back(v);
+				local[i].v[k] = it.first->second;
+			}
+		optimizeVertexCache(local, 0, length, global_ids.size());
+
+		sMeshCluster& cluster = clusters.emplace_back();
+		cluster.start = (unsigned int)(first + start);
+		cluster.length = (unsigned int)length;
+
+		Vector3 cluster_min = positions[global_ids[0]];
+		Vector3 cluster_max = cluster_min;
+		Vector3 axis(0, 0, 0);
+		std::vector<Vector3> normals;
+		normals.reserve(length);
+		for (size_t i = 0; i < length; ++i)
+		{
+			Vector3u& t = triangles[first + start + i];
+			t.set(global_ids[local[i].x], global_ids[local[i].y], global_ids[local[i].z]);
+			for (int k = 0; k < 3; ++k)
+			{
+				cluster_min.setMin(positions[t.v[k]]);
+				cluster_max.setMax(positions[t.v[k]]);
+			}
+			Vector3 normal = (positions[t.y] - positions[t.x]).cross(positions[t.z] - positions[t.x]);
+			float area = (float)normal.length();
+			if (area > 0.0f)
+			{
+				normal = normal * (1.0f / area);
+				normals.push_back(normal);
+				axis = axis + normal;
+			}
+		}
+		cluster.center = (cluster_min + cluster_max) * 0.5f;
+		cluster.halfsize = (cluster_max - cluster_min) * 0.5f;
+
+		//the cone contains all the normals, too wide cones cannot be culled
+		cluster.cone_axis.set(0, 0, 0);
+		cluster.cone_cutoff = 1.0f;
+		float axis_length = (float)axis.length();
+		if (axis_length > 0.0f)
+		{
+			cluster.cone_axis = axis * (1.0f / axis_length);
+			float min_dot = 1.0f;
+			for (const Vector3& normal : normals)
+				min_dot = std::min(min_dot, normal.dot(cluster.cone_axis));
+			if (min_dot > 0.1f)
+				cluster.cone_cutoff = sqrtf(1.0f - min_dot * min_dot);
+		}
+	}
+}
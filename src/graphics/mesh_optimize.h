@@ -0,0 +1,28 @@
+/*  Index buffer optimizations done at cook time, once the vertices are welded:
+	triangle order for the post-transform vertex cache (Forsyth's linear-speed algorithm),
+	vertex order for fetch locality (vertices sorted by first use) and clusters of nearby
+	triangles for the culling of big meshes.
+*/
+
+#pragma once
+
+#include "framework/framework.h"
+#include <vector>
+
+struct sMeshCluster;
+
+#define VERTEX_CACHE_SIZE 32 //simulated cache, bigger than most real ones is fine for this algorithm
+
+//reorders count triangles starting at first, vertices are not changed
+void optimizeVertexCache(std::vector<Vector3u>& triangles, size_t first, size_t count, size_t num_vertices);
+
+//renumbers the vertices in the order they are used by the triangles, remap[old] = new (or -1 if unused)
+//returns the number of vertices used
+size_t optimizeVertexFetch(std::vector<Vector3u>& triangles, size_t num_vertices, std::vector<int>& remap);
+
+//average vertex shader invocations per triangle with a FIFO cache, 0.5 is the best possible and 3 is a triangle soup
+float computeACMR(const std::vector<Vector3u>& triangles, size_t num_vertices, size_t cache_size = 16);
+
+//sorts count triangles starting at first along a morton curve and splits them in clusters of MESH_CLUSTER_TRIANGLES,
+//each cluster is ordered for the vertex cache on its own, the new clusters are added at the end
+void buildClusters(const std::vector<Vector3>& positions, std::vector<Vector3u>& triangles, size_t first, size_t count, std::vector<sMeshCluster>& clusters);
@@ -0,0 +1,315 @@
+#include "mesh_simplify.h"
+
+#include <map>
+#include <tuple>
+#include <algorithm>
+#include <cmath>
+
+//symmetric 4x4 matrix, sum of squared distances to a set of planes
+struct sQuadric
+{
+	double a2 = 0, ab = 0, ac = 0, ad = 0;
+	double b2 = 0, bc = 0, bd = 0;
+	double c2 = 0, cd = 0;
+	double d2 = 0;
+
+	void addPlane(double a, double b, double c, double d, double w)
+	{
+		a2 += a * a * w; ab += a * b * w; ac += a * c * w; ad += a * d * w;
+		b2 += b * b * w; bc += b * c * w; bd += b * d * w;
+		c2 += c * c * w; cd += c * d * w;
+		d2 += d * d * w;
+	}
+
+	void add(const sQuadric& q)
+	{
+		a2 += q.a2; ab += q.ab; ac += q.ac; ad += q.ad;
+		b2 += q.b2; bc += q.bc; bd += q.bd;
+		c2 += q.c2; cd += q.cd;
+		d2 += q.d2;
+	}
+
+	double evaluate(const Vector3& p) const
+	{
+		double x = p.x, y = p.y, z = p.z;
+		double e = a2 * x * x + 2 * ab * x * y + 2 * ac * x * z + 2 * ad * x
+			+ b2 * y * y + 2 * bc * y * z + 2 * bd * y
+			+ c2 * z * z + 2 * cd * z
+			+ d2;
+		return e > 0 ? e : 0;
+	}
+};
+
+struct sCollapse
+{
+	double cost;
+	unsigned int from;
+	unsigned int to;
+	bool operator<(const sCollapse& other) const { return cost < other.cost; }
+};
+
+//borders get a much higher weight so the silhouette of open meshes (terrain patches) is kept
+#define BORDER_WEIGHT 10.0
+#define MAX_SIMPLIFY_PASSES 32
+
+static Vector3 triangleNormal(const Vector3& a, const Vector3& b, const Vector3& c)
+{
+	return (b - a).cross(c - a);
+}
+
+void weldPositions(const Vector3* positions, size_t num_positions, sWeldMap& weld)
+{
+	//meshes come with a vertex per wedge, the seams have several at the same position
+	std::map<std::tuple<float, float, float>, unsigned int> welded_ids;
+	weld.remap.resize(num_positions);
+	weld.representative.clear();
+	for (size_t i = 0; i < num_positions; ++i)
+	{
+		const Vector3& p = positions[i];
+		auto it = welded_ids.emplace(std::make_tuple(p.x, p.y, p.z), (unsigned int)weld.representative.size());
+		if (it.second)
+			weld.representative.push_back((unsigned int)i);
+		weld.remap[i] = it.first->second;
+	}
+}
+
+float simplifyTriangles(const Vector3* positions, const sWeldMap& weld, const std::vector<Vector3u>& triangles, size_t target_triangles, std::vector<Vector3u>& result)
+{
+	const std::vector<unsigned int>& remap = weld.remap;
+	const std::vector<unsigned int>& representative = weld.representative;
+	size_t num_vertices = representative.size();
+
+	//the collapses work on the welded vertices, the wedges (original vertices) of every corner follow them
+	std::vector<Vector3u> tris;
+	std::vector<Vector3u> wedges;
+	tris.reserve(triangles.size());
+	wedges.reserve(triangles.size());
+	for (const Vector3u& t : triangles)
+	{
+		Vector3u w(remap[t.x], remap[t.y], remap[t.z]);
+		if (w.x != w.y && w.y != w.z && w.x != w.z)
+		{
+			tris.push_back(w);
+			wedges.push_back(t);
+		}
+	}
+
+	//plane quadrics of the adjacent triangles
+	std::vector<sQuadric> quadrics(num_vertices);
+	std::map<std::pair<unsigned int, unsigned int>, int> edge_count;
+	for (const Vector3u& t : tris)
+	{
+		unsigned int v[3] = { t.x, t.y, t.z };
+		const Vector3& a = positions[representative[v[0]]];
+		Vector3 n = triangleNormal(a, positions[representative[v[1]]], positions[representative[v[2]]]);
+		double len = n.length();
+		if (len > 0)
+		{
+			n = n / (float)len;
+			double d = -n.dot(a);
+			for (int k = 0; k < 3; ++k)
+				quadrics[v[k]].addPlane(n.x, n.y, n.z, d, 1.0);
+		}
+		for (int k = 0; k < 3; ++k)
+		{
+			unsigned int e0 = v[k], e1 = v[(k + 1) % 3];
+			edge_count[std::make_pair(std::min(e0, e1), std::max(e0, e1))]++;
+		}
+	}
+
+	//open edges: plane through the edge perpendicular to the triangle
+	for (const Vector3u& t : tris)
+	{
+		unsigned int v[3] = { t.x, t.y, t.z };
+		Vector3 n = triangleNormal(positions[representative[v[0]]], positions[representative[v[1]]], positions[representative[v[2]]]);
+		for (int k = 0; k < 3; ++k)
+		{
+			unsigned int e0 = v[k], e1 = v[(k + 1) % 3];
+			if (edge_count[std::make_pair(std::min(e0, e1), std::max(e0, e1))] != 1)
+				continue;
+			const Vector3& p0 = positions[representative[e0]];
+			Vector3 edge = positions[representative[e1]] - p0;
+			Vector3 plane_normal = edge.cross(n);
+			double len = plane_normal.length();
+			if (len <= 0)
+				continue;
+			plane_normal = plane_normal / (float)len;
+			double d = -plane_normal.dot(p0);
+			quadrics[e0].addPlane(plane_normal.x, plane_normal.y, plane_normal.z, d, BORDER_WEIGHT);
+			quadrics[e1].addPlane(plane_normal.x, plane_normal.y, plane_normal.z, d, BORDER_WEIGHT);
+		}
+	}
+
+	std::vector<unsigned int> collapsed_to(num_vertices);
+	for (size_t i = 0; i < num_vertices; ++i)
+		collapsed_to[i] = (unsigned int)i;
+	std::vector<unsigned int> wedge_to(remap.size());
+	for (size_t i = 0; i < remap.size(); ++i)
+		wedge_to[i] = (unsigned int)i;
+	std::vector<std::pair<unsigned int, unsigned int>> wedge_pairs;
+
+	double max_error = 0;
+	std::vector<unsigned int> adjacency_offset;
+	std::vector<unsigned int> adjacency;
+	std::vector<sCollapse> collapses;
+	std::vector<char> locked;
+
+	for (int pass = 0; pass < MAX_SIMPLIFY_PASSES && tris.size() > target_triangles; ++pass)
+	{
+		//vertex to triangles adjacency (compact)
+		adjacency_offset.assign(num_vertices + 1, 0);
+		for (const Vector3u& t : tris)
+		{
+			adjacency_offset[t.x + 1]++;
+			adjacency_offset[t.y + 1]++;
+			adjacency_offset[t.z + 1]++;
+		}
+		for (size_t i = 0; i < num_vertices; ++i)
+			adjacency_offset[i + 1] += adjacency_offset[i];
+		adjacency.resize(tris.size() * 3);
+		std::vector<unsigned int> fill(adjacency_offset.begin(), adjacency_offset.end() - 1);
+		for (unsigned int i = 0; i < tris.size(); ++i)
+		{
+			adjacency[fill[tris[i].x]++] = i;
+			adjacency[fill[tris[i].y]++] = i;
+			adjacency[fill[tris[i].z]++] = i;
+		}
+
+		//every edge collapses to the endpoint with the lowest error
+		collapses.clear();
+		for (const Vector3u& t : tris)
+		{
+			unsigned int v[3] = { t.x, t.y, t.z };
+			for (int k = 0; k < 3; ++k)
+			{
+				unsigned int a = v[k], b = v[(k + 1) % 3]; //shared edges appear twice, the second is skipped by the locks
+				sQuadric q = quadrics[a];
+				q.add(quadrics[b]);
+				double cost_ab = q.evaluate(positions[representative[b]]);
+				double cost_ba = q.evaluate(positions[representative[a]]);
+				if (cost_ab <= cost_ba)
+					collapses.push_back({ cost_ab, a, b });
+				else
+					collapses.push_back({ cost_ba, b, a });
+			}
+		}
+		std::sort(collapses.begin(), collapses.end());
+
+		//collapse the cheapest edges, locking the neighbourhood so the checks stay valid in this pass
+		size_t triangles_to_remove = tris.size() - target_triangles;
+		size_t removed = 0;
+		size_t num_collapses = 0;
+		locked.assign(num_vertices, 0);
+		for (const sCollapse& c : collapses)
+		{
+			if (removed >= triangles_to_remove)
+				break;
+			if (locked[c.from] || locked[c.to])
+				continue;
+
+			//reject collapses that flip a triangle
+			const Vector3& target = positions[representative[c.to]];
+			bool flips = false;
+			int shared = 0;
+			for (unsigned int i = adjacency_offset[c.from]; i < adjacency_offset[c.from + 1] && !flips; ++i)
+			{
+				const Vector3u& t = tris[adjacency[i]];
+				if (t.x == c.to || t.y == c.to || t.z == c.to)
+				{
+					shared++;
+					continue; //this one disappears
+				}
+				Vector3 p[3] = { positions[representative[t.x]], positions[representative[t.y]], positions[representative[t.z]] };
+				Vector3 before = triangleNormal(p[0], p[1], p[2]);
+				if (t.x == c.from) p[0] = target;
+				if (t.y == c.from) p[1] = target;
+				if (t.z == c.from) p[2] = target;
+				Vector3 after = triangleNormal(p[0], p[1], p[2]);
+				if (before.dot(after) <= 0)
+					flips = true;
+			}
+			if (flips)
+				continue;
+
+			//every wedge of from continues in the wedge of to on its side of the collapsed edge,
+			//a wedge without one (or with two) means the collapse crosses a seam or a hard edge
+			wedge_pairs.clear();
+			bool compatible = true;
+			for (unsigned int i = adjacency_offset[c.from]; i < adjacency_offset[c.from + 1] && compatible; ++i)
+			{
+				const Vector3u& t = tris[adjacency[i]];
+				const Vector3u& w = wedges[adjacency[i]];
+				unsigned int from_wedge = 0, to_wedge = 0;
+				bool shared = false;
+				for (int k = 0; k < 3; ++k)
+				{
+					if (t.v[k] == c.from)
+						from_wedge = w.v[k];
+					else if (t.v[k] == c.to)
+					{
+						to_wedge = w.v[k];
+						shared = true;
+					}
+				}
+				if (!shared)
+					continue;
+				for (const auto& pair : wedge_pairs)
+					if (pair.first == from_wedge && pair.second != to_wedge)
+						compatible = false;
+				wedge_pairs.push_back(std::make_pair(from_wedge, to_wedge));
+			}
+			for (unsigned int i = adjacency_offset[c.from]; i < adjacency_offset[c.from + 1] && compatible; ++i)
+			{
+				const Vector3u& t = tris[adjacency[i]];
+				unsigned int from_wedge = t.x == c.from ? wedges[adjacency[i]].x : (t.y == c.from ? wedges[adjacency[i]].y : wedges[adjacency[i]].z);
+				bool found = false;
+				for (const auto& pair : wedge_pairs)
+					found = found || pair.first == from_wedge;
+				compatible = found;
+			}
+			if (!compatible)
+				continue;
+
+			for (const auto& pair : wedge_pairs)
+				wedge_to[pair.first] = pair.second;
+			collapsed_to[c.from] = c.to;
+			quadrics[c.to].add(quadrics[c.from]);
+			max_error = std::max(max_error, c.cost);
+			removed += shared;
+			num_collapses++;
+
+			unsigned int ends[2] = { c.from, c.to };
+			for (unsigned int e = 0; e < 2; ++e)
+				for (unsigned int i = adjacency_offset[ends[e]]; i < adjacency_offset[ends[e] + 1]; ++i)
+				{
+					const Vector3u& t = tris[adjacency[i]];
+					locked[t.x] = locked[t.y] = locked[t.z] = 1;
+				}
+		}
+
+		if (!num_collapses)
+			break;
+
+		//apply the collapses and remove the degenerated triangles
+		size_t num_tris = 0;
+		for (size_t i = 0; i < tris.size(); ++i)
+		{
+			Vector3u t(collapsed_to[tris[i].x], collapsed_to[tris[i].y], collapsed_to[tris[i].z]);
+			if (t.x == t.y || t.y == t.z || t.x == t.z)
+				continue;
+			const Vector3u& w = wedges[i];
+			wedges[num_tris].set(wedge_to[w.x], wedge_to[w.y], wedge_to[w.z]);
+			tris[num_tris++] = t;
+		}
+		tris.resize(num_tris);
+		wedges.resize(num_tris);
+
+		//keep the chain flat, a vertex may have been the target of another collapse later
+		for (size_t i = 0; i < num_vertices; ++i)
+			collapsed_to[i] = collapsed_to[collapsed_to[i]];
+	}
+
+	result.swap(wedges);
+
+	return (float)sqrt(max_error);
+}
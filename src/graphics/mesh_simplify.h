@@ -0,0 +1,24 @@
+/*  Mesh simplification by edge collapse using quadric error metrics (Garland & Heckbert).
+	Used at cook time to build the LOD levels of a mesh, it is too slow to be used per frame.
+*/
+
+#pragma once
+
+#include "framework/framework.h"
+#include <vector>
+
+//vertices at the same position, the wedges of a seam or hard edge share one
+struct sWeldMap
+{
+	std::vector<unsigned int> remap;			//welded vertex of every vertex
+	std::vector<unsigned int> representative;	//first vertex of every welded one
+};
+
+//built once per mesh, shared by all its draw calls and levels
+void weldPositions(const Vector3* positions, size_t num_positions, sWeldMap& weld);
+
+//simplifies the triangles (indices to positions) until target_triangles is reached or no more edges can be collapsed
+//vertices are only moved onto other existing vertices, every corner keeps a vertex with the attributes of its side of the seams,
+//collapses that would drag a seam or a hard edge are rejected (so the vertices must be welded by attributes to be simplified)
+//returns the max geometric error introduced, in the same units as the positions
+float simplifyTriangles(const Vector3* positions, const sWeldMap& weld, const std::vector<Vector3u>& triangles, size_t target_triangles, std::vector<Vector3u>& result);
@@ -0,0 +1,273 @@
+#include "occlusion_culler.h"
+#include "mesh.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	#define OCCLUSION_USE_SSE
+	#include <emmintrin.h>
+#endif
+
+long OcclusionCuller::num_occluded = 0;
+
+OcclusionCuller::OcclusionCuller()
+{
+	depth.resize(OCCLUSION_WIDTH * OCCLUSION_HEIGHT, 1.0f);
+	tiles.resize((OCCLUSION_WIDTH / OCCLUSION_TILE) * (OCCLUSION_HEIGHT / OCCLUSION_TILE), 1.0f);
+}
+
+void OcclusionCuller::begin(const Matrix44& viewprojection)
+{
+	this->viewprojection = viewprojection;
+	std::fill(depth.begin(), depth.end(), 1.0f);
+}
+
+const sOccluderMesh& OcclusionCuller::getOccluderMesh(Mesh* mesh)
+{
+	auto it = occluder_meshes.find(mesh);
+	if (it != occluder_meshes.end())
+		return it->second;
+
+	sOccluderMesh& occluder = occluder_meshes[mesh];
+
+	//the .mbin meshes only have them in VRAM, they are read from the file again
+	Mesh::sGeometry geometry;
+	if (!mesh->getGeometry(geometry))
+		return occluder;
+
+	//the first level under the budget, or the coarsest one
+	const Vector3u* triangles = nullptr;
+	size_t num_triangles = 0;
+	std::vector<Vector3u> sequential;
+	for (int lod = 0; lod < (int)mesh->getNumLODs(); ++lod)
+	{
+		if (lod > 0)
+		{
+			const sMeshLOD& level = mesh->lods[lod - 1];
+			triangles = geometry.lod_indices + level.start;
+			num_triangles = level.length;
+		}
+		else if (geometry.indices)
+		{
+			triangles = geometry.indices;
+			num_triangles = geometry.num_indices;
+		}
+		else
+		{
+			num_triangles = geometry.num_vertices / 3;
+			sequential.resize(num_triangles);
+			for (size_t i = 0; i < num_triangles; ++i)
+				sequential[i].set((unsigned int)(i * 3), (unsigned int)(i * 3 + 1), (unsigned int)(i * 3 + 2));
+			triangles = num_triangles ? &sequential[0] : nullptr;
+		}
+		if (num_triangles <= OCCLUDER_MAX_TRIANGLES)
+			break;
+	}
+
+	//keep only the vertices used
+	std::vector<int> remap(geometry.num_vertices, -1);
+	occluder.triangles.resize(num_triangles);
+	for (size_t i = 0; i < num_triangles; ++i)
+	{
+		for (int k = 0; k < 3; ++k)
+		{
+			unsigned int index = triangles[i].v[k];
+			if (remap[index] == -1)
+			{
+				remap[index] = (int)occluder.positions.size();
+				occluder.positions.push_back(geometry.getPosition(index));
+			}
+			occluder.triangles[i].v[k] = remap[index];
+		}
+	}
+
+	return occluder;
+}
+
+void OcclusionCuller::addOccluder(Mesh* mesh, const Matrix44& model)
+{
+	if (!enabled || !mesh)
+		return;
+
+	const sOccluderMesh& occluder = getOccluderMesh(mesh);
+	Matrix44 mvp = model * viewprojection;
+
+	screen_vertices.resize(occluder.positions.size());
+	for (size_t i = 0; i < occluder.positions.size(); ++i)
+		screen_vertices[i] = mvp * Vector4(occluder.positions[i], 1.0f);
+
+	for (const Vector3u& t : occluder.triangles)
+		rasterizeClipTriangle(screen_vertices[t.x], screen_vertices[t.y], screen_vertices[t.z]);
+}
+
+void OcclusionCuller::rasterizeClipTriangle(const Vector4& a, const Vector4& b, const Vector4& c)
+{
+	//trivial reject against the side planes
+	if ((a.x > a.w && b.x > b.w && c.x > c.w) || (a.x < -a.w && b.x < -b.w && c.x < -c.w) ||
+		(a.y > a.w && b.y > b.w && c.y > c.w) || (a.y < -a.w && b.y < -b.w && c.y < -c.w))
+		return;
+
+	//clip against the near plane (z > -w), up to 4 vertices
+	Vector4 input[3] = { a, b, c };
+	Vector4 polygon[4];
+	int count = 0;
+	for (int i = 0; i < 3; ++i)
+	{
+		const Vector4& p = input[i];
+		const Vector4& q = input[(i + 1) % 3];
+		float dp = p.z + p.w;
+		float dq = q.z + q.w;
+		if (dp >= 0)
+			polygon[count++] = p;
+		if ((dp >= 0) != (dq >= 0))
+		{
+			float t = dp / (dp - dq);
+			polygon[count++] = Vector4(p.x + (q.x - p.x) * t, p.y + (q.y - p.y) * t, p.z + (q.z - p.z) * t, p.w + (q.w - p.w) * t);
+		}
+	}
+	if (count < 3)
+		return;
+
+	Vector3 screen[4];
+	for (int i = 0; i < count; ++i)
+	{
+		float inv_w = 1.0f / std::max(polygon[i].w, 1e-6f);
+		screen[i].set((polygon[i].x * inv_w * 0.5f + 0.5f) * OCCLUSION_WIDTH,
+			(polygon[i].y * inv_w * 0.5f + 0.5f) * OCCLUSION_HEIGHT,
+			clamp(polygon[i].z * inv_w * 0.5f + 0.5f, 0.0f, 1.0f));
+	}
+
+	rasterizeTriangle(screen[0], screen[1], screen[2]);
+	if (count == 4)
+		rasterizeTriangle(screen[0], screen[2], screen[3]);
+}
+
+void OcclusionCuller::rasterizeTriangle(Vector3 v0, Vector3 v1, Vector3 v2)
+{
+	float area = (v1.x - v0.x) * (v2.y - v0.y) - (v2.x - v0.x) * (v1.y - v0.y);
+	if (fabs(area) < 1e-6f)
+		return;
+	if (area < 0) //both faces occlude
+	{
+		std::swap(v1, v2);
+		area = -area;
+	}
+
+	int min_x = std::max(0, (int)floor(std::min(v0.x, std::min(v1.x, v2.x))));
+	int max_x = std::min(OCCLUSION_WIDTH - 1, (int)ceil(std::max(v0.x, std::max(v1.x, v2.x))));
+	int min_y = std::max(0, (int)floor(std::min(v0.y, std::min(v1.y, v2.y))));
+	int max_y = std::min(OCCLUSION_HEIGHT - 1, (int)ceil(std::max(v0.y, std::max(v1.y, v2.y))));
+	if (min_x > max_x || min_y > max_y)
+		return;
+	min_x &= ~3; //blocks of 4 pixels
+
+	//edge functions, positive inside: E = A * x + B * y + C
+	float a0 = v0.y - v1.y, b0 = v1.x - v0.x, c0 = v0.x * v1.y - v0.y * v1.x; //v0 -> v1, weight of v2
+	float a1 = v1.y - v2.y, b1 = v2.x - v1.x, c1 = v1.x * v2.y - v1.y * v2.x; //v1 -> v2, weight of v0
+	float a2 = v2.y - v0.y, b2 = v0.x - v2.x, c2 = v2.x * v0.y - v2.y * v0.x; //v2 -> v0, weight of v1
+
+	//depth is linear in screen space
+	float inv_area = 1.0f / area;
+	float az = (a1 * v0.z + a2 * v1.z + a0 * v2.z) * inv_area;
+	float bz = (b1 * v0.z + b2 * v1.z + b0 * v2.z) * inv_area;
+	float cz = (c1 * v0.z + c2 * v1.z + c0 * v2.z) * inv_area;
+
+	for (int y = min_y; y <= max_y; ++y)
+	{
+		float py = y + 0.5f;
+		float* row = &depth[y * OCCLUSION_WIDTH];
+
+#ifdef OCCLUSION_USE_SSE
+		__m128 offsets = _mm_set_ps(3.5f, 2.5f, 1.5f, 0.5f);
+		__m128 zero = _mm_setzero_ps();
+		__m128 row0 = _mm_set1_ps(b0 * py + c0);
+		__m128 row1 = _mm_set1_ps(b1 * py + c1);
+		__m128 row2 = _mm_set1_ps(b2 * py + c2);
+		__m128 rowz = _mm_set1_ps(bz * py + cz);
+		for (int x = min_x; x <= max_x; x += 4)
+		{
+			__m128 px = _mm_add_ps(_mm_set1_ps((float)x), offsets);
+			__m128 e0 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(a0), px), row0);
+			__m128 e1 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(a1), px), row1);
+			__m128 e2 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(a2), px), row2);
+			__m128 inside = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(e0, zero), _mm_cmpge_ps(e1, zero)), _mm_cmpge_ps(e2, zero));
+			if (!_mm_movemask_ps(inside))
+				continue;
+			__m128 z = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(az), px), rowz);
+			__m128 old_depth = _mm_loadu_ps(row + x);
+			__m128 new_depth = _mm_min_ps(old_depth, z);
+			_mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, new_depth), _mm_andnot_ps(inside, old_depth)));
+		}
+#else
+		for (int x = min_x; x <= max_x; ++x)
+		{
+			float px = x + 0.5f;
+			if (a0 * px + b0 * py + c0 < 0 || a1 * px + b1 * py + c1 < 0 || a2 * px + b2 * py + c2 < 0)
+				continue;
+			float z = az * px + bz * py + cz;
+			if (z < row[x])
+				row[x] = z;
+		}
+#endif
+	}
+}
+
+void OcclusionCuller::end()
+{
+	const int tiles_x = OCCLUSION_WIDTH / OCCLUSION_TILE;
+	const int tiles_y = OCCLUSION_HEIGHT / OCCLUSION_TILE;
+
+	//farthest depth of every tile, anything in front of it may be visible
+	for (int ty = 0; ty < tiles_y; ++ty)
+		for (int tx = 0; tx < tiles_x; ++tx)
+		{
+			float max_depth = 0.0f;
+			for (int y = 0; y < OCCLUSION_TILE; ++y)
+			{
+				const float* row = &depth[(ty * OCCLUSION_TILE + y) * OCCLUSION_WIDTH + tx * OCCLUSION_TILE];
+				for (int x = 0; x < OCCLUSION_TILE; ++x)
+					max_depth = std::max(max_depth, row[x]);
+			}
+			tiles[ty * tiles_x + tx] = max_depth;
+		}
+}
+
+bool OcclusionCuller::testBox(const BoundingBox& box) const
+{
+	if (!enabled)
+		return true;
+
+	float min_x = 1e10f, min_y = 1e10f, max_x = -1e10f, max_y = -1e10f;
+	float min_z = 1.0f;
+	for (int i = 0; i < 8; ++i)
+	{
+		Vector3 corner = box.center + box.halfsize * Vector3(i & 1 ? 1.0f : -1.0f, i & 2 ? 1.0f : -1.0f, i & 4 ? 1.0f : -1.0f);
+		Vector4 clip = viewprojection * Vector4(corner, 1.0f);
+		if (clip.z < -clip.w || clip.w <= 1e-6f)
+			return true; //crosses the near plane
+		float inv_w = 1.0f / clip.w;
+		float x = (clip.x * inv_w * 0.5f + 0.5f) * OCCLUSION_WIDTH;
+		float y = (clip.y * inv_w * 0.5f + 0.5f) * OCCLUSION_HEIGHT;
+		min_x = std::min(min_x, x);
+		max_x = std::max(max_x, x);
+		min_y = std::min(min_y, y);
+		max_y = std::max(max_y, y);
+		min_z = std::min(min_z, clip.z * inv_w * 0.5f + 0.5f);
+	}
+
+	int x0 = std::max(0, (int)floor(min_x));
+	int x1 = std::min(OCCLUSION_WIDTH - 1, (int)floor(max_x));
+	int y0 = std::max(0, (int)floor(min_y));
+	int y1 = std::min(OCCLUSION_HEIGHT - 1, (int)floor(max_y));
+	if (x0 > x1 || y0 > y1)
+		return true; //out of the screen, the frustum test decides
+
+	const int tiles_x = OCCLUSION_WIDTH / OCCLUSION_TILE;
+	for (int ty = y0 / OCCLUSION_TILE; ty <= y1 / OCCLUSION_TILE; ++ty)
+		for (int tx = x0 / OCCLUSION_TILE; tx <= x1 / OCCLUSION_TILE; ++tx)
+			if (min_z < tiles[ty * tiles_x + tx])
+				return true;
+
+	return false;
+}
@@ -0,0 +1,58 @@
+/*  CPU occlusion culling: a few big occluders are rasterized every frame in a small depth buffer
+	(SSE when available) and the boxes of the entities are tested against the max depth of its tiles.
+	It does not use the GPU at all, so it gives the same result with or without a context.
+*/
+
+#pragma once
+
+#include "framework/framework.h"
+#include <vector>
+#include <map>
+
+class Mesh;
+
+#define OCCLUSION_WIDTH 256
+#define OCCLUSION_HEIGHT 128
+#define OCCLUSION_TILE 8				//pixels per side of the tiles of the hierarchical buffer
+#define OCCLUDER_MAX_TRIANGLES 2048		//the coarsest LOD under this budget is used as occluder
+#define OCCLUDER_MIN_RADIUS 20.0f		//colliders bigger than this become occluders automatically
+#define OCCLUDER_MAX_COUNT 16			//occluders rasterized per frame, the biggest on screen
+
+//geometry used to rasterize a mesh as occluder, only the positions used by its triangles
+struct sOccluderMesh
+{
+	std::vector<Vector3> positions;
+	std::vector<Vector3u> triangles;
+};
+
+class OcclusionCuller
+{
+public:
+	static long num_occluded; //stats, reset every time the GPU stats are shown
+
+	bool enabled = true;
+
+	OcclusionCuller();
+
+	//clears the depth buffer
+	void begin(const Matrix44& viewprojection);
+	void addOccluder(Mesh* mesh, const Matrix44& model);
+	//builds the max depth of every tile, call it before testing
+	void end();
+
+	//false if the box (in world space) is completely hidden by the occluders
+	bool testBox(const BoundingBox& box) const;
+
+	const float* getDepthBuffer() const { return &depth[0]; } //for debug, 0 is near and 1 far
+
+private:
+	Matrix44 viewprojection;
+	std::vector<float> depth;
+	std::vector<float> tiles;
+	std::vector<Vector4> screen_vertices; //reused between occluders
+	std::map<Mesh*, sOccluderMesh> occluder_meshes;
+
+	const sOccluderMesh& getOccluderMesh(Mesh* mesh);
+	void rasterizeClipTriangle(const Vector4& a, const Vector4& b, const Vector4& c);
+	void rasterizeTriangle(Vector3 v0, Vector3 v1, Vector3 v2); //in pixels, z from 0 to 1
+};
@@ -0,0 +1,344 @@
+#include "render_queue.h"
+
+#include "mesh.h"
+#include "shader.h"
+#include "texture.h"
+#include "material.h"
+#include "uniform_buffer.h"
+#include "occlusion_culler.h"
+#include "static_batch.h"
+#include "animation_texture.h"
+#include "framework/camera.h"
+#include "framework/animation.h"
+
+#include <algorithm>
+
+long RenderQueue::num_shader_changes = 0;
+long RenderQueue::num_texture_changes = 0;
+long RenderQueue::num_mesh_changes = 0;
+
+static int countBits(uint8 mask)
+{
+	int count = 0;
+	for (; mask; mask &= mask - 1)
+		count++;
+	return count;
+}
+
+static int countTrailingZeros(uint8 mask)
+{
+	int count = 0;
+	while (mask && !(mask & 1)) {
+		mask >>= 1;
+		count++;
+	}
+	return count;
+}
+
+void RenderQueue::begin(Camera* camera)
+{
+	this->camera = camera;
+	occlusion = nullptr;
+	batch = nullptr;
+	num_occluded = 0;
+	draw_calls.clear();
+	impostor_draws.clear();
+	crowd_draws.clear();
+}
+
+bool RenderQueue::isVisible(Mesh* mesh, const Matrix44& model, bool test_occlusion)
+{
+	if (!mesh || !camera)
+		return true;
+
+	BoundingBox box = transformBoundingBox(model, mesh->box);
+	if (camera->testBoxInFrustum(box.center, box.halfsize) == CLIP_OUTSIDE)
+		return false;
+
+	if (test_occlusion && occlusion && !occlusion->testBox(box))
+	{
+		num_occluded++;
+		return false;
+	}
+	return true;
+}
+
+uint64_t RenderQueue::computeSortKey(Mesh* mesh, const Material* material, float distance)
+{
+	//GL names are small integers, they work as compact ids for the key
+	uint64_t shader_id = material->shader ? material->shader->getProgram() : 0;
+	uint64_t texture_id = material->diffuse ? material->diffuse->texture_id : 0;
+	uint64_t mesh_id = mesh->quantized_vbo_id ? mesh->quantized_vbo_id : (mesh->interleaved_vbo_id ? mesh->interleaved_vbo_id : mesh->vertices_vbo_id);
+	uint64_t depth = (uint64_t)clamp(distance, 0.0f, 65535.0f); //front to back inside the same state
+
+	return ((shader_id & 0xFFFF) << 48) | ((texture_id & 0xFFFF) << 32) | ((mesh_id & 0xFFFF) << 16) | depth;
+}
+
+void RenderQueue::add(Mesh* mesh, const Material* material, const Matrix44& model, Skeleton* skeleton, int lod)
+{
+	if (!mesh || !material || !material->shader)
+		return;
+
+	float distance = camera ? camera->eye.distance(model.getTranslation()) : 0.0f;
+
+	sDrawCall& dc = draw_calls.emplace_back();
+	dc.sort_key = computeSortKey(mesh, material, distance);
+	dc.mesh = mesh;
+	dc.material = material;
+	dc.skeleton = skeleton;
+	dc.lod = lod;
+	dc.item = -1;
+	dc.view_mask = 0;
+	dc.model = model;
+}
+
+void RenderQueue::build(const std::vector<sRenderItem>& items, int view_id)
+{
+	assert(view_id < RENDER_MAX_VIEWS);
+	for (size_t i = 0; i < items.size(); ++i)
+	{
+		const sRenderItem& item = items[i];
+		if (!item.skeleton && !isVisible(item.mesh, item.model, item.test_occlusion))
+			continue;
+
+		//crowds skip the queue, the clip is sampled by their vertex shader
+		if (item.crowd)
+		{
+			crowd_draws.push_back({ item.crowd, item.material, item.crowd->getInstance(item.model) });
+			continue;
+		}
+
+		//far instances are quads, the mesh stays while the quad fades in
+		if (item.impostor)
+		{
+			float fade = item.impostor->computeFade(camera, item.model);
+			if (fade > 0.0f)
+				impostor_draws.push_back({ item.impostor, item.impostor->getInstance(item.model, fade) });
+			if (fade >= 1.0f)
+				continue;
+		}
+
+		uint8& lod = item.lod_levels[view_id];
+		lod = item.mesh->selectLOD(camera, item.model, lod);
+		size_t num_draw_calls = draw_calls.size();
+		add(item.mesh, item.material, item.model, item.skeleton, lod);
+		if (draw_calls.size() > num_draw_calls)
+		{
+			draw_calls.back().item = (int)i;
+			draw_calls.back().view_mask = 1 << view_id;
+		}
+	}
+}
+
+bool RenderQueue::supportsMultiview(const sDrawCall& dc)
+{
+	//skinned meshes upload their bones per draw, clustered ones cull them against the camera of their view,
+	//the rest needs the per draw and views blocks
+	Shader* shader = dc.material->shader;
+	return !dc.skeleton && dc.item != -1 && dc.mesh->clusters.empty() && shader->hasUniformBlock(UBLOCK_VIEWS) && shader->hasUniformBlock(UBLOCK_OBJECT);
+}
+
+void RenderQueue::mergeViews(RenderQueue** queues, int num_views, size_t num_items)
+{
+	assert(num_views > 0);
+	camera = queues[0]->camera;
+	occlusion = nullptr;
+	batch = nullptr; //instanced per view, not compatible with the draw ids of the batch
+	multiview = true;
+	draw_calls.clear();
+	impostor_draws.clear();
+	crowd_draws.clear();
+	merged_draws.assign(num_items, -1);
+
+	for (int v = 0; v < num_views; ++v)
+	{
+		std::vector<sDrawCall>& view_draw_calls = queues[v]->draw_calls;
+		size_t num_kept = 0;
+		for (size_t i = 0; i < view_draw_calls.size(); ++i)
+		{
+			const sDrawCall& dc = view_draw_calls[i];
+			if (!supportsMultiview(dc))
+			{
+				view_draw_calls[num_kept++] = dc;
+				continue;
+			}
+			int& index = merged_draws[dc.item];
+			if (index == -1)
+			{
+				index = (int)draw_calls.size();
+				draw_calls.push_back(dc);
+			}
+			else
+			{
+				//the finest level of all the views, depth from the first one
+				sDrawCall& merged_dc = draw_calls[index];
+				merged_dc.view_mask |= dc.view_mask;
+				merged_dc.lod = std::min(merged_dc.lod, dc.lod);
+			}
+		}
+		view_draw_calls.resize(num_kept);
+	}
+
+	//instances go to consecutive views, split masks with gaps (only possible with more than two views)
+	size_t num_merged = draw_calls.size();
+	for (size_t i = 0; i < num_merged; ++i)
+	{
+		uint8 mask = draw_calls[i].view_mask;
+		uint8 first_run = mask & ~(mask + (mask & -mask)); //lowest run of consecutive bits
+		if (first_run == mask)
+			continue;
+		draw_calls[i].view_mask = first_run;
+		sDrawCall rest = draw_calls[i];
+		rest.view_mask = mask & ~first_run;
+		draw_calls.push_back(rest);
+		num_merged++; //the rest may need another split
+	}
+}
+
+void RenderQueue::flush()
+{
+	assert(camera && "call begin before flushing the queue");
+
+	std::sort(draw_calls.begin(), draw_calls.end(), [](const sDrawCall& a, const sDrawCall& b) {
+		return a.sort_key < b.sort_key;
+	});
+
+	//per draw data of the whole queue goes in a single upload, each draw binds its range
+	size_t object_stride = 0;
+	size_t object_offset = 0;
+	bool use_object_block = false;
+	for (const sDrawCall& dc : draw_calls)
+		if (dc.material->shader->hasUniformBlock(UBLOCK_OBJECT)) {
+			use_object_block = true;
+			break;
+		}
+	if (use_object_block)
+	{
+		size_t alignment = UniformBuffer::getOffsetAlignment();
+		object_stride = ((sizeof(sObjectBlock) + alignment - 1) / alignment) * alignment;
+		object_blocks.resize(object_stride * draw_calls.size());
+		for (size_t i = 0; i < draw_calls.size(); ++i)
+		{
+			sObjectBlock* block = (sObjectBlock*)&object_blocks[i * object_stride];
+			block->model = draw_calls[i].model;
+			block->color = draw_calls[i].material->color;
+			block->first_view = multiview ? countTrailingZeros(draw_calls[i].view_mask) : 0;
+		}
+		object_offset = UniformBuffer::Get(UBLOCK_OBJECT)->stream(object_blocks.data(), object_blocks.size());
+	}
+
+	Shader* current_shader = nullptr;
+	Texture* current_texture = nullptr;
+	Mesh* current_mesh = nullptr;
+	Vector4 current_color;
+
+	for (size_t i = 0; i < draw_calls.size(); ++i)
+	{
+		const sDrawCall& dc = draw_calls[i];
+		const Material* material = dc.material;
+		Shader* shader = material->shader;
+		bool has_object_block = shader->hasUniformBlock(UBLOCK_OBJECT);
+		bool batched = batch && !dc.skeleton && batch->contains(dc.mesh) && StaticBatch::supportsShader(shader);
+
+		//a run of batched draws ends with any state change or an unbatched draw
+		if (batch && batch->hasPending() && (!batched || shader != current_shader || (material->diffuse && material->diffuse != current_texture)))
+			batch->flush(current_shader);
+
+		//per shader state, uploaded once for all the draws using it
+		if (shader != current_shader)
+		{
+			shader->enable();
+			if (!shader->hasUniformBlock(UBLOCK_CAMERA))
+				shader->setUniform(UNIFORM("u_viewprojection"), camera->viewprojection_matrix);
+			if (!has_object_block)
+				shader->setUniform(UNIFORM("u_color"), material->color);
+			current_shader = shader;
+			current_texture = nullptr;
+			current_color = material->color;
+			num_shader_changes++;
+		}
+
+		if (material->diffuse && material->diffuse != current_texture)
+		{
+			shader->setUniform(UNIFORM("u_texture"), material->diffuse, 0);
+			current_texture = material->diffuse;
+			num_texture_changes++;
+		}
+
+		if (!has_object_block && (material->color.x != current_color.x || material->color.y != current_color.y || material->color.z != current_color.z || material->color.w != current_color.w))
+		{
+			shader->setUniform(UNIFORM("u_color"), material->color);
+			current_color = material->color;
+		}
+
+		if (dc.mesh != current_mesh)
+		{
+			current_mesh = dc.mesh;
+			num_mesh_changes++;
+		}
+
+		if (batched)
+		{
+			batch->add(dc.mesh, dc.lod, dc.model, material->color);
+			continue;
+		}
+
+		if (has_object_block)
+			UniformBuffer::Get(UBLOCK_OBJECT)->bindRange(object_offset + i * object_stride, sizeof(sObjectBlock));
+		else
+			shader->setUniform(UNIFORM("u_model"), dc.model);
+
+		//the merged queue has the camera of the first view only
+		if (!dc.mesh->clusters.empty())
+			Mesh::setClusterView(multiview || dc.skeleton ? nullptr : camera, dc.model, cull_backfaces);
+
+		if (dc.skeleton)
+			dc.mesh->renderAnimated(GL_TRIANGLES, dc.skeleton, dc.lod);
+		else if (multiview && dc.view_mask & (dc.view_mask - 1))
+			dc.mesh->render(GL_TRIANGLES, -1, countBits(dc.view_mask), dc.lod);
+		else
+			dc.mesh->render(GL_TRIANGLES, -1, 0, dc.lod);
+
+		//multi-material meshes bind their own textures
+		if (!dc.mesh->materials.empty())
+			current_texture = nullptr;
+	}
+
+	if (batch && batch->hasPending())
+		batch->flush(current_shader);
+	Mesh::setClusterView(nullptr, Matrix44());
+
+	if (current_shader)
+		current_shader->disable();
+
+	//one instanced draw per impostor
+	std::sort(impostor_draws.begin(), impostor_draws.end(), [](const sImpostorDraw& a, const sImpostorDraw& b) {
+		return a.impostor < b.impostor;
+	});
+	for (size_t i = 0; i < impostor_draws.size();)
+	{
+		Impostor* impostor = impostor_draws[i].impostor;
+		impostor_instances.clear();
+		for (; i < impostor_draws.size() && impostor_draws[i].impostor == impostor; ++i)
+			impostor_instances.push_back(impostor_draws[i].instance);
+		impostor->render(&impostor_instances[0], impostor_instances.size());
+	}
+
+	//one instanced draw per clip and material
+	std::sort(crowd_draws.begin(), crowd_draws.end(), [](const sCrowdDraw& a, const sCrowdDraw& b) {
+		return a.crowd != b.crowd ? a.crowd < b.crowd : a.material < b.material;
+	});
+	for (size_t i = 0; i < crowd_draws.size();)
+	{
+		AnimationTexture* crowd = crowd_draws[i].crowd;
+		const Material* material = crowd_draws[i].material;
+		crowd_instances.clear();
+		for (; i < crowd_draws.size() && crowd_draws[i].crowd == crowd && crowd_draws[i].material == material; ++i)
+			crowd_instances.push_back(crowd_draws[i].instance);
+		crowd->render(&crowd_instances[0], crowd_instances.size(), material);
+	}
+
+	draw_calls.clear();
+	impostor_draws.clear();
+	crowd_draws.clear();
+}
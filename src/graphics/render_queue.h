@@ -0,0 +1,103 @@
+/*  Render queue: the scene traversal only emits compact draw calls, which are sorted
+	by render state (shader, texture, mesh) and submitted in a single pass to minimize
+	program and binding changes.
+*/
+
+#pragma once
+
+#include "framework/includes.h"
+#include "framework/framework.h"
+#include "impostor.h"
+#include "mesh.h"
+#include <vector>
+
+class Mesh;
+class Material;
+class Camera;
+class Skeleton;
+class OcclusionCuller;
+class StaticBatch;
+class AnimationTexture;
+
+#define RENDER_MAX_VIEWS 4		//views (split screen) culled and rendered per frame
+
+//an instance found by the scene traversal, shared by all the views of the frame
+struct sRenderItem {
+	Mesh* mesh;
+	const Material* material;
+	Skeleton* skeleton;			//only for animated meshes, they are never culled
+	Matrix44 model;
+	bool test_occlusion;		//false for the occluders themselves
+	uint8* lod_levels;			//RENDER_MAX_VIEWS entries owned by the entity, last level used by each view
+	Impostor* impostor;			//optional, drawn instead of the mesh when the instance is small on screen
+	AnimationTexture* crowd;	//optional, the instance is animated on the GPU with the baked clip
+};
+
+//an instance drawn as impostor, all the ones of the same impostor go in a single draw
+struct sImpostorDraw {
+	Impostor* impostor;
+	sImpostorInstance instance;
+};
+
+//an instance of a crowd, all the ones of the same clip and material go in a single draw
+struct sCrowdDraw {
+	AnimationTexture* crowd;
+	const Material* material;
+	sInstanceData instance;
+};
+
+//a single draw of a view, built from a render item
+struct sDrawCall {
+	uint64_t sort_key;			//shader | texture | mesh | depth
+	Mesh* mesh;
+	const Material* material;
+	Skeleton* skeleton;			//only for animated meshes
+	int lod;					//0 is the full detail mesh
+	int item;					//index in the render items, -1 if added directly
+	uint8 view_mask;			//multiview queues: views drawing it, consecutive bits
+	Matrix44 model;
+};
+
+class RenderQueue
+{
+public:
+	//stats, reset every time the GPU stats are shown
+	static long num_shader_changes;
+	static long num_texture_changes;
+	static long num_mesh_changes;
+
+	Camera* camera = nullptr;
+	OcclusionCuller* occlusion = nullptr; //optional, set after begin when there are occluders
+	StaticBatch* batch = nullptr;		//optional, static meshes in it are drawn with multi draw indirect
+	std::vector<sDrawCall> draw_calls;
+	std::vector<uint8> object_blocks;	//per draw uniform block data, reused every frame
+	long num_occluded = 0;				//added to the culler stats once the views are built
+	bool multiview = false;				//every draw is instanced once per view in its view_mask
+	bool cull_backfaces = false;		//set by the owner when it draws with GL_CULL_FACE, GL_BACK and GL_CCW, the clusters facing away are skipped
+	std::vector<int> merged_draws;		//draw of every render item while merging the views
+	std::vector<sImpostorDraw> impostor_draws;	//far instances, drawn after the meshes
+	std::vector<sImpostorInstance> impostor_instances; //scratch for the instanced draws
+	std::vector<sCrowdDraw> crowd_draws;		//animated instances, drawn after the meshes
+	std::vector<sInstanceData> crowd_instances;	//scratch for the instanced draws
+
+	//clears the queue and sets the camera used to sort and render
+	void begin(Camera* camera);
+
+	//frustum and occlusion test of the mesh box, call it before add to skip hidden instances
+	bool isVisible(Mesh* mesh, const Matrix44& model, bool test_occlusion = true);
+
+	void add(Mesh* mesh, const Material* material, const Matrix44& model, Skeleton* skeleton = nullptr, int lod = 0);
+
+	//culls the items and picks their level of detail for this view, safe to call from a worker thread
+	void build(const std::vector<sRenderItem>& items, int view_id);
+
+	//moves the draws that can be rendered in a single pass from the queues of the views to this one,
+	//an instance visible in several views becomes a single draw
+	void mergeViews(RenderQueue** queues, int num_views, size_t num_items);
+
+	//sorts by state and renders all the draw calls
+	void flush();
+
+	static uint64_t computeSortKey(Mesh* mesh, const Material* material, float distance);
+	static bool supportsMultiview(const sDrawCall& dc);
+};
@@ -1,5 +1,6 @@
 #include "shader.h"
 #include <cassert>
+#include <cstring>
 #include <iostream>
 #include "framework/utils.h"
 #include <algorithm> 
@@ -8,6 +9,8 @@
 #include <locale>
 
 #include "texture.h"
+#include "uniform_buffer.h"
+#include "static_batch.h"
 
 std::string Shader::s_shader_atlas_filename;
 std::map<std::string, std::string> Shader::s_shaders_atlas;
@@ -55,6 +58,31 @@ REGISTER_GLEXT(void, glUniformMatrix4fv, GLint location, GLsizei count, GLboolea
 
 std::map<std::string, Shader*> Shader::s_Shaders;
 bool Shader::s_ready = false;
+
+UniformHandle::UniformHandle(const char* name, uint32_t hash)
+{
+	this->name = name;
+	this->hash = hash;
+
+	//the same name used in different places shares the slot
+	std::vector<sSlot>& slots = getSlots();
+	auto it = std::find_if(slots.begin(), slots.end(), [hash](const sSlot& s) { return s.hash == hash; });
+	slot = (int)(it - slots.begin());
+	if (it == slots.end())
+		slots.push_back({ hash, name });
+	else if (strcmp(it->name, name) != 0)
+	{
+		std::cout << "[ERROR] Uniform names with the same hash: " << it->name << " " << name << std::endl;
+		assert(0 && "two uniform names with the same hash, rename one of them");
+	}
+}
+
+std::vector<UniformHandle::sSlot>& UniformHandle::getSlots()
+{
+	static std::vector<sSlot> slots;
+	return slots;
+}
+
 Shader* Shader::current = NULL;
 
 Shader::Shader()
@@ -63,6 +91,8 @@ Shader::Shader()
 		Shader::init();
 	compiled = false;
 	from_atlas = false;
+	uniform_blocks = 0;
+	attrib_signature = 0;
 }
 
 Shader::~Shader()
@@ -92,6 +122,14 @@ bool Shader::load(const std::string& vsf, const std::string& psf, const char* ma
 	if (!readFile(vsf, vsm) || !readFile(psf, psm))
 		return false;
 
+	//shared uniform blocks
+	replace(vsm, "#include \"uniform_blocks\"", UNIFORM_BLOCKS_GLSL);
+	replace(psm, "#include \"uniform_blocks\"", UNIFORM_BLOCKS_GLSL);
+	replace(vsm, "#include \"multiview\"", MULTIVIEW_GLSL);
+	replace(vsm, "#include \"batching\"", BATCHING_GLSL);
+	replace(vsm, "#include \"quantization\"", QUANTIZATION_GLSL);
+	replace(vsm, "#include \"skinning\"", SKINNING_GLSL);
+
 	//printf("Vertex shader from memory:\n%s\n", vsm.c_str());
 	//printf("Fragment shader from memory:\n%s\n", psm.c_str());
 	if (macros)
@@ -170,6 +208,11 @@ bool Shader::LoadAtlas(const char* filename)
 
 	//separate subfiles
 	s_shader_atlas_filename = filename;
+	s_shaders_atlas["uniform_blocks"] = UNIFORM_BLOCKS_GLSL;
+	s_shaders_atlas["multiview"] = MULTIVIEW_GLSL;
+	s_shaders_atlas["batching"] = BATCHING_GLSL;
+	s_shaders_atlas["quantization"] = QUANTIZATION_GLSL;
+	s_shaders_atlas["skinning"] = SKINNING_GLSL;
 	std::vector<std::string> lines = tokenize(content, "\n");
 	std::string subfile_name = "";
 	std::string subfile_content = "";
@@ -336,6 +379,9 @@ bool Shader::compileFromMemory(const std::string& vsm, const std::string& psm)
 	validate();
 #endif
 
+	buildLocationTables();
+	bindUniformBlocks();
+
 	compiled = true;
 
 	return true;
@@ -344,11 +390,10 @@ bool Shader::compileFromMemory(const std::string& vsm, const std::string& psm)
 bool Shader::validate()
 {
 	glValidateProgram(program);
-	assert(glGetError() == GL_NO_ERROR);
 
+	//the status tells, an earlier unrelated GL error must not
 	GLint validated = 0;
-	glGetProgramiv(program, GL_LINK_STATUS, &validated);
-	assert(glGetError() == GL_NO_ERROR);
+	glGetProgramiv(program, GL_VALIDATE_STATUS, &validated);
 
 	if (!validated)
 	{
@@ -360,6 +405,95 @@ bool Shader::validate()
 	return true;
 }
 
+void Shader::bindUniformBlocks()
+{
+	uniform_blocks = 0;
+	if (!UniformBuffer::isSupported())
+		return;
+
+	for (int i = 0; i < UBLOCK_COUNT; ++i)
+	{
+		GLuint index = glGetUniformBlockIndex(program, UniformBuffer::block_names[i]);
+		if (index == GL_INVALID_INDEX)
+			continue;
+		glUniformBlockBinding(program, index, i);
+		uniform_blocks |= 1 << i;
+	}
+}
+
+void Shader::buildLocationTables()
+{
+	locations.clear();
+	attrib_locations.clear();
+	slot_locations.clear();
+
+	GLint count = 0;
+	GLint max_length = 0;
+	GLint size = 0;
+	GLenum type = 0;
+
+	std::vector<std::string> uniform_names, attrib_names; //only to report the collisions
+
+	glGetProgramiv(program, GL_ACTIVE_UNIFORM_MAX_LENGTH, &max_length);
+	std::string name(max_length + 1, '\0');
+	glGetProgramiv(program, GL_ACTIVE_UNIFORMS, &count);
+	for (int i = 0; i < count; ++i)
+	{
+		GLsizei length = 0;
+		glGetActiveUniform(program, i, (GLsizei)name.size(), &length, &size, &type, &name[0]);
+		std::string varname = name.substr(0, length);
+		if (varname.size() > 3 && varname.compare(varname.size() - 3, 3, "[0]") == 0)
+			varname.resize(varname.size() - 3); //arrays are set using the base name
+		GLint loc = glGetUniformLocation(program, varname.c_str());
+		if (loc != -1) //uniforms inside blocks have no location
+		{
+			locations.push_back({ hashShaderName(varname.c_str()), loc });
+			uniform_names.push_back(varname);
+		}
+	}
+
+	glGetProgramiv(program, GL_ACTIVE_ATTRIBUTE_MAX_LENGTH, &max_length);
+	name.assign(max_length + 1, '\0');
+	glGetProgramiv(program, GL_ACTIVE_ATTRIBUTES, &count);
+	for (int i = 0; i < count; ++i)
+	{
+		GLsizei length = 0;
+		glGetActiveAttrib(program, i, (GLsizei)name.size(), &length, &size, &type, &name[0]);
+		std::string varname = name.substr(0, length);
+		GLint loc = glGetAttribLocation(program, varname.c_str());
+		if (loc != -1) //built-in attributes
+		{
+			attrib_locations.push_back({ hashShaderName(varname.c_str()), loc });
+			attrib_names.push_back(varname);
+		}
+	}
+
+	std::sort(locations.begin(), locations.end());
+	std::sort(attrib_locations.begin(), attrib_locations.end());
+	checkHashCollisions(locations, uniform_names);
+	checkHashCollisions(attrib_locations, attrib_names);
+
+	//programs with the same signature can share the vertex array objects of a mesh
+	attrib_signature = 2166136261u;
+	for (const sLocation& attrib : attrib_locations)
+		attrib_signature = (attrib_signature ^ (attrib.hash + (uint32_t)attrib.location)) * 16777619u;
+	assert(glGetError() == GL_NO_ERROR);
+}
+
+void Shader::checkHashCollisions(const loctable& table, const std::vector<std::string>& names)
+{
+	//two names with the same hash would share a location
+	auto it = std::adjacent_find(table.begin(), table.end(), [](const sLocation& a, const sLocation& b) { return a.hash == b.hash; });
+	if (it == table.end())
+		return;
+	std::cout << "[ERROR] Shader names with the same hash:";
+	for (const std::string& name : names)
+		if (hashShaderName(name.c_str()) == it->hash)
+			std::cout << " " << name;
+	std::cout << std::endl;
+	assert(0 && "two shader names with the same hash, rename one of them");
+}
+
 bool Shader::createVertexShaderObject(const std::string& shader)
 {
 	return createShaderObject(GL_VERTEX_SHADER, vs, shader);
@@ -432,6 +566,10 @@ void Shader::release()
 	}
 
 	locations.clear();
+	attrib_locations.clear();
+	slot_locations.clear();
+	uniform_blocks = 0;
+	attrib_signature = 0;
 
 	compiled = false;
 }
@@ -510,55 +648,32 @@ void Shader::saveProgramInfoLog(GLuint obj)
 	}
 }
 
-GLint Shader::getLocation(const char* varname, loctable* table)
+GLint Shader::findLocation(const loctable& table, uint32_t hash)
 {
-	if (varname == 0 || table == 0)
-		return 0;
-
-	GLint loc = 0;
-	loctable* locs = table;
-
-	loctable::iterator cur = locs->find(varname);
-
-	if (cur == locs->end()) //not found in the locations table
-	{
-		loc = glGetUniformLocation(program, varname);
-		if (loc == -1)
-		{
-			return -1;
-		}
+	//tables are tiny, a binary search on a flat array is enough
+	auto it = std::lower_bound(table.begin(), table.end(), sLocation{ hash, 0 });
+	if (it == table.end() || it->hash != hash)
+		return -1;
+	return it->location;
+}
 
-		//insert the new value
-		locs->insert(loctable::value_type(varname, loc));
-	}
-	else //found in the table
-	{
-		loc = (*cur).second;
-	}
-	return loc;
+GLint Shader::resolveLocation(const UniformHandle& u)
+{
+	//handles created after the program was linked grow the table
+	if (u.slot >= (int)slot_locations.size())
+		slot_locations.resize(UniformHandle::getSlots().size(), -2);
+	slot_locations[u.slot] = findLocation(locations, u.hash);
+	return slot_locations[u.slot];
 }
 
 int Shader::getAttribLocation(const char* varname)
 {
-	int loc = glGetAttribLocation(program, varname);
-	if (loc == -1)
-	{
-		return loc;
-	}
-	assert(glGetError() == GL_NO_ERROR);
-
-	return loc;
+	return findLocation(attrib_locations, hashShaderName(varname));
 }
 
 int Shader::getUniformLocation(const char* varname)
 {
-	int loc = getLocation(varname, &locations);
-	if (loc == -1)
-	{
-		return loc;
-	}
-	assert(glGetError() == GL_NO_ERROR);
-	return loc;
+	return getLocation(varname);
 }
 
 void Shader::setTexture(const char* varname, Texture* tex, int slot)
@@ -569,6 +684,15 @@ void Shader::setTexture(const char* varname, Texture* tex, int slot)
 	glActiveTexture(GL_TEXTURE0 + slot);
 }
 
+void Shader::setUniform(const UniformHandle& u, Texture* tex, int slot)
+{
+	assert(current == this);
+	glActiveTexture(GL_TEXTURE0 + slot);
+	glBindTexture(tex->texture_type, tex->texture_id);
+	setUniform(u, slot);
+	glActiveTexture(GL_TEXTURE0 + slot);
+}
+
 /*
 void Shader::setTexture(const char* varname, unsigned int tex)
 {
@@ -582,7 +706,7 @@ void Shader::setTexture(const char* varname, unsigned int tex)
 
 void Shader::setUniform1(const char* varname, bool input1)
 {
-	GLint loc = getLocation(varname, &locations);
+	GLint loc = getLocation(varname);
 	CHECK_SHADER_VAR(loc, varname);
 	glUniform1i(loc, input1);
 	assert(glGetError() == GL_NO_ERROR);
@@ -590,7 +714,7 @@ void Shader::setUniform1(const char* varname, bool input1)
 
 void Shader::setUniform1(const char* varname, int input1)
 {
-	GLint loc = getLocation(varname, &locations);
+	GLint loc = getLocation(varname);
 	CHECK_SHADER_VAR(loc, varname);
 	glUniform1i(loc, input1);
 	assert(glGetError() == GL_NO_ERROR);
@@ -598,7 +722,7 @@ void Shader::setUniform1(const char* varname, int input1)
 
 void Shader::setUniform2(const char* varname, int input1, int input2)
 {
-	GLint loc = getLocation(varname, &locations);
+	GLint loc = getLocation(varname);
 	CHECK_SHADER_VAR(loc, varname);
 	glUniform2i(loc, input1, input2);
 	assert(glGetError() == GL_NO_ERROR);
@@ -606,7 +730,7 @@ void Shader::setUniform2(const char* varname, int input1, int input2)
 
 void Shader::setUniform3(const char* varname, int input1, int input2, int input3)
 {
-	GLint loc = getLocation(varname, &locations);
+	GLint loc = getLocation(varname);
 	CHECK_SHADER_VAR(loc, varname);
 	glUniform3i(loc, input1, input2, input3);
 	assert(glGetError() == GL_NO_ERROR);
@@ -614,7 +738,7 @@ void Shader::setUniform3(const char* varname, int input1, int input2, int input3
 
 void Shader::setUniform4(const char* varname, const int input1, const int input2, const int input3, const int input4)
 {
-	GLint loc = getLocation(varname, &locations);
+	GLint loc = getLocation(varname);
 	CHECK_SHADER_VAR(loc, varname);
 	glUniform4i(loc, input1, input2, input3, input4);
 	assert(glGetError() == GL_NO_ERROR);
@@ -622,7 +746,7 @@ void Shader::setUniform4(const char* varname, const int input1, const int input2
 
 void Shader::setUniform1Array(const char* varname, const int* input, const int count)
 {
-	GLint loc = getLocation(varname, &locations);
+	GLint loc = getLocation(varname);
 	CHECK_SHADER_VAR(loc, varname);
 	glUniform1iv(loc, count, input);
 	assert(glGetError() == GL_NO_ERROR);
@@ -630,7 +754,7 @@ void Shader::setUniform1Array(const char* varname, const int* input, const int c
 
 void Shader::setUniform2Array(const char* varname, const int* input, const int count)
 {
-	GLint loc = getLocation(varname, &locations);
+	GLint loc = getLocation(varname);
 	CHECK_SHADER_VAR(loc, varname);
 	glUniform2iv(loc, count, input);
 	assert(glGetError() == GL_NO_ERROR);
@@ -638,7 +762,7 @@ void Shader::setUniform2Array(const char* varname, const int* input, const int c
 
 void Shader::setUniform3Array(const char* varname, const int* input, const int count)
 {
-	GLint loc = getLocation(varname, &locations);
+	GLint loc = getLocation(varname);
 	CHECK_SHADER_VAR(loc, varname);
 	glUniform3iv(loc, count, input);
 	assert(glGetError() == GL_NO_ERROR);
@@ -646,7 +770,7 @@ void Shader::setUniform3Array(const char* varname, const int* input, const int c
 
 void Shader::setUniform4Array(const char* varname, const int* input, const int count)
 {
-	GLint loc = getLocation(varname, &locations);
+	GLint loc = getLocation(varname);
 	CHECK_SHADER_VAR(loc, varname);
 	glUniform4iv(loc, count, input);
 	assert(glGetError() == GL_NO_ERROR);
@@ -654,7 +778,7 @@ void Shader::setUniform4Array(const char* varname, const int* input, const int c
 
 void Shader::setUniform1(const char* varname, const float input1)
 {
-	GLint loc = getLocation(varname, &locations);
+	GLint loc = getLocation(varname);
 	CHECK_SHADER_VAR(loc, varname);
 	glUniform1f(loc, input1);
 	assert(glGetError() == GL_NO_ERROR);
@@ -662,7 +786,7 @@ void Shader::setUniform1(const char* varname, const float input1)
 
 void Shader::setUniform2(const char* varname, const float input1, const float input2)
 {
-	GLint loc = getLocation(varname, &locations);
+	GLint loc = getLocation(varname);
 	CHECK_SHADER_VAR(loc, varname);
 	glUniform2f(loc, input1, input2);
 	assert(glGetError() == GL_NO_ERROR);
@@ -670,7 +794,7 @@ void Shader::setUniform2(const char* varname, const float input1, const float in
 
 void Shader::setUniform3(const char* varname, const float input1, const float input2, const float input3)
 {
-	GLint loc = getLocation(varname, &locations);
+	GLint loc = getLocation(varname);
 	CHECK_SHADER_VAR(loc, varname);
 	glUniform3f(loc, input1, input2, input3);
 	assert(glGetError() == GL_NO_ERROR);
@@ -678,7 +802,7 @@ void Shader::setUniform3(const char* varname, const float input1, const float in
 
 void Shader::setUniform4(const char* varname, const float input1, const float input2, const float input3, const float input4)
 {
-	GLint loc = getLocation(varname, &locations);
+	GLint loc = getLocation(varname);
 	CHECK_SHADER_VAR(loc, varname);
 	glUniform4f(loc, input1, input2, input3, input4);
 	checkGLErrors();
@@ -686,7 +810,7 @@ void Shader::setUniform4(const char* varname, const float input1, const float in
 
 void Shader::setUniform1Array(const char* varname, const float* input, const int count)
 {
-	GLint loc = getLocation(varname, &locations);
+	GLint loc = getLocation(varname);
 	CHECK_SHADER_VAR(loc, varname);
 	glUniform1fv(loc, count, input);
 	assert(glGetError() == GL_NO_ERROR);
@@ -694,7 +818,7 @@ void Shader::setUniform1Array(const char* varname, const float* input, const int
 
 void Shader::setUniform2Array(const char* varname, const float* input, const int count)
 {
-	GLint loc = getLocation(varname, &locations);
+	GLint loc = getLocation(varname);
 	CHECK_SHADER_VAR(loc, varname);
 	glUniform2fv(loc, count, input);
 	assert(glGetError() == GL_NO_ERROR);
@@ -702,7 +826,7 @@ void Shader::setUniform2Array(const char* varname, const float* input, const int
 
 void Shader::setUniform3Array(const char* varname, const float* input, const int count)
 {
-	GLint loc = getLocation(varname, &locations);
+	GLint loc = getLocation(varname);
 	CHECK_SHADER_VAR(loc, varname);
 	glUniform3fv(loc, count, input);
 	assert(glGetError() == GL_NO_ERROR);
@@ -710,7 +834,7 @@ void Shader::setUniform3Array(const char* varname, const float* input, const int
 
 void Shader::setUniform4Array(const char* varname, const float* input, const int count)
 {
-	GLint loc = getLocation(varname, &locations);
+	GLint loc = getLocation(varname);
 	CHECK_SHADER_VAR(loc, varname);
 	glUniform4fv(loc, count, input);
 	assert(glGetError() == GL_NO_ERROR);
@@ -718,7 +842,7 @@ void Shader::setUniform4Array(const char* varname, const float* input, const int
 
 void Shader::setMatrix44(const char* varname, const float* m)
 {
-	GLint loc = getLocation(varname, &locations);
+	GLint loc = getLocation(varname);
 	CHECK_SHADER_VAR(loc, varname);
 	glUniformMatrix4fv(loc, 1, GL_FALSE, m);
 	assert(glGetError() == GL_NO_ERROR);
@@ -726,7 +850,7 @@ void Shader::setMatrix44(const char* varname, const float* m)
 
 void Shader::setMatrix44(const char* varname, const Matrix44& m)
 {
-	GLint loc = getLocation(varname, &locations);
+	GLint loc = getLocation(varname);
 	CHECK_SHADER_VAR(loc, varname);
 	glUniformMatrix4fv(loc, 1, GL_FALSE, m.m);
 	assert(glGetError() == GL_NO_ERROR);
@@ -734,7 +858,7 @@ void Shader::setMatrix44(const char* varname, const Matrix44& m)
 
 void Shader::setMatrix44Array(const char* varname, Matrix44* m_array, int num)
 {
-	GLint loc = getLocation(varname, &locations);
+	GLint loc = getLocation(varname);
 	CHECK_SHADER_VAR(loc, varname);
 	glUniformMatrix4fv(loc, num, GL_FALSE, (GLfloat*)m_array);
 	assert(glGetError() == GL_NO_ERROR);
@@ -9,6 +9,8 @@
 #include <map>
 #include "framework/framework.h"
 #include <cassert>
+#include <vector>
+#include <type_traits>
 
 #ifdef _DEBUG
 #define CHECK_SHADER_VAR(a,b) if (a == -1) return
@@ -19,6 +21,37 @@
 
 class Texture;
 
+//FNV-1a hash of a shader variable name, evaluated at compile time when the name is a literal
+constexpr uint32_t hashShaderName(const char* name)
+{
+	uint32_t hash = 2166136261u;
+	while (*name)
+		hash = (hash ^ (uint8)*name++) * 16777619u;
+	return hash;
+}
+
+//handle to a uniform: the name is hashed at compile time and every different name gets
+//a slot, which indexes the location table of each program. Use the UNIFORM macro to create them.
+class UniformHandle
+{
+public:
+	uint32_t hash;
+	int slot;
+	const char* name;
+
+	UniformHandle(const char* name, uint32_t hash);
+
+	struct sSlot
+	{
+		uint32_t hash;
+		const char* name; //the first one using the slot
+	};
+	static std::vector<sSlot>& getSlots();
+};
+
+//one static handle per call site, initialized the first time it is used
+#define UNIFORM(name) ([]() -> const UniformHandle& { static const UniformHandle handle(name, std::integral_constant<uint32_t, hashShaderName(name)>::value); return handle; }())
+
 class Shader
 {
 	int last_slot;
@@ -49,6 +82,7 @@ public:
 	//check
 	virtual bool IsUniform(const char* varname) { return (getUniformLocation(varname) != -1); } //uniform exist
 	virtual bool IsAttribute(const char* varname) { return (getAttribLocation(varname) != -1); } //attribute exist
+	bool hasUniformBlock(int block) const { return (uniform_blocks & (1 << block)) != 0; } //eUniformBlock declared in the shader
 
 	//upload
 	void setUniform(const char* varname, bool input) { assert(current == this); setUniform1(varname, input); }
@@ -63,6 +97,17 @@ public:
 	//for textures you must specify an slot (a number from 0 to 16) where this texture is stored in the shader
 	void setUniform(const char* varname, Texture* texture, int slot) { assert(current == this); setTexture(varname, texture, slot); }
 
+	//upload using handles, the location is just an index in the table of the program
+	void setUniform(const UniformHandle& u, bool input) { assert(current == this); GLint loc = getLocation(u); CHECK_SHADER_VAR(loc, u.name); glUniform1i(loc, input); }
+	void setUniform(const UniformHandle& u, int input) { assert(current == this); GLint loc = getLocation(u); CHECK_SHADER_VAR(loc, u.name); glUniform1i(loc, input); }
+	void setUniform(const UniformHandle& u, float input) { assert(current == this); GLint loc = getLocation(u); CHECK_SHADER_VAR(loc, u.name); glUniform1f(loc, input); }
+	void setUniform(const UniformHandle& u, const Vector2& input) { assert(current == this); GLint loc = getLocation(u); CHECK_SHADER_VAR(loc, u.name); glUniform2f(loc, input.x, input.y); }
+	void setUniform(const UniformHandle& u, const Vector3& input) { assert(current == this); GLint loc = getLocation(u); CHECK_SHADER_VAR(loc, u.name); glUniform3f(loc, input.x, input.y, input.z); }
+	void setUniform(const UniformHandle& u, const Vector4& input) { assert(current == this); GLint loc = getLocation(u); CHECK_SHADER_VAR(loc, u.name); glUniform4f(loc, input.x, input.y, input.z, input.w); }
+	void setUniform(const UniformHandle& u, const Matrix44& input) { assert(current == this); GLint loc = getLocation(u); CHECK_SHADER_VAR(loc, u.name); glUniformMatrix4fv(loc, 1, GL_FALSE, input.m); }
+	void setUniform(const UniformHandle& u, std::vector<Matrix44>& m_vector) { assert(current == this && m_vector.size()); GLint loc = getLocation(u); CHECK_SHADER_VAR(loc, u.name); glUniformMatrix4fv(loc, (GLsizei)m_vector.size(), GL_FALSE, m_vector[0].m); }
+	void setUniform(const UniformHandle& u, Texture* texture, int slot);
+
 
 	virtual void setInt(const char* varname, const int& input) { setUniform1(varname, input); }
 	virtual void setFloat(const char* varname, const float& input) { setUniform1(varname, input); }
@@ -100,6 +145,7 @@ public:
 
 	virtual int getAttribLocation(const char* varname);
 	virtual int getUniformLocation(const char* varname);
+	int getUniformLocation(const UniformHandle& u) { return getLocation(u); }
 
 	std::string getInfoLog() const;
 	bool hasInfoLog() const;
@@ -113,6 +159,8 @@ public:
 
 	const std::string& getVSName() { return vs_filename; }
 	const std::string& getFSName() { return ps_filename; }
+	GLuint getProgram() const { return program; }
+	uint32_t getAttribSignature() const { return attrib_signature; } //same value for programs with the same attribute locations
 
 	//this is a way to load a single file that contains all the shaders 
 	//to know more about the file format, it is based in this https://github.com/jagenjo/rendeer.js/tree/master/guides#the-shaders but with tiny differences
@@ -137,6 +185,11 @@ protected:
 	void saveProgramInfoLog(GLuint obj);
 
 	bool validate();
+	void bindUniformBlocks(); //assigns the shared binding points to the blocks found
+	void buildLocationTables(); //reads all the active uniforms and attributes after linking
+
+	unsigned int uniform_blocks; //mask of eUniformBlock used by the program
+	uint32_t attrib_signature; //hash of the attribute names and locations
 
 	GLuint vs;
 	GLuint fs;
@@ -146,16 +199,22 @@ protected:
 	//this is a hack to speed up shader usage (save info locally)
 private:
 
-	struct ltstr
+	struct sLocation
 	{
-		bool operator()(const char* s1, const char* s2) const
-		{
-			return strcmp(s1, s2) < 0;
-		}
+		uint32_t hash;
+		GLint location;
+		bool operator<(const sLocation& other) const { return hash < other.hash; }
 	};
-	typedef std::map<const char*, int, ltstr> loctable;
+	typedef std::vector<sLocation> loctable; //sorted by hash
+
+	static GLint findLocation(const loctable& table, uint32_t hash);
+	static void checkHashCollisions(const loctable& table, const std::vector<std::string>& names);
+	GLint resolveLocation(const UniformHandle& u);
 
 public:
-	GLint getLocation(const char* varname, loctable* table);
+	GLint getLocation(const char* varname) { return varname ? findLocation(locations, hashShaderName(varname)) : 0; }
+	GLint getLocation(const UniformHandle& u) { return u.slot < (int)slot_locations.size() && slot_locations[u.slot] != -2 ? slot_locations[u.slot] : resolveLocation(u); }
 	loctable locations;
+	loctable attrib_locations;
+	std::vector<GLint> slot_locations; //indexed by UniformHandle::slot, -2 if not resolved yet
 };
\ No newline at end of file
@@ -0,0 +1,255 @@
+#include "static_batch.h"
+#include "shader.h"
+#include "framework/utils.h"
+
+#include <cassert>
+#include <cstring>
+
+const char* BATCHING_GLSL =
+	"in float a_draw_id;\n"
+	"uniform samplerBuffer u_draw_data;\n"
+	"mat4 batchModel() {\n"
+	"	int base = int(a_draw_id) * 5;\n"
+	"	return mat4(texelFetch(u_draw_data, base), texelFetch(u_draw_data, base + 1), texelFetch(u_draw_data, base + 2), texelFetch(u_draw_data, base + 3));\n"
+	"}\n"
+	"vec4 batchColor() { return texelFetch(u_draw_data, int(a_draw_id) * 5 + 4); }\n";
+
+StaticBatch::~StaticBatch()
+{
+	release();
+}
+
+bool StaticBatch::isSupported()
+{
+	static int supported = -1;
+	if (supported == -1)
+		supported = Mesh::useVertexArrays() && checkGLExtension("GL_ARB_multi_draw_indirect") && checkGLExtension("GL_ARB_base_instance") ? 1 : 0;
+	return supported == 1;
+}
+
+bool StaticBatch::canBatch(Mesh* mesh)
+{
+	//multi-material meshes change uniforms and textures between their draw calls, clustered meshes cull their own triangles
+	return mesh && (mesh->interleaved_vbo_id || mesh->quantized_vbo_id) && mesh->materials.empty() && mesh->clusters.empty() &&
+		!mesh->hasUVs1() && !mesh->hasColors() && !mesh->hasBones();
+}
+
+bool StaticBatch::supportsShader(Shader* shader)
+{
+	return shader->getAttribLocation("a_draw_id") != -1;
+}
+
+void StaticBatch::addMesh(Mesh* mesh)
+{
+	if (!canBatch(mesh) || contains(mesh))
+		return;
+	for (Mesh* pending : pending_meshes)
+		if (pending == mesh)
+			return;
+	pending_meshes.push_back(mesh);
+}
+
+void StaticBatch::build()
+{
+	if (!isSupported() || pending_meshes.empty())
+		return;
+	release();
+
+	std::vector<Mesh::tInterleaved> vertices;
+	std::vector<Vector3u> triangles;
+	for (Mesh* mesh : pending_meshes)
+	{
+		//the .mbin meshes only have them in VRAM, they are read from the file again
+		Mesh::sGeometry geometry;
+		if (!mesh->getGeometry(geometry) || !geometry.interleaved)
+			continue;
+
+		sBatchedMesh& batched = meshes[mesh];
+		batched.base_vertex = (GLint)vertices.size();
+		vertices.insert(vertices.end(), geometry.interleaved, geometry.interleaved + geometry.num_vertices);
+
+		//level 0, the triangle soups get sequential indices
+		batched.first_index.push_back((GLuint)triangles.size() * 3);
+		if (geometry.indices)
+			triangles.insert(triangles.end(), geometry.indices, geometry.indices + geometry.num_indices);
+		else
+			for (unsigned int i = 0; i + 2 < geometry.num_vertices; i += 3)
+				triangles.emplace_back(i, i + 1, i + 2);
+		batched.count.push_back((GLuint)triangles.size() * 3 - batched.first_index.back());
+
+		//simplified levels, indices are local to the mesh (base_vertex is added by the draw)
+		for (const sMeshLOD& level : mesh->lods)
+		{
+			batched.first_index.push_back((GLuint)triangles.size() * 3);
+			triangles.insert(triangles.end(), geometry.lod_indices + level.start, geometry.lod_indices + level.start + level.length);
+			batched.count.push_back(level.length * 3);
+		}
+	}
+	pending_meshes.clear();
+	if (vertices.empty())
+		return;
+
+	glGenBuffers(1, &vertices_vbo_id);
+	glBindBuffer(GL_ARRAY_BUFFER, vertices_vbo_id);
+	glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Mesh::tInterleaved), &vertices[0], GL_STATIC_DRAW);
+
+	glGenBuffers(1, &indices_vbo_id);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indices_vbo_id);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, triangles.size() * sizeof(Vector3u), &triangles[0], GL_STATIC_DRAW);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+	glGenBuffers(1, &indirect_buffer_id);
+	glGenBuffers(1, &draw_data_buffer_id);
+	glGenTextures(1, &draw_data_texture_id);
+	glBindBuffer(GL_TEXTURE_BUFFER, draw_data_buffer_id);
+	glBufferData(GL_TEXTURE_BUFFER, sizeof(Vector4) * BATCH_DRAW_TEXELS, nullptr, GL_STREAM_DRAW);
+	glBindTexture(GL_TEXTURE_BUFFER, draw_data_texture_id);
+	glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, draw_data_buffer_id);
+	glBindTexture(GL_TEXTURE_BUFFER, 0);
+	glBindBuffer(GL_TEXTURE_BUFFER, 0);
+	glGenBuffers(1, &draw_ids_vbo_id);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	std::cout << " + Static batch: " << meshes.size() << " meshes, " << vertices.size() << " vertices, " << triangles.size() << " triangles" << std::endl;
+}
+
+void StaticBatch::release()
+{
+	for (sVertexArray& va : vertex_arrays)
+		glDeleteVertexArrays(1, &va.vao);
+	vertex_arrays.clear();
+
+	GLuint* buffers[] = { &vertices_vbo_id, &indices_vbo_id, &draw_ids_vbo_id, &indirect_buffer_id, &draw_data_buffer_id };
+	for (GLuint* buffer : buffers)
+		if (*buffer)
+		{
+			glDeleteBuffers(1, buffer);
+			*buffer = 0;
+		}
+	if (draw_data_texture_id)
+	{
+		glDeleteTextures(1, &draw_data_texture_id);
+		draw_data_texture_id = 0;
+	}
+	max_draws = 0;
+
+	//keep the meshes so build can pack them again
+	for (auto& it : meshes)
+		pending_meshes.push_back(it.first);
+	meshes.clear();
+}
+
+void StaticBatch::add(Mesh* mesh, int lod, const Matrix44& model, const Vector4& color)
+{
+	auto it = meshes.find(mesh);
+	assert(it != meshes.end() && "mesh not in the batch");
+	const sBatchedMesh& batched = it->second;
+	if (lod < 0 || lod >= (int)batched.count.size())
+		lod = 0;
+
+	sDrawElementsIndirectCommand& command = commands.emplace_back();
+	command.count = batched.count[lod];
+	command.instance_count = 1;
+	command.first_index = batched.first_index[lod];
+	command.base_vertex = batched.base_vertex;
+	command.base_instance = (GLuint)(commands.size() - 1);
+
+	const float* m = model.m;
+	draw_data.emplace_back(m[0], m[1], m[2], m[3]);
+	draw_data.emplace_back(m[4], m[5], m[6], m[7]);
+	draw_data.emplace_back(m[8], m[9], m[10], m[11]);
+	draw_data.emplace_back(m[12], m[13], m[14], m[15]);
+	draw_data.push_back(color);
+}
+
+void StaticBatch::bindVertexArray(Shader* shader)
+{
+	uint32_t signature = shader->getAttribSignature();
+	for (sVertexArray& va : vertex_arrays)
+		if (va.signature == signature)
+		{
+			glBindVertexArray(va.vao);
+			return;
+		}
+
+	sVertexArray& va = vertex_arrays.emplace_back();
+	va.signature = signature;
+	glGenVertexArrays(1, &va.vao);
+	glBindVertexArray(va.vao);
+
+	//same layout as the interleaved meshes
+	const int stride = sizeof(Mesh::tInterleaved);
+	glBindBuffer(GL_ARRAY_BUFFER, vertices_vbo_id);
+	int vertex_location = shader->getAttribLocation("a_vertex");
+	if (vertex_location != -1)
+	{
+		glEnableVertexAttribArray(vertex_location);
+		glVertexAttribPointer(vertex_location, 3, GL_FLOAT, GL_FALSE, stride, (void*)0);
+	}
+	int normal_location = shader->getAttribLocation("a_normal");
+	if (normal_location != -1)
+	{
+		glEnableVertexAttribArray(normal_location);
+		glVertexAttribPointer(normal_location, 3, GL_FLOAT, GL_FALSE, stride, (void*)sizeof(Vector3));
+	}
+	int uv_location = shader->getAttribLocation("a_uv");
+	if (uv_location != -1)
+	{
+		glEnableVertexAttribArray(uv_location);
+		glVertexAttribPointer(uv_location, 2, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(Vector3) * 2));
+	}
+
+	//the base instance of every command selects its id
+	int draw_id_location = shader->getAttribLocation("a_draw_id");
+	glBindBuffer(GL_ARRAY_BUFFER, draw_ids_vbo_id);
+	glEnableVertexAttribArray(draw_id_location);
+	glVertexAttribPointer(draw_id_location, 1, GL_FLOAT, GL_FALSE, 0, (void*)0);
+	glVertexAttribDivisor(draw_id_location, 1);
+
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indices_vbo_id); //stored in the VAO
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void StaticBatch::flush(Shader* shader)
+{
+	if (commands.empty())
+		return;
+	assert(shader && supportsShader(shader));
+
+	//ids buffer only grows, the attribute pointer stays valid
+	if (commands.size() > max_draws)
+	{
+		max_draws = std::max(commands.size(), max_draws * 2);
+		std::vector<float> ids(max_draws);
+		for (size_t i = 0; i < max_draws; ++i)
+			ids[i] = (float)i;
+		glBindBuffer(GL_ARRAY_BUFFER, draw_ids_vbo_id);
+		glBufferData(GL_ARRAY_BUFFER, max_draws * sizeof(float), &ids[0], GL_STATIC_DRAW);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	}
+
+	//orphan and refill, the data of the previous run may still be in use
+	glBindBuffer(GL_TEXTURE_BUFFER, draw_data_buffer_id);
+	glBufferData(GL_TEXTURE_BUFFER, draw_data.size() * sizeof(Vector4), &draw_data[0], GL_STREAM_DRAW);
+	glBindBuffer(GL_TEXTURE_BUFFER, 0);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirect_buffer_id);
+	glBufferData(GL_DRAW_INDIRECT_BUFFER, commands.size() * sizeof(sDrawElementsIndirectCommand), &commands[0], GL_STREAM_DRAW);
+
+	glActiveTexture(GL_TEXTURE0 + BATCH_DATA_TEXTURE_UNIT);
+	glBindTexture(GL_TEXTURE_BUFFER, draw_data_texture_id);
+	shader->setUniform(UNIFORM("u_draw_data"), BATCH_DATA_TEXTURE_UNIT);
+	glActiveTexture(GL_TEXTURE0);
+
+	bindVertexArray(shader);
+	glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (void*)0, (GLsizei)commands.size(), 0);
+	glBindVertexArray(0);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+
+	//the whole run counts as one draw call
+	Mesh::num_meshes_rendered++;
+	for (const sDrawElementsIndirectCommand& command : commands)
+		Mesh::num_triangles_rendered += command.count / 3;
+
+	commands.clear();
+	draw_data.clear();
+}
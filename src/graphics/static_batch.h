@@ -0,0 +1,80 @@
+/*  Static batching: the static meshes of the scene with the same vertex format are packed in a
+	single vertex and index buffer at load time, so consecutive draws with the same render state go
+	out in a single glMultiDrawElementsIndirect. The per draw data (model and color) is read in the
+	vertex shader from a buffer texture, using the draw index that comes as an instanced attribute.
+	To use it in a shader add #include "batching" (needs #version 140) and use batchModel()/batchColor().
+*/
+
+#pragma once
+
+#include "framework/includes.h"
+#include "framework/framework.h"
+#include "mesh.h"
+#include <vector>
+#include <unordered_map>
+
+class Shader;
+
+#define BATCH_DRAW_TEXELS 5			//RGBA32F texels per draw: model (4) and color
+#define BATCH_DATA_TEXTURE_UNIT 7	//texture unit of the per draw data
+
+//layout defined by GL_ARB_draw_indirect
+struct sDrawElementsIndirectCommand {
+	GLuint count;
+	GLuint instance_count;
+	GLuint first_index;
+	GLint base_vertex;
+	GLuint base_instance;	//used as draw index
+};
+
+//where a mesh is inside the shared buffers
+struct sBatchedMesh {
+	GLint base_vertex;
+	std::vector<GLuint> first_index;	//per level of detail
+	std::vector<GLuint> count;
+};
+
+//GLSL helpers
+extern const char* BATCHING_GLSL;
+
+class StaticBatch
+{
+public:
+	GLuint vertices_vbo_id = 0;
+	GLuint indices_vbo_id = 0;
+	GLuint draw_ids_vbo_id = 0;		//0, 1, 2... as instanced attribute, grows with the draws
+	GLuint indirect_buffer_id = 0;
+	GLuint draw_data_buffer_id = 0;
+	GLuint draw_data_texture_id = 0;
+	size_t max_draws = 0;			//ids in draw_ids_vbo_id
+
+	std::unordered_map<Mesh*, sBatchedMesh> meshes;
+	std::vector<Mesh*> pending_meshes;	//added but not built yet
+
+	//draws of the current run, sent on flush
+	std::vector<sDrawElementsIndirectCommand> commands;
+	std::vector<Vector4> draw_data;
+
+	~StaticBatch();
+
+	static bool isSupported();
+	static bool canBatch(Mesh* mesh);	//interleaved, in VRAM, without per vertex extras or materials
+
+	void addMesh(Mesh* mesh);
+	//packs all the added meshes in the shared buffers, call it once the scene is loaded
+	void build();
+	void release();
+	bool isReady() const { return vertices_vbo_id != 0; }
+	bool contains(Mesh* mesh) const { return meshes.find(mesh) != meshes.end(); }
+	static bool supportsShader(Shader* shader);
+
+	//accumulates a draw, nothing is sent until flush
+	void add(Mesh* mesh, int lod, const Matrix44& model, const Vector4& color);
+	bool hasPending() const { return !commands.empty(); }
+	//sends all the accumulated draws with the current shader in a single call
+	void flush(Shader* shader);
+
+private:
+	std::vector<sVertexArray> vertex_arrays; //per attribute signature, like the meshes
+	void bindVertexArray(Shader* shader);
+};
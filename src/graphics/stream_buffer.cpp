@@ -0,0 +1,147 @@
+#include "stream_buffer.h"
+#include "framework/utils.h"
+
+#include <cassert>
+#include <cstring>
+
+long StreamBuffer::num_stalls = 0;
+
+StreamBuffer::StreamBuffer(size_t region_size, GLenum target)
+{
+	this->region_size = region_size;
+	this->target = target;
+	buffer_id = 0;
+	mapped = nullptr;
+	persistent = false;
+	create();
+}
+
+StreamBuffer::~StreamBuffer()
+{
+	release();
+}
+
+bool StreamBuffer::isPersistentSupported()
+{
+	static int supported = -1;
+	if (supported == -1)
+		supported = checkGLExtension("GL_ARB_buffer_storage") ? 1 : 0;
+	return supported == 1;
+}
+
+void StreamBuffer::create()
+{
+	size_t total_size = region_size * STREAM_BUFFER_FRAMES;
+	head = 0;
+	frame = 0;
+	for (int i = 0; i < STREAM_BUFFER_FRAMES; ++i)
+		fences[i] = 0;
+
+	glGenBuffers(1, &buffer_id);
+	glBindBuffer(target, buffer_id);
+
+	persistent = isPersistentSupported();
+	if (persistent)
+	{
+		GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		glBufferStorage(target, total_size, nullptr, flags);
+		mapped = (uint8*)glMapBufferRange(target, 0, total_size, flags);
+		assert(mapped && "persistent mapping failed");
+	}
+	else
+		glBufferData(target, total_size, nullptr, GL_STREAM_DRAW);
+}
+
+void StreamBuffer::release()
+{
+	for (int i = 0; i < STREAM_BUFFER_FRAMES; ++i)
+		if (fences[i])
+		{
+			glDeleteSync(fences[i]);
+			fences[i] = 0;
+		}
+
+	if (!buffer_id)
+		return;
+	if (mapped)
+	{
+		glBindBuffer(target, buffer_id);
+		glUnmapBuffer(target);
+		mapped = nullptr;
+	}
+	glDeleteBuffers(1, &buffer_id);
+	buffer_id = 0;
+}
+
+void StreamBuffer::waitRegion(int region)
+{
+	GLsync& fence = fences[region];
+	if (!fence)
+		return;
+
+	//usually signaled long ago, the region was used STREAM_BUFFER_FRAMES frames before
+	GLenum result = glClientWaitSync(fence, 0, 0);
+	if (result == GL_TIMEOUT_EXPIRED)
+	{
+		num_stalls++;
+		do {
+			result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000); //1ms
+		} while (result == GL_TIMEOUT_EXPIRED);
+	}
+	glDeleteSync(fence);
+	fence = 0;
+}
+
+size_t StreamBuffer::upload(const void* data, size_t size, size_t alignment)
+{
+	size_t offset = ((head + alignment - 1) / alignment) * alignment;
+
+	//region too small for this frame, grow it. The old buffer is kept alive by the driver while in use
+	if (offset + size > region_size)
+	{
+		size_t new_size = region_size * 2;
+		while (new_size < size)
+			new_size *= 2;
+		release();
+		region_size = new_size;
+		create();
+		offset = 0;
+	}
+
+	//first write in this region since it was fenced
+	if (head == 0)
+		waitRegion(frame);
+
+	size_t buffer_offset = frame * region_size + offset;
+	glBindBuffer(target, buffer_id);
+	if (persistent)
+		memcpy(mapped + buffer_offset, data, size);
+	else
+	{
+		void* ptr = glMapBufferRange(target, buffer_offset, size, GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_INVALIDATE_RANGE_BIT);
+		assert(ptr && "cannot map stream buffer");
+		memcpy(ptr, data, size);
+		glUnmapBuffer(target);
+	}
+
+	head = offset + size;
+	return buffer_offset;
+}
+
+void StreamBuffer::endFrame()
+{
+	if (head == 0)
+		return; //nothing written, keep using the same region
+
+	fences[frame] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	frame = (frame + 1) % STREAM_BUFFER_FRAMES;
+	head = 0;
+}
+
+StreamBuffer* StreamBuffer::Get()
+{
+	static StreamBuffer* stream = nullptr;
+	if (!stream)
+		stream = new StreamBuffer(1024 * 1024); //1MB per frame, grows if needed
+	return stream;
+}
@@ -0,0 +1,45 @@
+/*  Streaming ring buffer for data that changes every frame (instances, particles, text...).
+	The buffer is split in one region per frame in flight, every region is protected by a fence
+	so the CPU never writes over data the GPU is still reading and never has to wait for it.
+	Uses a persistent mapping (GL_ARB_buffer_storage) when available, if not it maps the
+	ranges unsynchronized.
+*/
+
+#pragma once
+
+#include "framework/includes.h"
+#include "framework/framework.h"
+
+#define STREAM_BUFFER_FRAMES 3
+
+class StreamBuffer
+{
+public:
+	static long num_stalls; //times the CPU had to wait for a fence, reset with the GPU stats
+
+	GLuint buffer_id;
+	GLenum target;
+	size_t region_size;		//bytes available per frame
+	size_t head;			//next free byte in the current region
+	int frame;				//current region
+	bool persistent;
+	uint8* mapped;			//only when persistent
+	GLsync fences[STREAM_BUFFER_FRAMES];
+
+	StreamBuffer(size_t region_size, GLenum target = GL_ARRAY_BUFFER);
+	~StreamBuffer();
+
+	//copies the data and returns its offset inside the buffer, which is left bound to the target
+	size_t upload(const void* data, size_t size, size_t alignment = 16);
+
+	//call once the frame has been submitted, fences the region used and moves to the next one
+	void endFrame();
+
+	static bool isPersistentSupported();
+	static StreamBuffer* Get(); //global buffer for dynamic vertex data
+
+private:
+	void create();
+	void release();
+	void waitRegion(int region);
+};
@@ -179,48 +179,20 @@ Texture* Texture::Get(const char* filename, bool mipmaps, bool wrap)
 
 bool Texture::load(const char* filename, bool mipmaps, bool wrap, unsigned int type)
 {
-	std::string str = filename;
-	std::string ext = str.substr(str.size() - 4, 4);
-	Image* image = NULL;
 	long time = getTime();
 
 	std::cout << " + Texture loading: " << filename << " ... ";
 
-	image = new Image();
-	bool found = false;
-
-	if (ext == ".tga" || ext == ".TGA")
-		found = image->loadTGA(filename);
-	else if (ext == ".png" || ext == ".PNG")
-		found = image->loadPNG(filename, true);
-	else
-	{
-		std::cout << "[ERROR]: unsupported format" << std::endl;
-		return false; //unsupported file type
-	}
-
-	if (!found) //file not found
+	Image image;
+	if (!image.load(filename))
 	{
 		std::cout << " [ERROR]: Texture not found " << std::endl;
 		return false;
 	}
 
 	this->filename = filename;
+	createFromImage(&image, mipmaps, wrap, type);
 
-	unsigned int internal_format = 0;
-
-	if (type == GL_FLOAT)
-		internal_format = (image->bytes_per_pixel == 3 ? GL_RGB32F : GL_RGBA32F);
-
-	//upload to VRAM
-	create(image->width, image->height, (image->bytes_per_pixel == 3 ? GL_RGB : GL_RGBA), type, mipmaps, image->data, 0);
-
-	glTexParameteri(this->texture_type, GL_TEXTURE_WRAP_S, this->mipmaps && wrap ? GL_REPEAT : GL_CLAMP_TO_EDGE);
-	glTexParameteri(this->texture_type, GL_TEXTURE_WRAP_T, this->mipmaps && wrap ? GL_REPEAT : GL_CLAMP_TO_EDGE);
-	if (mipmaps)
-		generateMipmaps();
-
-	this->image.clear();
 	std::cout << "[OK] Size: " << width << "x" << height << " Time: " << (getTime() - time) * 0.001 << "sec" << std::endl;
 	setName(filename);
 	return true;
@@ -229,46 +201,52 @@ bool Texture::load(const char* filename, bool mipmaps, bool wrap, unsigned int t
 bool Texture::loadCubemap(const char* name, std::vector<std::string> faces, bool mipmaps, bool wrap, unsigned int type)
 {
 	long time = getTime();
-	std::vector <Uint8*> imageData;
-
-	Image* image = NULL;
+	assert(faces.size() == 6);
 
+	Image images[6];
+	Image* face_images[6];
 	for (unsigned int i = 0; i < faces.size(); i++)
 	{
-		std::string str = faces[i].c_str();
-		std::string ext = str.substr(str.size() - 4, 4);
-
 		std::cout << " + Cubemap Face loading: " << faces[i].c_str() << "\n";
-
-		image = new Image();
-		bool found = false;
-
-		if (ext == ".tga" || ext == ".TGA")
-			found = image->loadTGA(faces[i].c_str());
-		else if (ext == ".png" || ext == ".PNG")
-			found = image->loadPNG(faces[i].c_str(), true);
-		else
-		{
-			std::cout << "[ERROR]: unsupported format" << std::endl;
-			return false; //unsupported file type
-		}
-
-		if (!found) //file not found
+		if (!images[i].load(faces[i].c_str()))
 		{
 			std::cout << " [ERROR]: Texture not found " << std::endl;
 			return false;
 		}
-
-		imageData.push_back(image->data);
+		face_images[i] = &images[i];
 	}
 
-	unsigned int internal_format = 0;
+	createCubemapFromImages(face_images, mipmaps, wrap, type);
 
-	if (type == GL_FLOAT)
-		internal_format = (image->bytes_per_pixel == 3 ? GL_RGB32F : GL_RGBA32F);
+	std::cout << "[OK] Size: " << width << "x" << height << " Time: " << (getTime() - time) * 0.001 << "sec" << std::endl;
+	setName(name);
+	return true;
+}
+
+void Texture::createFromImage(Image* image, bool mipmaps, bool wrap, unsigned int type)
+{
+	//upload to VRAM
+	create(image->width, image->height, (image->bytes_per_pixel == 3 ? GL_RGB : GL_RGBA), type, mipmaps, image->data, 0);
+
+	glTexParameteri(this->texture_type, GL_TEXTURE_WRAP_S, this->mipmaps && wrap ? GL_REPEAT : GL_CLAMP_TO_EDGE);
+	glTexParameteri(this->texture_type, GL_TEXTURE_WRAP_T, this->mipmaps && wrap ? GL_REPEAT : GL_CLAMP_TO_EDGE);
+	if (mipmaps)
+		generateMipmaps();
+
+	this->image.clear();
+}
+
+void Texture::createCubemapFromImages(Image** faces, bool mipmaps, bool wrap, unsigned int type)
+{
+	Uint8* data[6];
+	for (int i = 0; i < 6; ++i)
+	{
+		assert(faces[i]->width == faces[0]->width && faces[i]->bytes_per_pixel == faces[0]->bytes_per_pixel && "cubemap faces must match");
+		data[i] = faces[i]->data;
+	}
 
 	// Upload to VRAM
-	createCubemap(image->width, image->height, imageData.data(), (image->bytes_per_pixel == 3 ? GL_RGB : GL_RGBA), type, mipmaps, 0);
+	createCubemap(faces[0]->width, faces[0]->height, data, (faces[0]->bytes_per_pixel == 3 ? GL_RGB : GL_RGBA), type, mipmaps, 0);
 
 	glTexParameteri(this->texture_type, GL_TEXTURE_WRAP_S, this->mipmaps && wrap ? GL_REPEAT : GL_CLAMP_TO_EDGE);
 	glTexParameteri(this->texture_type, GL_TEXTURE_WRAP_T, this->mipmaps && wrap ? GL_REPEAT : GL_CLAMP_TO_EDGE);
@@ -276,9 +254,6 @@ bool Texture::loadCubemap(const char* name, std::vector<std::string> faces, bool
 		generateMipmaps();
 
 	this->image.clear();
-	std::cout << "[OK] Size: " << width << "x" << height << " Time: " << (getTime() - time) * 0.001 << "sec" << std::endl;
-	setName(name);
-	return true;
 }
 
 void Texture::upload(Image* img)
@@ -462,7 +437,7 @@ void Texture::toViewport(Shader* shader)
 	if (!shader)
 		shader = Shader::getDefaultShader("screen");
 	shader->enable();
-	shader->setUniform("u_texture", this, 0);
+	shader->setUniform(UNIFORM("u_texture"), this, 0);
 	quad->render(GL_TRIANGLES);
 	shader->disable();
 }
@@ -624,6 +599,18 @@ bool Image::loadTGA(const char* filename)
 #include <iostream>
 #include <fstream>
 
+bool Image::load(const char* filename)
+{
+	std::string str = filename;
+	std::string ext = str.size() > 4 ? str.substr(str.size() - 4, 4) : "";
+	if (ext == ".tga" || ext == ".TGA")
+		return loadTGA(filename);
+	if (ext == ".png" || ext == ".PNG")
+		return loadPNG(filename, true);
+	std::cout << "[ERROR]: unsupported format " << filename << std::endl;
+	return false;
+}
+
 bool Image::loadPNG(const char* filename, bool flip_y)
 {
 	std::ifstream file(filename, std::ios::in | std::ios::binary | std::ios::ate);
@@ -48,6 +48,7 @@ public:
 	void fromTexture(Texture* texture);
 	void fromScreen(int width, int height);
 
+	bool load(const char* filename); //tga or png (flipped as the textures expect it), only CPU work so it can run in any thread
 	bool loadTGA(const char* filename);
 	bool loadPNG(const char* filename, bool flip_y = false);
 	bool saveTGA(const char* filename, bool flip_y = true);
@@ -113,6 +114,10 @@ public:
 	bool load(const char* filename, bool mipmaps = true, bool wrap = true, unsigned int type = GL_UNSIGNED_BYTE);
 	bool loadCubemap(const char* name, std::vector<std::string> faces, bool mipmaps = true, bool wrap = true, unsigned int type = GL_UNSIGNED_BYTE);
 
+	//GL part of the loaders, the images are decoded before (in the AssetLoader workers)
+	void createFromImage(Image* image, bool mipmaps = true, bool wrap = true, unsigned int type = GL_UNSIGNED_BYTE);
+	void createCubemapFromImages(Image** faces, bool mipmaps = true, bool wrap = true, unsigned int type = GL_UNSIGNED_BYTE); //6 faces
+
 	//load using the manager (caching loaded ones to avoid reloading them)
 	static Texture* Get(const char* filename, bool mipmaps = true, bool wrap = true);
 	void setName(const char* name) { sTexturesLoaded[name] = this; }
@@ -0,0 +1,221 @@
+#include "uniform_buffer.h"
+#include "stream_buffer.h"
+#include "framework/utils.h"
+#include "framework/camera.h"
+
+#include <cassert>
+#include <cstdio>
+
+const char* UniformBuffer::block_names[UBLOCK_COUNT] = { "u_camera_block", "u_lights_block", "u_viewport_block", "u_object_block", "u_views_block", "u_material_block", "u_bones_block" };
+
+const char* UNIFORM_BLOCKS_GLSL =
+	"#extension GL_ARB_uniform_buffer_object : enable\n"
+	"layout(std140) uniform u_camera_block {\n"
+	"	mat4 u_viewprojection;\n"
+	"	vec3 u_camera_position;\n"
+	"	float u_time;\n"
+	"};\n"
+	"layout(std140) uniform u_lights_block {\n"
+	"	vec3 u_light_position;\n"
+	"	float u_ambient;\n"
+	"	vec3 u_light_color;\n"
+	"	float u_diffuse;\n"
+	"	vec3 u_light2_position;\n"
+	"	float u_specular;\n"
+	"	vec3 u_light2_color;\n"
+	"	float u_shininess;\n"
+	"};\n"
+	"layout(std140) uniform u_viewport_block {\n"
+	"	vec4 u_viewport;\n"
+	"	vec2 u_camera_nearfar;\n"
+	"	vec2 u_viewport_inv;\n"
+	"};\n"
+	"layout(std140) uniform u_object_block {\n"
+	"	mat4 u_model;\n"
+	"	vec4 u_color;\n"
+	"	int u_first_view;\n"
+	"};\n"
+	"layout(std140) uniform u_material_block {\n"
+	"	vec3 u_Ka;\n"
+	"	vec3 u_Kd;\n"
+	"	vec3 u_Ks;\n"
+	"	vec2 u_maps;\n"
+	"};\n";
+
+const char* SKINNING_GLSL =
+	"#extension GL_ARB_uniform_buffer_object : enable\n"
+	"layout(std140) uniform u_bones_block {\n"
+	"	mat4 u_bones[128];\n"
+	"};\n";
+
+//every instance of a draw goes to the next view, either with gl_ViewportIndex or squeezed into its rect and clipped
+const char* MULTIVIEW_GLSL =
+	"#extension GL_ARB_shader_viewport_layer_array : enable\n"
+	"layout(std140) uniform u_views_block {\n"
+	"	mat4 u_views_viewprojection[4];\n"
+	"	vec4 u_views_eye[4];\n"
+	"	vec4 u_views_rect[4];\n"
+	"};\n"
+	"int multiviewIndex() { return u_first_view + gl_InstanceID; }\n"
+	"vec4 multiviewPosition(vec3 world_position) {\n"
+	"	int view = multiviewIndex();\n"
+	"	vec4 clip = u_views_viewprojection[view] * vec4(world_position, 1.0);\n"
+	"#ifdef GL_ARB_shader_viewport_layer_array\n"
+	"	gl_ViewportIndex = view;\n"
+	"#else\n"
+	"	gl_ClipDistance[0] = clip.w + clip.x;\n"
+	"	gl_ClipDistance[1] = clip.w - clip.x;\n"
+	"	gl_ClipDistance[2] = clip.w + clip.y;\n"
+	"	gl_ClipDistance[3] = clip.w - clip.y;\n"
+	"	clip.xy = clip.xy * u_views_rect[view].xy + clip.w * u_views_rect[view].zw;\n"
+	"#endif\n"
+	"	return clip;\n"
+	"}\n";
+
+UniformBuffer::UniformBuffer(unsigned int binding)
+{
+	this->binding = binding;
+	capacity = 0;
+	ring = nullptr;
+	glGenBuffers(1, &buffer_id);
+}
+
+UniformBuffer::~UniformBuffer()
+{
+	if (buffer_id)
+		glDeleteBuffers(1, &buffer_id);
+	delete ring;
+}
+
+void UniformBuffer::upload(const void* data, size_t size)
+{
+	glBindBuffer(GL_UNIFORM_BUFFER, buffer_id);
+	if (size > capacity)
+	{
+		glBufferData(GL_UNIFORM_BUFFER, size, data, GL_DYNAMIC_DRAW);
+		capacity = size;
+	}
+	else
+		glBufferSubData(GL_UNIFORM_BUFFER, 0, size, data);
+	glBindBufferBase(GL_UNIFORM_BUFFER, binding, buffer_id);
+}
+
+size_t UniformBuffer::stream(const void* data, size_t size)
+{
+	//rewriting the buffer of the previous flush would wait for its draws or make the driver copy it
+	if (!ring)
+		ring = new StreamBuffer(UBLOCK_STREAM_REGION, GL_UNIFORM_BUFFER);
+	return ring->upload(data, size, getOffsetAlignment());
+}
+
+void UniformBuffer::bindRange(size_t offset, size_t size)
+{
+	if (ring)
+	{
+		assert(offset + size <= ring->region_size * STREAM_BUFFER_FRAMES);
+		glBindBufferRange(GL_UNIFORM_BUFFER, binding, ring->buffer_id, offset, size);
+		return;
+	}
+	assert(offset + size <= capacity);
+	glBindBufferRange(GL_UNIFORM_BUFFER, binding, buffer_id, offset, size);
+}
+
+bool UniformBuffer::isSupported()
+{
+	static int supported = -1;
+	if (supported == -1)
+		supported = checkGLExtension("GL_ARB_uniform_buffer_object") ? 1 : 0;
+	return supported == 1;
+}
+
+bool UniformBuffer::isMultiviewSupported()
+{
+	static int supported = -1;
+	if (supported == -1)
+	{
+		int major = 0, minor = 0;
+		const char* version = (const char*)glGetString(GL_VERSION);
+		if (version)
+			sscanf(version, "%d.%d", &major, &minor);
+		supported = isSupported() && (major > 3 || (major == 3 && minor >= 1)) ? 1 : 0;
+	}
+	return supported == 1;
+}
+
+bool UniformBuffer::useViewportIndex()
+{
+	//must match the #ifdef of MULTIVIEW_GLSL
+	static int supported = -1;
+	if (supported == -1)
+		supported = checkGLExtension("GL_ARB_viewport_array") && checkGLExtension("GL_ARB_shader_viewport_layer_array") ? 1 : 0;
+	return supported == 1;
+}
+
+int UniformBuffer::getOffsetAlignment()
+{
+	static GLint alignment = 0;
+	if (!alignment)
+	{
+		glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+		if (alignment <= 0)
+			alignment = 256; //worst case in the spec
+	}
+	return alignment;
+}
+
+static UniformBuffer* buffers[UBLOCK_COUNT] = {};
+
+UniformBuffer* UniformBuffer::Get(eUniformBlock block)
+{
+	assert(block < UBLOCK_COUNT);
+	if (!buffers[block])
+		buffers[block] = new UniformBuffer(block);
+	return buffers[block];
+}
+
+void UniformBuffer::EndFrame()
+{
+	for (int i = 0; i < UBLOCK_COUNT; ++i)
+		if (buffers[i] && buffers[i]->ring)
+			buffers[i]->ring->endFrame();
+}
+
+void UniformBuffer::UploadCamera(Camera* camera, float time)
+{
+	if (!isSupported())
+		return;
+	sCameraBlock block;
+	block.viewprojection = camera->viewprojection_matrix;
+	block.camera_position = camera->eye;
+	block.time = time;
+	Get(UBLOCK_CAMERA)->upload(&block, sizeof(block));
+}
+
+void UniformBuffer::UploadViewport(Camera* camera, int x, int y, int width, int height)
+{
+	if (!isSupported())
+		return;
+	sViewportBlock block;
+	block.viewport.set((float)x, (float)y, (float)width, (float)height);
+	block.camera_nearfar.set(camera->near_plane, camera->far_plane);
+	block.viewport_inv.set(1.0f / width, 1.0f / height);
+	Get(UBLOCK_VIEWPORT)->upload(&block, sizeof(block));
+}
+
+void UniformBuffer::UploadViews(Camera* const* cameras, const int* viewports, int num_views, int target_width, int target_height)
+{
+	assert(num_views <= MULTIVIEW_MAX_VIEWS);
+	if (!isSupported())
+		return;
+	sViewsBlock block;
+	for (int i = 0; i < num_views; ++i)
+	{
+		const int* viewport = viewports + i * 4;
+		float scale_x = viewport[2] / (float)target_width;
+		float scale_y = viewport[3] / (float)target_height;
+		block.viewprojection[i] = cameras[i]->viewprojection_matrix;
+		block.eye[i] = Vector4(cameras[i]->eye, 1.0f);
+		block.rect[i].set(scale_x, scale_y, 2.0f * viewport[0] / target_width + scale_x - 1.0f, 2.0f * viewport[1] / target_height + scale_y - 1.0f);
+	}
+	Get(UBLOCK_VIEWS)->upload(&block, sizeof(block));
+}
@@ -0,0 +1,121 @@
+/*  Uniform buffer objects (std140) shared by all the shader programs.
+	Every block has a fixed binding point, so its data is uploaded once and any program
+	declaring the block reads it, no need to call setUniform on every program.
+	To use them in a shader add #include "uniform_blocks" (and remove the loose uniforms).
+*/
+
+#pragma once
+
+#include "framework/includes.h"
+#include "framework/framework.h"
+
+class Camera;
+class StreamBuffer;
+
+enum eUniformBlock {
+	UBLOCK_CAMERA = 0,	//per view: viewprojection, eye and time
+	UBLOCK_LIGHTS,		//per frame: lights and default material constants
+	UBLOCK_VIEWPORT,	//per view: viewport rect and camera planes
+	UBLOCK_OBJECT,		//per draw: model and color
+	UBLOCK_VIEWS,		//per frame: cameras of all the views, for single pass split screen
+	UBLOCK_MATERIAL,	//per submesh draw call: constants of the MTL materials, uploaded once at load
+	UBLOCK_BONES,		//per skinned draw: bone matrices of the pose, uploaded once per animation update
+	UBLOCK_COUNT
+};
+
+#define MULTIVIEW_MAX_VIEWS 4
+#define SKINNING_MAX_BONES 128	//same limit as the skeletons
+#define UBLOCK_STREAM_REGION (256 * 1024)	//bytes per frame of the streamed blocks, grows if needed
+
+//std140 layouts, keep them in sync with UNIFORM_BLOCKS_GLSL
+struct sCameraBlock {
+	Matrix44 viewprojection;
+	Vector3 camera_position;
+	float time;
+};
+
+struct sLightsBlock {
+	Vector3 light_position;
+	float ambient;
+	Vector3 light_color;
+	float diffuse;
+	Vector3 light2_position;
+	float specular;
+	Vector3 light2_color;
+	float shininess;
+};
+
+struct sViewportBlock {
+	Vector4 viewport;		//x, y, width, height
+	Vector2 camera_nearfar;
+	Vector2 viewport_inv;	//1/width, 1/height
+};
+
+struct sObjectBlock {
+	Matrix44 model;
+	Vector4 color;
+	int first_view;			//multiview draws: view of the first instance
+	int padding[3];
+};
+
+struct sMaterialBlock {
+	Vector3 Ka;
+	float padding0;
+	Vector3 Kd;
+	float padding1;
+	Vector3 Ks;
+	float padding2;
+	Vector2 maps;			//x: has diffuse texture
+	Vector2 padding3;
+};
+
+struct sViewsBlock {
+	Matrix44 viewprojection[MULTIVIEW_MAX_VIEWS];
+	Vector4 eye[MULTIVIEW_MAX_VIEWS];
+	Vector4 rect[MULTIVIEW_MAX_VIEWS];	//clip space scale (xy) and offset (zw) of the view inside the target
+};
+
+struct sBonesBlock {
+	Matrix44 bones[SKINNING_MAX_BONES];
+};
+
+//GLSL declaration of the blocks
+extern const char* UNIFORM_BLOCKS_GLSL;
+//u_bones as a block instead of a loose array, #include "skinning"
+extern const char* SKINNING_GLSL;
+//multiview helpers, #include "multiview" after the blocks (needs #version 140)
+extern const char* MULTIVIEW_GLSL;
+
+class UniformBuffer
+{
+public:
+	static const char* block_names[UBLOCK_COUNT];
+
+	GLuint buffer_id;
+	unsigned int binding;	//binding point
+	size_t capacity;		//bytes allocated in the GPU
+	StreamBuffer* ring;		//only the blocks written with stream
+
+	UniformBuffer(unsigned int binding);
+	~UniformBuffer();
+
+	//replaces the content and binds the whole buffer to its binding point
+	void upload(const void* data, size_t size);
+	//per draw blocks: copies the data where no draw in flight reads, returns its offset for bindRange
+	size_t stream(const void* data, size_t size);
+	//binds only a range (offset must be multiple of getOffsetAlignment), of the ring once the block is streamed
+	void bindRange(size_t offset, size_t size);
+
+	static bool isSupported();
+	static bool isMultiviewSupported();	//instancing and clip distances (GL 3.1)
+	static bool useViewportIndex();		//views as viewport array entries instead of clipping
+	static int getOffsetAlignment();
+	static UniformBuffer* Get(eUniformBlock block);
+	static void EndFrame(); //fences the rings of the streamed blocks, call it once the frame has been submitted
+
+	//helpers to fill the per view blocks
+	static void UploadCamera(Camera* camera, float time);
+	static void UploadViewport(Camera* camera, int x, int y, int width, int height);
+	//viewports are x, y, width, height for every view, relative to the target rect
+	static void UploadViews(Camera* const* cameras, const int* viewports, int num_views, int target_width, int target_height);
+};